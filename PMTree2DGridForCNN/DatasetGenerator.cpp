@@ -0,0 +1,786 @@
+#include "DatasetGenerator.h"
+#include "RenderManager.h"
+#include "RenderBackend.h"
+#include "Camera.h"
+#include "PMTree2D.h"
+#include <QDir>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <glm/gtc/matrix_transform.hpp>
+#include <QFile>
+#include <QTextStream>
+#include <QStringList>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+DatasetGenerator::DatasetGenerator(RenderManager* renderManager, RenderBackend* backend, Camera* camera, const glm::vec3& light_dir, pmtree::PMTree2D* tree) {
+	this->renderManager = renderManager;
+	this->backend = backend;
+	this->camera = camera;
+	this->light_dir = light_dir;
+	this->tree = tree;
+	outputWidth = 2560;
+	outputHeight = 2560;
+	maxTileSize = 4096;
+	guard = 32;
+	atlasSize = 1;
+	atlasCols = 0;
+	atlasRows = 0;
+	stripTop = 0;
+	nextPatchRow = 0;
+	treeIndex = -1;
+	firstTree = 0;
+	rangeSize = 0;
+	seed = 2;
+	reportProgress = false;
+	profileName = "profile";
+	useSoftware = false;
+	validateTrees = 0;
+	validatedTrees = 0;
+	useLabelMap = false;
+}
+
+/**
+ * Generate random trees, and store the patches of the line drawings with the type of the patch.
+ * The trees are generated in ranges of rangeSize trees, each of which is a directory with its own
+ * manifest. Each tree has its own seed, so a range is the same no matter which process generates
+ * it, and the ranges that have been completed with the same parameters are skipped. If rangeSize
+ * is 0, the trees are one range stored in baseResultDir itself.
+ *
+ * @param baseResultDir		output directory
+ * @param numTrees			number of trees from firstTree
+ * @return					true if all the ranges are complete
+ */
+bool DatasetGenerator::generateTrainingData(const QString& baseResultDir, int numTrees) {
+	QDir().mkpath(baseResultDir);
+
+	Profiler& profiler = renderManager->profiler;
+	profiler.clear();
+
+	// the quota is for the trees of this run unless the coordinator gives the whole run
+	if (sampler.spanTrees <= 0) {
+		sampler.spanFirst = firstTree;
+		sampler.spanTrees = numTrees;
+	}
+
+	bool succeeded = true;
+	int endTree = firstTree + numTrees;
+	for (int first = firstTree; first < endTree;) {
+		// the ranges are aligned to rangeSize, so that separate runs split the trees in the same way
+		int end = endTree;
+		QString rangeDir = baseResultDir;
+		if (rangeSize > 0) {
+			end = (std::min)((first / rangeSize + 1) * rangeSize, endTree);
+			rangeDir = baseResultDir + DatasetIndex::rangeName(first, end) + "/";
+		}
+		if (!generateRange(rangeDir, first, end)) {
+			std::cout << "Error: trees " << first << " to " << end - 1 << " could not be generated" << std::endl;
+			succeeded = false;
+			break;
+		}
+		first = end;
+	}
+
+	// 計測結果を出力
+	profiler.flush();
+	profiler.printSummary();
+	profiler.dumpCSV(baseResultDir + profileName + ".csv");
+	profiler.dumpJSON(baseResultDir + profileName + ".json");
+
+	return succeeded;
+}
+
+/**
+ * Generate the trees [first, end) into the directory, and write the manifest when all
+ * the patches have been stored. The directory is removed first unless it has the manifest of
+ * the same range and parameters.
+ *
+ * @param rangeDir		output directory of the range
+ * @param first			index of the first tree
+ * @param end			index of the tree after the last one
+ * @return				true if the range is complete
+ */
+bool DatasetGenerator::generateRange(const QString& rangeDir, int first, int end) {
+	Profiler& profiler = renderManager->profiler;
+
+	RangeManifest manifest;
+	if (manifest.read(rangeDir + DatasetIndex::MANIFEST_FILE) && manifest.complete && manifest.firstTree == first && manifest.endTree == end
+		&& manifest.seed == seed && manifest.parameters == parameterString()) {
+		std::cout << "Skipping trees " << first << " to " << end - 1 << ", which are complete" << std::endl;
+		for (int n = first; n < end; ++n) {
+			reportTree(n);
+		}
+		return true;
+	}
+
+	if (QDir(rangeDir).exists()) {
+		QDir(rangeDir).removeRecursively();
+	}
+	QDir().mkpath(rangeDir);
+
+	// the patches are encoded while the next trees are rendered
+	if (!patchWriter.open(rangeDir, 4)) return false;
+	sampler.begin(4, seed, first, end);
+	dedup.begin(4);
+	treeIndex = first - 1;
+	if (useSoftware) {
+		generateWithSoftware(first, end);
+	}
+	else {
+		generateWithGL(first, end);
+	}
+
+	labelMaps.clear();
+	currentLabels.release();
+
+	bool written;
+	{
+		ScopedCPUTimer timer(&profiler, "encode wait");
+		written = patchWriter.close();
+	}
+	if (!written) return false;
+
+	sampler.printSummary();
+	if (dedup.enabled()) dedup.printSummary();
+	if (treeIndex + 1 < end) {
+		std::cout << "All the quotas are filled after tree " << treeIndex << std::endl;
+		for (int n = treeIndex + 1; n < end; ++n) {
+			reportTree(n);
+		}
+	}
+
+	manifest = RangeManifest();
+	manifest.firstTree = first;
+	manifest.endTree = end;
+	manifest.seed = seed;
+	manifest.parameters = parameterString();
+	manifest.generatedTrees = treeIndex + 1 - first;
+	manifest.counts = patchWriter.counts();
+	manifest.numPatches = 0;
+	for (int i = 0; i < manifest.counts.size(); ++i) {
+		manifest.numPatches += manifest.counts[i];
+	}
+	manifest.checksum = RangeManifest::computeChecksum(rangeDir);
+	manifest.complete = true;
+
+	return manifest.write(rangeDir + DatasetIndex::MANIFEST_FILE);
+}
+
+/**
+ * Return the parameters that the patches depend on, which a completed range has to match.
+ */
+QString DatasetGenerator::parameterString() const {
+	return QString("size=%1x%2 renderer=%3 labels=%4 format=%5 compress=%6")
+		.arg(outputWidth).arg(outputHeight)
+		.arg(useSoftware ? "software" : "gl")
+		.arg(useLabelMap ? 1 : 0)
+		.arg(patchWriter.format == PatchWriter::FORMAT_SHARDS ? "shards" : "files")
+		.arg(patchWriter.compress ? 1 : 0) + " " + sampler.parameterString() + " " + dedup.parameterString();
+}
+
+/**
+ * Generate a random tree that does not hit the ground.
+ * The random numbers are seeded by the index of the tree, so each tree is the same regardless
+ * of the trees generated before it.
+ *
+ * @param name		object name of the tree
+ * @param index		index of the tree
+ */
+void DatasetGenerator::generateTree(const QString& name, int index) {
+	srand(seed + index);
+
+	// 枝が地面にぶつからないよう、ランダムに生成
+	while (true) {
+		renderManager->removeObject(name);
+		tree->generateRandom();
+		if (!tree->generateGeometry(renderManager, false, name)) break;
+	}
+}
+
+/**
+ * Rasterize the label map of the current tree, and append it to the queue of the label maps.
+ *
+ * @param view		camera of the whole image
+ */
+void DatasetGenerator::renderLabels(const Camera& view) {
+	ScopedCPUTimer timer(&renderManager->profiler, "labels");
+
+	std::vector<LabelSegment> segments;
+	std::vector<LabelLeaf> leaves;
+	tree->generateSkeleton(false, segments, leaves);
+
+	labelMaps.push_back(cv::Mat());
+	labelRasterizer.render(segments, leaves, view, outputWidth, outputHeight, labelMaps.back());
+}
+
+/**
+ * Print that all the patches of the tree have been extracted, for the coordinator of the workers.
+ */
+void DatasetGenerator::reportTree(int index) {
+	if (reportProgress) {
+		std::cout << "tree " << index << std::endl;
+	}
+}
+
+/**
+ * Render the training images with the GL path.
+ * If validateTrees > 0, the first trees are rendered with the software rasterizer as well, and
+ * the mismatch between the two renderers is printed, together with the patches whose types from
+ * the summed-area table differ from the scan of their pixels.
+ */
+void DatasetGenerator::generateWithGL(int first, int end) {
+	Profiler& profiler = renderManager->profiler;
+
+	// all the textures have to be ready before the first frame is captured
+	renderManager->textureLoader.finish();
+
+	// the tiles must not exceed the limits of the GPU
+	backend->makeCurrent();
+	GLint maxRenderbufferSize, maxTextureSize, maxViewportDims[2];
+	glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &maxRenderbufferSize);
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+	glGetIntegerv(GL_MAX_VIEWPORT_DIMS, maxViewportDims);
+	int tileLimit = (std::min)((std::min)(maxTileSize, (int)maxRenderbufferSize), (std::min)((int)maxTextureSize, (int)(std::min)(maxViewportDims[0], maxViewportDims[1])));
+
+	grid.init(outputWidth, outputHeight, tileLimit, guard);
+
+	// atlas mode: several trees per frame, if the image fits in one tile
+	int batchSize = 1;
+	atlasCols = 0;
+	atlasRows = 0;
+	if (atlasSize > 1 && grid.numTiles() == 1) {
+		atlasCols = (std::min)(atlasSize, tileLimit / (outputWidth + guard * 2));
+		if (atlasCols > 0) {
+			atlasRows = (std::min)((atlasSize + atlasCols - 1) / atlasCols, tileLimit / (outputHeight + guard * 2));
+			batchSize = (std::min)(atlasSize, atlasCols * atlasRows);
+		}
+	}
+
+	int targetWidth = grid.renderWidth();
+	int targetHeight = grid.renderHeight();
+	if (batchSize > 1) {
+		targetWidth = atlasCols * (outputWidth + guard * 2);
+		targetHeight = atlasRows * (outputHeight + guard * 2);
+		std::cout << "Rendering " << batchSize << " trees per frame in a " << atlasCols << "x" << atlasRows << " atlas" << std::endl;
+	}
+	else if (grid.numTiles() > 1) {
+		std::cout << "Rendering " << outputWidth << "x" << outputHeight << " in " << grid.numCols << "x" << grid.numRows << " tiles" << std::endl;
+	}
+	tileTarget.resize(targetWidth, targetHeight, 2);
+
+	// camera of the whole image, whose projection is cropped for each tile
+	Camera view = *camera;
+	view.updatePMatrix(outputWidth, outputHeight);
+	glm::mat4 pMatrix = view.pMatrix;
+
+	// two images per frame, and the previous frame is processed while the GPU renders the next one
+	readback.init(4, targetWidth, targetHeight);
+	renderManager->flipY = true;
+
+	if (validateTrees > 0 && (batchSize > 1 || grid.numTiles() > 1)) {
+		std::cout << "Validation of the software rasterizer needs a single tile without atlas" << std::endl;
+	}
+	validationImages.clear();
+	validatedTrees = 0;
+
+	int pendingTile = -1;
+	int pendingTrees = 0;
+	for (int n = first; n < end && !sampler.filled(); n += batchSize) {
+		int numInBatch = (std::min)(batchSize, end - n);
+
+		{
+			ScopedCPUTimer timer(&profiler, "generate");
+			renderManager->removeObjects();
+			for (int k = 0; k < numInBatch; ++k) {
+				generateTree(batchSize > 1 ? QString("tree_%1").arg(k) : QString("tree"), n + k);
+
+				// the camera of the cell moves together with the tree, so the label map is the same as in a single image
+				if (useLabelMap) renderLabels(view);
+			}
+		}
+
+		if (batchSize > 1) {
+			// all the trees of the batch in one frame
+			renderManager->setAtlas(layoutAtlas(numInBatch, view));
+			renderAndRead(RenderManager::RENDERING_MODE_COMBINED, view, &tileTarget);
+
+			if (pendingTrees > 0) {
+				processAtlas(pendingTrees);
+			}
+			pendingTrees = numInBatch;
+			continue;
+		}
+
+		// the images of the software rasterizer wait for the GL images in the readback queue
+		if (n < validateTrees && grid.numTiles() == 1) {
+			ScopedCPUTimer timer(&profiler, "software");
+			validationImages.push_back(std::make_pair(cv::Mat(), cv::Mat()));
+			softwareRasterizer.render(renderManager, view, outputWidth, outputHeight, validationImages.back().first, validationImages.back().second);
+		}
+
+		for (int t = 0; t < grid.numTiles(); ++t) {
+			view.pMatrix = grid.projection(pMatrix, t);
+			view.updateMVPMatrix();
+
+			// render the tree with color and with line rendering from one G-buffer
+			renderAndRead(RenderManager::RENDERING_MODE_COMBINED, view, &tileTarget);
+
+			if (pendingTile >= 0) {
+				processTile(pendingTile);
+			}
+			pendingTile = t;
+		}
+	}
+	if (pendingTile >= 0) {
+		processTile(pendingTile);
+	}
+	if (pendingTrees > 0) {
+		processAtlas(pendingTrees);
+	}
+
+	renderManager->clearAtlas();
+	renderManager->flipY = false;
+}
+
+/**
+ * Render the training images with the software rasterizer, which does not need a GL context.
+ * The images are always rendered at once, since the memory of the G-buffer on the CPU is not
+ * as limited as on the GPU.
+ */
+void DatasetGenerator::generateWithSoftware(int first, int end) {
+	Profiler& profiler = renderManager->profiler;
+
+	Camera view = *camera;
+	view.updatePMatrix(outputWidth, outputHeight);
+
+	cv::Mat colorImage;
+	cv::Mat lineImage;
+	for (int n = first; n < end && !sampler.filled(); ++n) {
+		{
+			ScopedCPUTimer timer(&profiler, "generate");
+			renderManager->removeObjects();
+			generateTree("tree", n);
+		}
+		if (useLabelMap) {
+			renderLabels(view);
+			currentLabels = labelMaps.front();
+			labelMaps.pop_front();
+		}
+
+		{
+			ScopedCPUTimer timer(&profiler, "software");
+			softwareRasterizer.render(renderManager, view, outputWidth, outputHeight, colorImage, lineImage);
+		}
+
+		nextPatchRow = 0;
+		treeIndex++;
+		extractPatches(colorImage, lineImage, 0, outputHeight);
+		reportTree(treeIndex);
+	}
+}
+
+/**
+ * Pass the oldest tile in the readback queue to the patch extractor.
+ * If the image consists of one tile, the patches are taken from the mapped buffers directly.
+ * Otherwise, the interior of the tile is copied to the strips, and the patches are extracted
+ * when the last tile of the row has arrived. The strips keep only the rows that the remaining
+ * patches need, so the memory does not grow with the image height.
+ *
+ * @param index				tile index
+ */
+void DatasetGenerator::processTile(int index) {
+	Profiler& profiler = renderManager->profiler;
+
+	cv::Mat colorTile;
+	cv::Mat lineTile;
+	{
+		ScopedCPUTimer timer(&profiler, "readback");
+		colorTile = readback.acquire();
+		lineTile = readback.acquire();
+	}
+
+	if (index == 0) {
+		nextPatchRow = 0;
+		treeIndex++;
+		stripTop = 0;
+		if (!labelMaps.empty()) {
+			currentLabels = labelMaps.front();
+			labelMaps.pop_front();
+		}
+	}
+
+	cv::Rect rect = grid.tileRect(index);
+	if (grid.numTiles() == 1 && !validationImages.empty()) {
+		double lineMismatch = SoftwareRasterizer::compareLines(lineTile, validationImages.front().second, 1);
+		double classMismatch = SoftwareRasterizer::compareClasses(colorTile, validationImages.front().first, 1);
+		int numPatches;
+		int typeMismatches = countPatchTypeMismatches(colorTile, numPatches);
+		std::cout << "Validation of tree " << validatedTrees++ << ": line mismatch " << lineMismatch * 100.0 << "%, class mismatch " << classMismatch * 100.0 << "%";
+		std::cout << ", patch type mismatch " << typeMismatches << " / " << numPatches;
+		if (!currentLabels.empty()) {
+			std::cout << ", label map mismatch " << SoftwareRasterizer::compareClasses(colorTile, LabelRasterizer::colorize(currentLabels), 1) * 100.0 << "%";
+		}
+		std::cout << std::endl;
+		validationImages.pop_front();
+	}
+	if (grid.numTiles() == 1) {
+		extractPatches(colorTile, lineTile, 0, outputHeight);
+	}
+	else {
+		int stripRows = outputHeight / 10 + grid.tileHeight;
+		if (colorStrip.rows != stripRows || colorStrip.cols != outputWidth) {
+			colorStrip.create(stripRows, outputWidth, CV_8UC4);
+			lineStrip.create(stripRows, outputWidth, CV_8UC4);
+		}
+
+		{
+			ScopedCPUTimer timer(&profiler, "assemble");
+			cv::Rect interior(grid.guard, grid.guard, rect.width, rect.height);
+			cv::Rect dst(rect.x, rect.y - stripTop, rect.width, rect.height);
+			colorTile(interior).copyTo(colorStrip(dst));
+			lineTile(interior).copyTo(lineStrip(dst));
+		}
+
+		if (grid.endOfRow(index)) {
+			int bottom = rect.y + rect.height;
+			extractPatches(colorStrip, lineStrip, stripTop, bottom);
+
+			// drop the rows above the next row of patches
+			int drop = (std::min)(nextPatchRow, bottom) - stripTop;
+			int keep = bottom - stripTop - drop;
+			if (drop > 0 && keep > 0) {
+				memmove(colorStrip.data, colorStrip.ptr(drop), keep * colorStrip.step);
+				memmove(lineStrip.data, lineStrip.ptr(drop), keep * lineStrip.step);
+			}
+			stripTop += drop;
+		}
+	}
+
+	if (index == grid.numTiles() - 1) {
+		reportTree(treeIndex);
+	}
+
+	readback.release();
+	readback.release();
+}
+
+/**
+ * Lay out the trees of the batch in the atlas.
+ * The cells are filled row by row from the top-left corner. Each cell has the guard band
+ * around the image, so that the screen space passes do not see the neighboring trees.
+ * The trees are moved apart perpendicular to the light, so that they do not cast shadows
+ * on each other, and the camera of each cell is moved together with its tree.
+ *
+ * @param numCells		number of the trees
+ * @param view			camera of one image
+ * @return				cells
+ */
+std::vector<AtlasCell> DatasetGenerator::layoutAtlas(int numCells, const Camera& view) {
+	int cellWidth = outputWidth + guard * 2;
+	int cellHeight = outputHeight + guard * 2;
+	int atlasWidth = atlasCols * cellWidth;
+	int atlasHeight = atlasRows * cellHeight;
+
+	// spacing of the trees in the world
+	float spacing = 0.0f;
+	for (int k = 0; k < numCells; ++k) {
+		glm::vec3 minPt, maxPt;
+		if (renderManager->objectBounds(QString("tree_%1").arg(k), minPt, maxPt)) {
+			spacing = (std::max)(spacing, glm::length(maxPt - minPt));
+		}
+	}
+	spacing += 1.0f;
+
+	glm::vec3 side(1, 0, 0);
+	if (fabs(light_dir.x) + fabs(light_dir.z) > 0.0f) {
+		side = glm::normalize(glm::vec3(-light_dir.z, 0, light_dir.x));
+	}
+
+	// the projection of the cell covers the guard band as well
+	float gx = 2.0f * guard / outputWidth;
+	float gy = 2.0f * guard / outputHeight;
+	glm::mat4 cellProjection = glm::inverse(TileGrid::ndcRegion(-1.0f - gx, 1.0f + gx, -1.0f - gy, 1.0f + gy)) * view.pMatrix;
+
+	std::vector<AtlasCell> cells(numCells);
+	for (int k = 0; k < numCells; ++k) {
+		AtlasCell& cell = cells[k];
+		cell.object_name = QString("tree_%1").arg(k);
+		cell.width = cellWidth;
+		cell.height = cellHeight;
+		cell.x = (k % atlasCols) * cellWidth;
+		cell.y = atlasHeight - (k / atlasCols + 1) * cellHeight;
+		cell.offset = side * (spacing * k);
+
+		float left = 2.0f * cell.x / atlasWidth - 1.0f;
+		float right = 2.0f * (cell.x + cellWidth) / atlasWidth - 1.0f;
+		float bottom = 2.0f * cell.y / atlasHeight - 1.0f;
+		float top = 2.0f * (cell.y + cellHeight) / atlasHeight - 1.0f;
+		cell.mvpMatrix = TileGrid::ndcRegion(left, right, bottom, top) * cellProjection * view.mvMatrix * glm::translate(glm::mat4(), -cell.offset);
+	}
+
+	return cells;
+}
+
+/**
+ * Pass the trees of the oldest atlas in the readback queue to the patch extractor.
+ * The images of the trees are views of the mapped buffers, so they are not copied.
+ *
+ * @param numCells			number of the trees in the atlas
+ */
+void DatasetGenerator::processAtlas(int numCells) {
+	Profiler& profiler = renderManager->profiler;
+
+	cv::Mat colorAtlas;
+	cv::Mat lineAtlas;
+	{
+		ScopedCPUTimer timer(&profiler, "readback");
+		colorAtlas = readback.acquire();
+		lineAtlas = readback.acquire();
+	}
+
+	// the atlas has been rendered top-down (flipY), so the first row of cells is at the top
+	int cellWidth = outputWidth + guard * 2;
+	int cellHeight = outputHeight + guard * 2;
+	for (int k = 0; k < numCells; ++k) {
+		cv::Rect rect((k % atlasCols) * cellWidth + guard, (k / atlasCols) * cellHeight + guard, outputWidth, outputHeight);
+		nextPatchRow = 0;
+		treeIndex++;
+		if (!labelMaps.empty()) {
+			currentLabels = labelMaps.front();
+			labelMaps.pop_front();
+		}
+		extractPatches(colorAtlas(rect), lineAtlas(rect), 0, outputHeight);
+		reportTree(treeIndex);
+	}
+
+	readback.release();
+	readback.release();
+}
+
+/**
+ * Split the available rows of the image into the patches, and pass each patch of the line
+ * drawing to patchWriter, which stores it with the type of the color patch.
+ * The rows of patches are extracted in order, starting from nextPatchRow.
+ *
+ * @param colorRows			rows of the color image (BGRA) from the image row "top"
+ * @param lineRows			rows of the line drawing (BGRA) from the image row "top"
+ * @param top				image row of the first row of colorRows / lineRows
+ * @param bottom			image rows up to "bottom" are available
+ */
+void DatasetGenerator::extractPatches(const cv::Mat& colorRows, const cv::Mat& lineRows, int top, int bottom) {
+	Profiler& profiler = renderManager->profiler;
+
+	// 10x10に分割
+	int patch_width = outputWidth / 10;
+	int patch_height = outputHeight / 10;
+	int stride = patch_width / 3;
+	if (nextPatchRow >= outputHeight - patch_height || nextPatchRow + patch_height > bottom) return;
+
+	// the patches overlap, so each pixel of the rows is classified once, and the class counts
+	// of each patch are taken from the summed-area table
+	CPUTimer classifyTimer;
+	CPUTimer queueTimer;
+	CPUTimer dedupTimer;
+	classifyTimer.start();
+	int firstRow = nextPatchRow;
+	if (currentLabels.empty()) {
+		classifier.setImage(colorRows(cv::Rect(0, firstRow - top, outputWidth, bottom - firstRow)));
+	}
+	else {
+		classifier.setLabels(currentLabels(cv::Rect(0, firstRow, outputWidth, bottom - firstRow)));
+	}
+	classifyTimer.stop();
+
+	for (; nextPatchRow < outputHeight - patch_height && nextPatchRow + patch_height <= bottom; nextPatchRow += stride) {
+		int r = nextPatchRow - top;
+		for (int c = 0; c < outputWidth - patch_width; c += stride) {
+			cv::Mat patch2(lineRows, cv::Rect(c, r, patch_width, patch_height));
+
+			// patchのタイプを計算
+			classifyTimer.start();
+			int type = classifier.classify(cv::Rect(c, nextPatchRow - firstRow, patch_width, patch_height));
+			bool accepted = sampler.accept(type, treeIndex, c, nextPatchRow);
+			classifyTimer.stop();
+
+			// the patches over the quota are dropped before they are copied and encoded
+			if (!accepted) continue;
+
+			// and so are the near-duplicates of the stored patches
+			if (dedup.enabled()) {
+				dedupTimer.start();
+				bool unique = dedup.add(type, PatchDeduplicator::computeHash(patch2));
+				dedupTimer.stop();
+				if (!unique) continue;
+			}
+			sampler.store(type);
+
+			// 画像をファイルに保存 (the workers of patchWriter encode it)
+			queueTimer.start();
+			patchWriter.add(type, treeIndex, c, nextPatchRow, patch2);
+			queueTimer.stop();
+		}
+	}
+	queueTimer.start();
+	patchWriter.flush();
+	queueTimer.stop();
+	profiler.addCPUSample("classify", classifyTimer.elapsed);
+	profiler.addCPUSample("queue", queueTimer.elapsed);
+	if (dedup.enabled()) profiler.addCPUSample("dedup", dedupTimer.elapsed);
+}
+
+/**
+ * Compute the type of the patch by scanning its pixels.
+ * This is the reference of PatchClassifier, which gives the same types from the summed-area table.
+ *
+ * @param patch		color patch (BGRA or BGR)
+ * @return			PatchClassifier::PATCH_XXX
+ */
+int DatasetGenerator::computePatchType(const cv::Mat& patch) {
+	int count[4] = { 0, 0, 0, 0 };
+
+	// the rendered images are BGRA, so the pixels are not read as Vec3b
+	int channels = patch.channels();
+	for (int r = 0; r < patch.rows; ++r) {
+		const unsigned char* pixel = patch.ptr<unsigned char>(r);
+		for (int c = 0; c < patch.cols; ++c, pixel += channels) {
+			count[PatchClassifier::classifyPixel(pixel[0], pixel[1], pixel[2])]++;
+		}
+	}
+
+	return PatchClassifier::decide(count[PatchClassifier::PATCH_TRUNK], count[PatchClassifier::PATCH_BRANCH], count[PatchClassifier::PATCH_LEAF], patch.rows * patch.cols);
+}
+
+/**
+ * Compare the types of the patches from the summed-area table with computePatchType(), for the
+ * same patches as extractPatches() takes from the image. They have to be identical.
+ *
+ * @param colorImage		color image of a tree (BGRA)
+ * @param numPatches		number of the patches compared
+ * @return					number of the patches whose types differ
+ */
+int DatasetGenerator::countPatchTypeMismatches(const cv::Mat& colorImage, int& numPatches) const {
+	int patch_width = outputWidth / 10;
+	int patch_height = outputHeight / 10;
+	int stride = patch_width / 3;
+
+	PatchClassifier reference;
+	reference.setImage(colorImage);
+
+	int mismatches = 0;
+	numPatches = 0;
+	for (int r = 0; r < outputHeight - patch_height; r += stride) {
+		for (int c = 0; c < outputWidth - patch_width; c += stride) {
+			cv::Rect rect(c, r, patch_width, patch_height);
+			if (reference.classify(rect) != computePatchType(colorImage(rect))) mismatches++;
+			numPatches++;
+		}
+	}
+
+	return mismatches;
+}
+
+/**
+ * Recover the trees from the predicted parameters, and store the binarized images.
+ *
+ * @param resultDir			output directory (removed first if it exists)
+ * @param predictedFile		one tree per line, 63 comma-separated parameters per level
+ */
+void DatasetGenerator::generatePredictedData(const QString& resultDir, const QString& predictedFile) {
+	if (QDir(resultDir).exists()) {
+		QDir(resultDir).removeRecursively();
+	}
+	QDir().mkpath(resultDir);
+
+	renderManager->textureLoader.finish();
+
+	QFile file(predictedFile);
+	if (!file.open(QIODevice::ReadOnly)) return;
+
+	// the image of the previous tree is written while the GPU renders the next one
+	readback.init(2, backend->width(), backend->height());
+	renderManager->flipY = true;
+
+	QTextStream in(&file);
+	int n = 0;
+	while (true) {
+		bool hasTree = !in.atEnd();
+		if (hasTree) {
+			QStringList data = in.readLine().split(",");
+			
+			std::vector<std::vector<float> > params;
+			for (int i = 0; i * 63 < data.size(); ++i) {
+				std::vector<float> ps;
+				for (int k = 0; k < 63; ++k) {
+					ps.push_back(data[i * 63 + k].toFloat());
+				}
+				params.push_back(ps);
+			}
+
+			tree->recover(params);
+			
+			// 木を生成
+			renderManager->removeObjects();
+			tree->generateGeometry(renderManager, false);
+
+			// 画像を生成
+			renderAndRead(renderManager->renderingMode, *camera, backend);
+		}
+
+		// write the image of the previous tree
+		if (readback.pending() > (hasTree ? 1 : 0)) {
+			cv::Mat sourceImage = readback.acquire();
+			writePredictedImage(sourceImage, resultDir + QString("image_%1.png").arg(n, 6, 10, QChar('0')));
+			readback.release();
+			n++;
+		}
+
+		if (!hasTree && readback.pending() == 0) break;
+	}
+
+	renderManager->flipY = false;
+}
+
+/**
+ * Binarize the rendered image while reducing it to 128x128, and write it to the file.
+ *
+ * @param image			rendered image (BGRA)
+ * @param filename		output file
+ */
+void DatasetGenerator::writePredictedImage(const cv::Mat& image, const QString& filename) {
+	cv::Mat grayImage;
+	cv::cvtColor(image, grayImage, CV_RGB2GRAY);
+
+	// 画像を縮小
+	cv::resize(grayImage, grayImage, cv::Size(512, 512));
+	cv::threshold(grayImage, grayImage, 200, 255, CV_THRESH_BINARY);
+	cv::resize(grayImage, grayImage, cv::Size(256, 256));
+	cv::threshold(grayImage, grayImage, 200, 255, CV_THRESH_BINARY);
+	cv::resize(grayImage, grayImage, cv::Size(128, 128));
+	cv::threshold(grayImage, grayImage, 200, 255, CV_THRESH_BINARY);
+
+	// write the iamge to file
+	cv::imwrite(QDir::toNativeSeparators(filename).toUtf8().constData(), grayImage);
+}
+
+/**
+ * Render the current scene with the given rendering mode, and start reading it back.
+ * One image is read for each post pass of the mode (e.g. color and line images in the
+ * combined mode), and they are obtained by readback.acquire() later in this order.
+ *
+ * @param renderingMode		RenderManager::RENDERING_MODE_XXX
+ * @param view				camera
+ * @param target			framebuffer to render to
+ */
+void DatasetGenerator::renderAndRead(int renderingMode, Camera& view, RenderBackend* target) {
+	backend->makeCurrent();
+	renderManager->renderingMode = renderingMode;
+	renderManager->renderFrame(view, light_dir, target);
+
+	int numImages = (std::min)((int)renderManager->pipeline().postPrograms.size(), target->numColorBuffers());
+	for (int i = 0; i < numImages; ++i) {
+		readback.read(target->framebuffer(), i);
+	}
+}
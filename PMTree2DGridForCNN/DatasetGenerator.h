@@ -0,0 +1,112 @@
+#pragma once
+
+#include <QString>
+#include <glm/glm.hpp>
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <deque>
+#include "PixelReadback.h"
+#include "RenderBackend.h"
+#include "TileGrid.h"
+#include "SoftwareRasterizer.h"
+#include "LabelRasterizer.h"
+#include "PatchClassifier.h"
+#include "PatchWriter.h"
+#include "PatchSampler.h"
+#include "PatchDeduplicator.h"
+#include "DatasetManifest.h"
+
+class RenderManager;
+class AtlasCell;
+class RenderBackend;
+class Camera;
+namespace pmtree {
+	class PMTree2D;
+}
+
+/**
+ * Generator of the training / predicted images.
+ * The trees are rendered with RenderManager::renderFrame(), so that the same code runs from
+ * the Qt widget and from the headless command line. The backend provides the GL context.
+ * The training images are rendered at the output resolution into an offscreen framebuffer,
+ * in tiles if the resolution exceeds maxTileSize or the limits of the GPU, and the patches
+ * are extracted from each band of tiles as soon as it is complete. Small images can be
+ * rendered several trees per frame in an atlas (atlasSize). The patches are encoded by the
+ * workers of patchWriter, so the next tree is rendered while the patches of the last one are written.
+ * With useSoftware, the training images are rendered by the software rasterizer without GL.
+ * With useLabelMap, the patches are classified by the label map of the skeleton of the tree
+ * instead of the colors of the rendered image.
+ */
+class DatasetGenerator {
+public:
+	RenderManager* renderManager;
+	RenderBackend* backend;
+	Camera* camera;
+	glm::vec3 light_dir;
+	pmtree::PMTree2D* tree;
+	int outputWidth;		// resolution of the training images
+	int outputHeight;
+	int maxTileSize;		// maximum size of the offscreen framebuffer (bounds the memory of the G-buffer)
+	int guard;				// guard band of the tiles in pixels
+	int atlasSize;			// number of trees rendered in one frame (atlas mode if > 1)
+	int firstTree;			// index of the first tree to generate
+	int rangeSize;			// number of the trees per range (0 -- one range in the output directory)
+	int seed;				// seed of the random numbers of the tree 0
+	bool reportProgress;	// print "tree N" when the patches of the tree N have been extracted
+	QString profileName;	// file name of the profile without the extension
+	bool useSoftware;		// render the training images with the software rasterizer
+	int validateTrees;		// number of the first trees compared between the GL path and the software rasterizer
+	SoftwareRasterizer softwareRasterizer;
+	bool useLabelMap;		// classify the patches by the label map of LabelRasterizer
+	LabelRasterizer labelRasterizer;
+	PatchWriter patchWriter;	// encoder threads of the patches
+	PatchSampler sampler;		// quota and acceptance probability of each type of the patches
+	PatchDeduplicator dedup;	// rejection of the near-duplicate patches
+
+private:
+	PixelReadback readback;
+	OffscreenBackend tileTarget;
+	TileGrid grid;
+	int atlasCols;
+	int atlasRows;
+
+	// rows of the image that are still needed by the patch extractor (used only when the image has several tiles)
+	cv::Mat colorStrip;
+	cv::Mat lineStrip;
+	int stripTop;			// image row of the first row of the strips
+	int nextPatchRow;		// image row of the next row of patches
+	int treeIndex;			// index of the tree whose patches are being extracted
+
+	// images of the software rasterizer to compare with the GL images in the readback queue (color, line)
+	std::deque<std::pair<cv::Mat, cv::Mat> > validationImages;
+	int validatedTrees;
+
+	// label maps of the trees in the readback queue, and the one of the tree being processed
+	std::deque<cv::Mat> labelMaps;
+	cv::Mat currentLabels;
+
+	PatchClassifier classifier;
+
+public:
+	DatasetGenerator(RenderManager* renderManager, RenderBackend* backend, Camera* camera, const glm::vec3& light_dir, pmtree::PMTree2D* tree);
+
+	bool generateTrainingData(const QString& baseResultDir, int numTrees);
+	void generatePredictedData(const QString& resultDir, const QString& predictedFile);
+	static int computePatchType(const cv::Mat& patch);
+	int countPatchTypeMismatches(const cv::Mat& colorImage, int& numPatches) const;
+
+private:
+	bool generateRange(const QString& rangeDir, int first, int end);
+	QString parameterString() const;
+	void generateTree(const QString& name, int index);
+	void renderLabels(const Camera& view);
+	void reportTree(int index);
+	void generateWithGL(int first, int end);
+	void generateWithSoftware(int first, int end);
+	void renderAndRead(int renderingMode, Camera& view, RenderBackend* target);
+	void processTile(int index);
+	std::vector<AtlasCell> layoutAtlas(int numCells, const Camera& view);
+	void processAtlas(int numCells);
+	void extractPatches(const cv::Mat& colorRows, const cv::Mat& lineRows, int top, int bottom);
+	void writePredictedImage(const cv::Mat& image, const QString& filename);
+};
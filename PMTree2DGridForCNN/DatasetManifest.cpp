@@ -0,0 +1,282 @@
+#include "DatasetManifest.h"
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QSaveFile>
+#include <QCryptographicHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <iostream>
+#include <algorithm>
+
+const char* DatasetIndex::MANIFEST_FILE = "manifest.json";
+const char* DatasetIndex::INDEX_FILE = "dataset.json";
+
+RangeManifest::RangeManifest() {
+	firstTree = 0;
+	endTree = 0;
+	generatedTrees = 0;
+	seed = 0;
+	numPatches = 0;
+	complete = false;
+}
+
+/**
+ * Read the manifest.
+ *
+ * @param filename		manifest file
+ * @return				true if it has been read
+ */
+bool RangeManifest::read(const QString& filename) {
+	QFile file(filename);
+	if (!file.open(QIODevice::ReadOnly)) return false;
+
+	QJsonDocument doc = QJsonDocument::fromJson(file.readAll());
+	if (!doc.isObject()) return false;
+
+	QJsonObject obj = doc.object();
+	firstTree = obj["firstTree"].toInt();
+	endTree = obj["endTree"].toInt();
+	generatedTrees = obj["generatedTrees"].toInt();
+	seed = obj["seed"].toInt();
+	parameters = obj["parameters"].toString();
+	numPatches = obj["patches"].toInt();
+	checksum = obj["checksum"].toString();
+	complete = obj["complete"].toBool();
+
+	QJsonArray array = obj["counts"].toArray();
+	counts.resize(array.size());
+	for (int i = 0; i < array.size(); ++i) {
+		counts[i] = array[i].toInt();
+	}
+
+	return true;
+}
+
+/**
+ * Write the manifest through a temporary file, so that it exists only when it is complete.
+ *
+ * @param filename		manifest file
+ * @return				true if it has been written
+ */
+bool RangeManifest::write(const QString& filename) const {
+	QJsonObject obj;
+	obj["firstTree"] = firstTree;
+	obj["endTree"] = endTree;
+	obj["generatedTrees"] = generatedTrees;
+	obj["seed"] = seed;
+	obj["parameters"] = parameters;
+	obj["patches"] = numPatches;
+	obj["checksum"] = checksum;
+	obj["complete"] = complete;
+
+	QJsonArray array;
+	for (int i = 0; i < counts.size(); ++i) {
+		array.append(counts[i]);
+	}
+	obj["counts"] = array;
+
+	QSaveFile file(filename);
+	if (!file.open(QIODevice::WriteOnly)) {
+		std::cout << "Error: could not write " << filename.toUtf8().constData() << std::endl;
+		return false;
+	}
+	file.write(QJsonDocument(obj).toJson());
+	return file.commit();
+}
+
+/**
+ * Compute the SHA-1 of the relative paths and the contents of the patches (the directories of
+ * the types or the shards) in the directory, in the order of the paths.
+ *
+ * @param dir		directory of the range
+ * @return			checksum (hex)
+ */
+QString RangeManifest::computeChecksum(const QString& dir) {
+	QStringList files;
+	QDirIterator it(dir, QDir::Files, QDirIterator::Subdirectories);
+	while (it.hasNext()) {
+		QString path = QDir(dir).relativeFilePath(it.next());
+		if (path.startsWith("pmtree2dgrid_") || path.startsWith("shard_")) files.push_back(path);
+	}
+	files.sort();
+
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	for (int i = 0; i < files.size(); ++i) {
+		hash.addData(files[i].toUtf8());
+
+		QFile file(QDir(dir).filePath(files[i]));
+		if (!file.open(QIODevice::ReadOnly)) return QString();
+		while (!file.atEnd()) {
+			hash.addData(file.read(1 << 20));
+		}
+	}
+
+	return QString(hash.result().toHex());
+}
+
+/**
+ * Return the directory name of the range of the trees.
+ */
+QString DatasetIndex::rangeName(int firstTree, int endTree) {
+	return QString("range_%1_%2").arg(firstTree, 8, 10, QChar('0')).arg(endTree, 8, 10, QChar('0'));
+}
+
+/**
+ * Collect the complete ranges of the input directories into the index of the dataset.
+ * The ranges are ordered by the tree index. A range that overlaps a preceding one is skipped,
+ * and the gaps between the ranges are reported.
+ *
+ * @param baseResultDir		directory of the index
+ * @param inputDirs			directories that have the ranges (with the trailing separator)
+ * @param verify			recompute the checksum of each range
+ * @return					number of the trees in the index, or -1 on error
+ */
+int DatasetIndex::merge(const QString& baseResultDir, const QStringList& inputDirs, bool verify) {
+	std::vector<std::pair<RangeManifest, QString> > ranges;
+	for (int i = 0; i < inputDirs.size(); ++i) {
+		findRanges(inputDirs[i], ranges);
+	}
+	std::sort(ranges.begin(), ranges.end(), [](const std::pair<RangeManifest, QString>& a, const std::pair<RangeManifest, QString>& b) {
+		return a.first.firstTree < b.first.firstTree || (a.first.firstTree == b.first.firstTree && a.first.endTree > b.first.endTree);
+	});
+
+	QJsonArray array;
+	std::vector<int> counts;
+	int numTrees = 0;
+	int generatedTrees = 0;
+	int numPatches = 0;
+	int end = 0;
+	QString parameters;
+	for (int i = 0; i < ranges.size(); ++i) {
+		const RangeManifest& manifest = ranges[i].first;
+		const QString& dir = ranges[i].second;
+
+		if (i > 0 && manifest.parameters != parameters) {
+			std::cout << "Error: " << dir.toUtf8().constData() << " has been generated with different parameters" << std::endl;
+			return -1;
+		}
+		parameters = manifest.parameters;
+		if (manifest.firstTree < end) {
+			std::cout << "Skipping " << dir.toUtf8().constData() << ", which overlaps the preceding range" << std::endl;
+			continue;
+		}
+		if (manifest.firstTree > end) {
+			std::cout << "Trees " << end << " to " << manifest.firstTree - 1 << " are missing" << std::endl;
+		}
+		if (verify && RangeManifest::computeChecksum(dir) != manifest.checksum) {
+			std::cout << "Error: checksum mismatch in " << dir.toUtf8().constData() << std::endl;
+			return -1;
+		}
+
+		QJsonObject obj;
+		obj["dir"] = QDir(baseResultDir).relativeFilePath(dir);
+		obj["firstTree"] = manifest.firstTree;
+		obj["endTree"] = manifest.endTree;
+		obj["generatedTrees"] = manifest.generatedTrees;
+		obj["patches"] = manifest.numPatches;
+		obj["checksum"] = manifest.checksum;
+		array.append(obj);
+
+		if (counts.size() < manifest.counts.size()) counts.resize(manifest.counts.size(), 0);
+		for (int k = 0; k < manifest.counts.size(); ++k) {
+			counts[k] += manifest.counts[k];
+		}
+		numTrees += manifest.endTree - manifest.firstTree;
+		generatedTrees += manifest.generatedTrees;
+		numPatches += manifest.numPatches;
+		end = manifest.endTree;
+	}
+
+	QJsonObject index;
+	index["parameters"] = parameters;
+	index["trees"] = numTrees;
+	index["generatedTrees"] = generatedTrees;
+	index["patches"] = numPatches;
+	QJsonArray countArray;
+	for (int k = 0; k < counts.size(); ++k) {
+		countArray.append(counts[k]);
+	}
+	index["counts"] = countArray;
+	index["ranges"] = array;
+
+	QDir().mkpath(baseResultDir);
+	QSaveFile file(baseResultDir + INDEX_FILE);
+	if (!file.open(QIODevice::WriteOnly)) {
+		std::cout << "Error: could not write the index of the dataset" << std::endl;
+		return -1;
+	}
+	file.write(QJsonDocument(index).toJson());
+	if (!file.commit()) return -1;
+
+	return numTrees;
+}
+
+/**
+ * Return the directories of the ranges in the index of the dataset, in the order of the trees.
+ *
+ * @param baseResultDir		directory of the index
+ * @return					directories (with the trailing separator), or empty if there is no index
+ */
+QStringList DatasetIndex::rangeDirs(const QString& baseResultDir) {
+	QStringList dirs;
+
+	QFile file(baseResultDir + INDEX_FILE);
+	if (!file.open(QIODevice::ReadOnly)) return dirs;
+
+	QJsonArray array = QJsonDocument::fromJson(file.readAll()).object()["ranges"].toArray();
+	for (int i = 0; i < array.size(); ++i) {
+		dirs.push_back(QDir::cleanPath(QDir(baseResultDir).filePath(array[i].toObject()["dir"].toString())) + "/");
+	}
+
+	return dirs;
+}
+
+/**
+ * Return whether the ranges in the index of the dataset cover the trees [firstTree, endTree)
+ * without a gap.
+ *
+ * @param baseResultDir		directory of the index
+ * @param firstTree			index of the first tree
+ * @param endTree			index of the tree after the last one
+ * @return					true if all the trees are in the index
+ */
+bool DatasetIndex::covers(const QString& baseResultDir, int firstTree, int endTree) {
+	QFile file(baseResultDir + INDEX_FILE);
+	if (!file.open(QIODevice::ReadOnly)) return false;
+
+	// the ranges are in the order of the trees, and do not overlap
+	int end = firstTree;
+	QJsonArray array = QJsonDocument::fromJson(file.readAll()).object()["ranges"].toArray();
+	for (int i = 0; i < array.size() && end < endTree; ++i) {
+		QJsonObject obj = array[i].toObject();
+		if (obj["firstTree"].toInt() <= end && obj["endTree"].toInt() > end) {
+			end = obj["endTree"].toInt();
+		}
+	}
+
+	return end >= endTree;
+}
+
+/**
+ * Find the complete ranges in the directory: the directory itself, or its subdirectories.
+ */
+void DatasetIndex::findRanges(const QString& dir, std::vector<std::pair<RangeManifest, QString> >& ranges) {
+	RangeManifest manifest;
+	if (manifest.read(dir + MANIFEST_FILE)) {
+		if (manifest.complete) ranges.push_back(std::make_pair(manifest, dir));
+		return;
+	}
+
+	QStringList names = QDir(dir).entryList(QStringList("range_*"), QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+	for (int i = 0; i < names.size(); ++i) {
+		QString rangeDir = dir + names[i] + "/";
+		if (manifest.read(rangeDir + MANIFEST_FILE) && manifest.complete) {
+			ranges.push_back(std::make_pair(manifest, rangeDir));
+		}
+		else {
+			std::cout << "Skipping the incomplete range " << rangeDir.toUtf8().constData() << std::endl;
+		}
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <vector>
+
+/**
+ * Manifest of a range of trees of the training data, written when all the patches of the range
+ * have been stored. It records the parameters that the patches depend on, so that a range is
+ * reused only if it would be generated the same, and a checksum of the files of the range.
+ * The manifest is written atomically as the last file of the range, so a range without the
+ * manifest is incomplete.
+ */
+class RangeManifest {
+public:
+	int firstTree;
+	int endTree;				// one past the last tree
+	int generatedTrees;			// number of the trees generated (fewer than the range if the quotas are filled)
+	int seed;
+	QString parameters;			// image size, renderer, format etc.
+	std::vector<int> counts;	// number of the patches of each type
+	int numPatches;
+	QString checksum;			// SHA-1 of the files of the range (hex)
+	bool complete;
+
+public:
+	RangeManifest();
+
+	bool read(const QString& filename);
+	bool write(const QString& filename) const;
+	static QString computeChecksum(const QString& dir);
+};
+
+/**
+ * Index of the complete ranges of one or more output directories, which describes the
+ * whole dataset.
+ */
+class DatasetIndex {
+public:
+	static const char* MANIFEST_FILE;
+	static const char* INDEX_FILE;
+
+	static QString rangeName(int firstTree, int endTree);
+	static int merge(const QString& baseResultDir, const QStringList& inputDirs, bool verify);
+	static QStringList rangeDirs(const QString& baseResultDir);
+	static bool covers(const QString& baseResultDir, int firstTree, int endTree);
+
+private:
+	static void findRanges(const QString& dir, std::vector<std::pair<RangeManifest, QString> >& ranges);
+};
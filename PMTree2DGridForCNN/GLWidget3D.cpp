@@ -1,17 +1,13 @@
 ﻿#include <iostream>
 #include "GLWidget3D.h"
 #include "MainWindow.h"
+#include "DatasetGenerator.h"
 #include <GL/GLU.h>
 #include <QTimer>
 #include <glm/gtc/matrix_transform.hpp>
-#include <opencv2/core/core.hpp>
-#include <opencv2/highgui/highgui.hpp>
-#include <opencv2/imgproc/imgproc.hpp>
-#include <QDir>
 #include <QMessageBox>
-#include <QTextStream>
 
-GLWidget3D::GLWidget3D(MainWindow* mainWin) : QGLWidget(QGLFormat(QGL::SampleBuffers), (QWidget*)mainWin) {
+GLWidget3D::GLWidget3D(MainWindow* mainWin) : QGLWidget(QGLFormat(QGL::SampleBuffers), (QWidget*)mainWin), backend(this) {
 	this->mainWin = mainWin;
 	ctrlPressed = false;
 	shiftPressed = false;
@@ -22,402 +18,22 @@ GLWidget3D::GLWidget3D(MainWindow* mainWin) : QGLWidget(QGLFormat(QGL::SampleBuf
 	light_dir = glm::normalize(glm::vec3(-4, -5, -8));
 	//light_dir = glm::normalize(glm::vec3(-1, -3, -2));
 
-	// シャドウマップ用のmodel/view/projection行列を作成
-	glm::mat4 light_pMatrix = glm::ortho<float>(-100, 100, -100, 100, 0.1, 200);
-	glm::mat4 light_mvMatrix = glm::lookAt(-light_dir * 50.0f, glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
-	light_mvpMatrix = light_pMatrix * light_mvMatrix;
+	// シャドウマップ用のmodel/view/projection行列は、シーンのbounding boxに合わせてShadowMappingが作成する
+	renderManager.shadow.setLightDir(light_dir);
 }
 
 void GLWidget3D::generateTrainingData() {
-	srand(2);
-
-	QString baseResultDir = "C:\\Anaconda\\caffe\\data\\pmtree2dgrid\\pmtree2dgrid\\";
-
-	if (QDir(baseResultDir).exists()) {
-		QDir(baseResultDir).removeRecursively();
-	}
-	QDir().mkpath(baseResultDir);
-
-	std::vector<int> count(4, 0);
-	for (int n = 0; n < 300; ++n) {
-		// 枝が地面にぶつからないよう、ランダムに生成
-		while (true) {
-			renderManager.removeObjects();
-			tree.generateRandom();
-			if (!tree.generateGeometry(&renderManager, false)) break;
-		}
-
-		// render the tree with color
-		renderManager.renderingMode = RenderManager::RENDERING_MODE_BASIC;
-		render();
-
-		// cv::Mat形式に変換
-		QImage img = grabFrameBuffer();
-		cv::Mat imageMat = cv::Mat(img.height(), img.width(), CV_8UC4, img.bits(), img.bytesPerLine()).clone();
-
-		// 2560x2560に変換
-		cv::resize(imageMat, imageMat, cv::Size(2560, 2560));
-
-		// render the tree with line rendering
-		renderManager.renderingMode = RenderManager::RENDERING_MODE_LINE;
-		render();
-
-		// cv::Mat形式に変換
-		QImage img2 = grabFrameBuffer();
-		cv::Mat imageMat2 = cv::Mat(img2.height(), img2.width(), CV_8UC4, img2.bits(), img2.bytesPerLine()).clone();
-
-		// 2560x2560に変換
-		cv::resize(imageMat2, imageMat2, cv::Size(2560, 2560));
-
-		// 10x10に分割
-		int patch_width = imageMat.cols / 10;
-		int patch_height = imageMat.rows / 10;
-		int stride = patch_width / 3;
-		for (int r = 0; r < imageMat.rows - patch_height; r += stride) {
-			for (int c = 0; c < imageMat.cols - patch_width; c += stride) {
-				cv::Mat patch(imageMat, cv::Rect(c, r, patch_width, patch_height));
-				cv::Mat patch2(imageMat2, cv::Rect(c, r, patch_width, patch_height));
-
-				// patchのタイプを計算
-				int type = computePatchType(patch);
-
-				// make directory
-				QString resultDir = QString(baseResultDir + "pmtree2dgrid_%1\\").arg(type, 2, 10, QChar('0'));
-				if (!QDir(resultDir).exists()) {
-					QDir().mkdir(resultDir);
-				}
-
-				// 画像をファイルに保存
-				QString filename = resultDir + QString("image_%1.png").arg(count[type]++, 6, 10, QChar('0'));
-				cv::imwrite(filename.toUtf8().constData(), patch2);
-			}
-		}
-	}
-}
-
-int GLWidget3D::computePatchType(const cv::Mat& patch) {
-	int trunk = 0;
-	int branch = 0;
-	int leaf = 0;
-
-	for (int r = 0; r < patch.rows; ++r) {
-		for (int c = 0; c < patch.cols; ++c) {
-			int blue = patch.at<cv::Vec3b>(r, c)[0];
-			int green = patch.at<cv::Vec3b>(r, c)[1];
-			int red = patch.at<cv::Vec3b>(r, c)[2];
-
-			if (blue > 240 && green > 240 && red > 240) { // background
-				// do nothing
-			}
-			else if (red > green && red > blue) { // trunk
-				trunk++;
-			}
-			else if (green > red && green > blue) { // branch
-				branch++;
-			}
-			else if (blue > green && blue > red) { // leaf
-				leaf++;
-			}
-		}
-	}
-
-	int threshold = patch.rows * patch.cols * 0.01;
-
-	if (trunk + branch + leaf < threshold) return 0; // background
-	else if (trunk > branch && trunk > leaf) return 1; // trunk
-	else if (branch > leaf) return 2; // branch
-	else return 3; // leaf
+	DatasetGenerator generator(&renderManager, &backend, &camera, light_dir, &tree);
+	generator.generateTrainingData("C:\\Anaconda\\caffe\\data\\pmtree2dgrid\\pmtree2dgrid\\", 300);
 }
 
 void GLWidget3D::generatePredictedData() {
-	QString resultDir = "C:\\Anaconda\\caffe\\data\\pmtree2d\\pmtree2d_predicted\\";
-	if (QDir(resultDir).exists()) {
-		QDir(resultDir).removeRecursively();
-	}
-	QDir().mkpath(resultDir);
-
-	QFile file("predicted_results.txt");
-	if (file.open(QIODevice::ReadOnly)) {
-		QTextStream in(&file);
-		int n = 0;
-		while (!in.atEnd()) {
-			QStringList data = in.readLine().split(",");
-			
-			std::vector<std::vector<float> > params;
-			for (int i = 0; i * 63 < data.size(); ++i) {
-				std::vector<float> ps;
-				for (int k = 0; k < 63; ++k) {
-					ps.push_back(data[i * 63 + k].toFloat());
-				}
-				params.push_back(ps);
-			}
-
-			tree.recover(params);
-			
-			// 木を生成
-			renderManager.removeObjects();
-			tree.generateGeometry(&renderManager, false);
-
-			// 画像を生成
-			render();
-
-			QImage img = grabFrameBuffer();
-			cv::Mat sourceImage(img.height(), img.width(), CV_8UC4, img.bits(), img.bytesPerLine());
-			cv::Mat grayImage;
-			cv::cvtColor(sourceImage, grayImage, CV_RGB2GRAY);
-
-			// 画像を縮小
-			cv::resize(grayImage, grayImage, cv::Size(512, 512));
-			cv::threshold(grayImage, grayImage, 200, 255, CV_THRESH_BINARY);
-			cv::resize(grayImage, grayImage, cv::Size(256, 256));
-			cv::threshold(grayImage, grayImage, 200, 255, CV_THRESH_BINARY);
-			cv::resize(grayImage, grayImage, cv::Size(128, 128));
-			cv::threshold(grayImage, grayImage, 200, 255, CV_THRESH_BINARY);
-
-			// write the iamge to file
-			QString filename = resultDir + QString("image_%1.png").arg(n, 6, 10, QChar('0'));
-
-			cv::imwrite(filename.toUtf8().constData(), grayImage);
-
-			n++;
-		}
-	}
-
+	DatasetGenerator generator(&renderManager, &backend, &camera, light_dir, &tree);
+	generator.generatePredictedData("C:\\Anaconda\\caffe\\data\\pmtree2d\\pmtree2d_predicted\\", "predicted_results.txt");
 }
 
 void GLWidget3D::render() {
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	glMatrixMode(GL_MODELVIEW);
-
-	////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-	// PASS 1: Render to texture
-	glUseProgram(renderManager.programs["pass1"]);
-
-	glBindFramebuffer(GL_FRAMEBUFFER, renderManager.fragDataFB);
-	glClearColor(0.95, 0.95, 0.95, 1);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderManager.fragDataTex[0], 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, renderManager.fragDataTex[1], 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, renderManager.fragDataTex[2], 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, renderManager.fragDataTex[3], 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, renderManager.fragDepthTex, 0);
-
-	// Set the list of draw buffers.
-	GLenum DrawBuffers[4] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
-	glDrawBuffers(4, DrawBuffers); // "3" is the size of DrawBuffers
-	// Always check that our framebuffer is ok
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-		printf("+ERROR: GL_FRAMEBUFFER_COMPLETE false\n");
-		exit(0);
-	}
-
-	glUniformMatrix4fv(glGetUniformLocation(renderManager.programs["pass1"], "mvpMatrix"), 1, false, &camera.mvpMatrix[0][0]);
-	glUniform3f(glGetUniformLocation(renderManager.programs["pass1"], "lightDir"), light_dir.x, light_dir.y, light_dir.z);
-	glUniformMatrix4fv(glGetUniformLocation(renderManager.programs["pass1"], "light_mvpMatrix"), 1, false, &light_mvpMatrix[0][0]);
-
-	glUniform1i(glGetUniformLocation(renderManager.programs["pass1"], "shadowMap"), 6);
-	glActiveTexture(GL_TEXTURE6);
-	glBindTexture(GL_TEXTURE_2D, renderManager.shadow.textureDepth);
-
-	glEnable(GL_DEPTH_TEST);
-	glDepthFunc(GL_LEQUAL);
-	drawScene();
-
-	////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-	// PASS 2: Create AO
-	if (renderManager.renderingMode == RenderManager::RENDERING_MODE_SSAO) {
-		glUseProgram(renderManager.programs["ssao"]);
-		glBindFramebuffer(GL_FRAMEBUFFER, renderManager.fragDataFB_AO);
-
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderManager.fragAOTex, 0);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, renderManager.fragDepthTex_AO, 0);
-		GLenum DrawBuffers[1] = { GL_COLOR_ATTACHMENT0 };
-		glDrawBuffers(1, DrawBuffers); // "1" is the size of DrawBuffers
-
-		glClearColor(1, 1, 1, 1);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		// Always check that our framebuffer is ok
-		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-			printf("++ERROR: GL_FRAMEBUFFER_COMPLETE false\n");
-			exit(0);
-		}
-
-		glDisable(GL_DEPTH_TEST);
-		glDepthFunc(GL_ALWAYS);
-
-		glUniform2f(glGetUniformLocation(renderManager.programs["ssao"], "pixelSize"), 2.0f / this->width(), 2.0f / this->height());
-
-		glUniform1i(glGetUniformLocation(renderManager.programs["ssao"], "tex0"), 1);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, renderManager.fragDataTex[0]);
-
-		glUniform1i(glGetUniformLocation(renderManager.programs["ssao"], "tex1"), 2);
-		glActiveTexture(GL_TEXTURE2);
-		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, renderManager.fragDataTex[1]);
-
-		glUniform1i(glGetUniformLocation(renderManager.programs["ssao"], "tex2"), 3);
-		glActiveTexture(GL_TEXTURE3);
-		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, renderManager.fragDataTex[2]);
-
-		glUniform1i(glGetUniformLocation(renderManager.programs["ssao"], "depthTex"), 8);
-		glActiveTexture(GL_TEXTURE8);
-		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, renderManager.fragDepthTex);
-
-		glUniform1i(glGetUniformLocation(renderManager.programs["ssao"], "noiseTex"), 7);
-		glActiveTexture(GL_TEXTURE7);
-		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, renderManager.fragNoiseTex);
-
-		{
-			glUniformMatrix4fv(glGetUniformLocation(renderManager.programs["ssao"], "mvpMatrix"), 1, false, &camera.mvpMatrix[0][0]);
-			glUniformMatrix4fv(glGetUniformLocation(renderManager.programs["ssao"], "pMatrix"), 1, false, &camera.pMatrix[0][0]);
-		}
-
-		glUniform1i(glGetUniformLocation(renderManager.programs["ssao"], "uKernelSize"), renderManager.uKernelSize);
-		glUniform3fv(glGetUniformLocation(renderManager.programs["ssao"], "uKernelOffsets"), renderManager.uKernelOffsets.size(), (const GLfloat*)renderManager.uKernelOffsets.data());
-
-		glUniform1f(glGetUniformLocation(renderManager.programs["ssao"], "uPower"), renderManager.uPower);
-		glUniform1f(glGetUniformLocation(renderManager.programs["ssao"], "uRadius"), renderManager.uRadius);
-
-		glBindVertexArray(renderManager.secondPassVAO);
-
-		glDrawArrays(GL_QUADS, 0, 4);
-		glBindVertexArray(0);
-		glDepthFunc(GL_LEQUAL);
-	}
-	else if (renderManager.renderingMode == RenderManager::RENDERING_MODE_LINE || renderManager.renderingMode == RenderManager::RENDERING_MODE_HATCHING) {
-		glUseProgram(renderManager.programs["line"]);
-
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		glClearColor(1, 1, 1, 1);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		glDisable(GL_DEPTH_TEST);
-		glDepthFunc(GL_ALWAYS);
-
-		glUniform2f(glGetUniformLocation(renderManager.programs["line"], "pixelSize"), 1.0f / this->width(), 1.0f / this->height());
-		glUniformMatrix4fv(glGetUniformLocation(renderManager.programs["line"], "pMatrix"), 1, false, &camera.pMatrix[0][0]);
-		if (renderManager.renderingMode == RenderManager::RENDERING_MODE_LINE) {
-			glUniform1i(glGetUniformLocation(renderManager.programs["line"], "useHatching"), 0);
-		}
-		else {
-			glUniform1i(glGetUniformLocation(renderManager.programs["line"], "useHatching"), 1);
-		}
-
-		glUniform1i(glGetUniformLocation(renderManager.programs["line"], "tex0"), 1);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, renderManager.fragDataTex[0]);
-
-		glUniform1i(glGetUniformLocation(renderManager.programs["line"], "tex1"), 2);
-		glActiveTexture(GL_TEXTURE2);
-		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, renderManager.fragDataTex[1]);
-
-		glUniform1i(glGetUniformLocation(renderManager.programs["line"], "tex2"), 3);
-		glActiveTexture(GL_TEXTURE3);
-		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, renderManager.fragDataTex[2]);
-
-		glUniform1i(glGetUniformLocation(renderManager.programs["line"], "tex3"), 4);
-		glActiveTexture(GL_TEXTURE4);
-		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, renderManager.fragDataTex[3]);
-
-		glUniform1i(glGetUniformLocation(renderManager.programs["line"], "depthTex"), 8);
-		glActiveTexture(GL_TEXTURE8);
-		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, renderManager.fragDepthTex);
-
-		glUniform1i(glGetUniformLocation(renderManager.programs["line"], "hatchingTexture"), 5);
-		glActiveTexture(GL_TEXTURE5);
-		glBindTexture(GL_TEXTURE_3D, renderManager.hatchingTextures);
-		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-		glBindVertexArray(renderManager.secondPassVAO);
-
-		glDrawArrays(GL_QUADS, 0, 4);
-		glBindVertexArray(0);
-		glDepthFunc(GL_LEQUAL);
-	}
-
-	////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-	// Blur
-
-	if (renderManager.renderingMode != RenderManager::RENDERING_MODE_LINE && renderManager.renderingMode != RenderManager::RENDERING_MODE_HATCHING) {
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		qglClearColor(QColor(0xFF, 0xFF, 0xFF));
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		glDisable(GL_DEPTH_TEST);
-		glDepthFunc(GL_ALWAYS);
-
-		glUseProgram(renderManager.programs["blur"]);
-		glUniform2f(glGetUniformLocation(renderManager.programs["blur"], "pixelSize"), 2.0f / this->width(), 2.0f / this->height());
-		//printf("pixelSize loc %d\n", glGetUniformLocation(vboRenderManager.programs["blur"], "pixelSize"));
-
-		glUniform1i(glGetUniformLocation(renderManager.programs["blur"], "tex0"), 1);//COLOR
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, renderManager.fragDataTex[0]);
-
-		glUniform1i(glGetUniformLocation(renderManager.programs["blur"], "tex1"), 2);//NORMAL
-		glActiveTexture(GL_TEXTURE2);
-		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, renderManager.fragDataTex[1]);
-
-		/*glUniform1i(glGetUniformLocation(renderManager.programs["blur"], "tex2"), 3);
-		glActiveTexture(GL_TEXTURE3);
-		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, renderManager.fragDataTex[2]);*/
-
-		glUniform1i(glGetUniformLocation(renderManager.programs["blur"], "depthTex"), 8);
-		glActiveTexture(GL_TEXTURE8);
-		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, renderManager.fragDepthTex);
-
-		glUniform1i(glGetUniformLocation(renderManager.programs["blur"], "tex3"), 4);//AO
-		glActiveTexture(GL_TEXTURE4);
-		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, renderManager.fragAOTex);
-
-		if (renderManager.renderingMode == RenderManager::RENDERING_MODE_SSAO) {
-			glUniform1i(glGetUniformLocation(renderManager.programs["blur"], "ssao_used"), 1); // ssao used
-		}
-		else {
-			glUniform1i(glGetUniformLocation(renderManager.programs["blur"], "ssao_used"), 0); // no ssao
-		}
-
-		glBindVertexArray(renderManager.secondPassVAO);
-
-		glDrawArrays(GL_QUADS, 0, 4);
-		glBindVertexArray(0);
-		glDepthFunc(GL_LEQUAL);
-
-	}
-
-	// REMOVE
-	glActiveTexture(GL_TEXTURE0);
-}
-
-/**
-* Draw the scene.
-*/
-void GLWidget3D::drawScene() {
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glEnable(GL_DEPTH_TEST);
-	glDepthFunc(GL_LEQUAL);
-	glDepthMask(true);
-
-	renderManager.renderAll();
+	renderManager.renderFrame(camera, light_dir, &backend);
 }
 
 void GLWidget3D::keyPressEvent(QKeyEvent *e) {
@@ -435,6 +51,19 @@ void GLWidget3D::keyPressEvent(QKeyEvent *e) {
 	case Qt::Key_Alt:
 		altPressed = true;
 		break;
+	case Qt::Key_H:
+		// only the post pass changes, so the G-buffer is reused once both modes have been drawn
+		renderManager.renderingMode = renderManager.renderingMode == RenderManager::RENDERING_MODE_HATCHING ? RenderManager::RENDERING_MODE_LINE : RenderManager::RENDERING_MODE_HATCHING;
+		update();
+		break;
+	case Qt::Key_Plus:
+		renderManager.uRadius *= 1.25f;
+		update();
+		break;
+	case Qt::Key_Minus:
+		renderManager.uRadius /= 1.25f;
+		update();
+		break;
 	default:
 		break;
 	}
@@ -459,11 +88,12 @@ void GLWidget3D::mousePressEvent(QMouseEvent* e) {
  */
 void GLWidget3D::mouseReleaseEvent(QMouseEvent* e) {
 	// do nothing
-	updateGL();
 }
 
 /**
  * This event handler is called when the mouse move events occur.
+ * The frame is requested only if the camera has moved. update() merges the requests until the
+ * next paint event, so a burst of mouse events renders one frame.
  */
 void GLWidget3D::mouseMoveEvent(QMouseEvent* e) {
 	lastPos = e->pos();
@@ -475,15 +105,14 @@ void GLWidget3D::mouseMoveEvent(QMouseEvent* e) {
 		else { // Rotate
 			camera.rotate(e->x(), e->y());
 		}
+		update();
 	}
-
-	updateGL();
 }
 
 void GLWidget3D::wheelEvent(QWheelEvent* e) {
 	// zoom
 	camera.zoom(e->delta()); 
-	updateGL();
+	update();
 }
 
 /**
@@ -517,7 +146,7 @@ void GLWidget3D::initializeGL() {
 	glDisable(GL_TEXTURE_2D);
 
 	////////////////////////////////
-	renderManager.init("", "", "", true, 8192);
+	renderManager.init("", "", "", true, ShadowMapping::QUALITY_MEDIUM);
 	renderManager.resize(this->width(), this->height());
 
 	camera.xrot = 0.0f;
@@ -535,13 +164,18 @@ void GLWidget3D::resizeGL(int width, int height) {
 	glViewport(0, 0, (GLint)width, (GLint)height);
 	camera.updatePMatrix(width, height);
 	renderManager.resize(width, height);
-
-	renderManager.updateShadowMap(this, light_dir, light_mvpMatrix);
 }
 
 /**
  * This function is called whenever the widget needs to be painted.
+ * RenderManager runs only the passes whose inputs have changed since the last frame, so a
+ * repaint of the same view (e.g. after the window is uncovered) runs only the post pass.
  */
 void GLWidget3D::paintGL() {
 	render();
+
+	// nothing requests a frame when a texture finishes decoding, so poll until all are published
+	if (renderManager.textureLoader.pending()) {
+		QTimer::singleShot(16, this, [this]() { update(); });
+	}
 }
@@ -1,4 +1,4 @@
-#pragma once
+﻿#pragma once
 
 #include "glew.h"
 #include <QGLWidget>
@@ -7,18 +7,36 @@
 #include "Camera.h"
 #include "ShadowMapping.h"
 #include "RenderManager.h"
+#include "RenderBackend.h"
 #include <vector>
 #include "PMTree2D.h"
 
 class MainWindow;
 
+/**
+ * Render backend that draws to the default framebuffer of the widget.
+ */
+class WidgetBackend : public RenderBackend {
+public:
+	QGLWidget* widget;
+
+public:
+	WidgetBackend(QGLWidget* widget) : widget(widget) {}
+
+	void makeCurrent() { widget->makeCurrent(); }
+	GLuint framebuffer() { return 0; }
+	int width() { return widget->width(); }
+	int height() { return widget->height(); }
+	QImage readImage() { return widget->grabFrameBuffer(); }
+};
+
 class GLWidget3D : public QGLWidget {
 public:
 	MainWindow* mainWin;
 	Camera camera;
 	glm::vec3 light_dir;
-	glm::mat4 light_mvpMatrix;
 	RenderManager renderManager;
+	WidgetBackend backend;
 	QPoint lastPos;
 	bool ctrlPressed;
 	bool shiftPressed;
@@ -28,10 +46,8 @@ public:
 public:
 	GLWidget3D(MainWindow *parent);
 	void generateTrainingData();
-	int computePatchType(const cv::Mat& patch);
 	void generatePredictedData();
 	void render();
-	void drawScene();
 
 	void keyPressEvent(QKeyEvent* e);
 	void keyReleaseEvent(QKeyEvent* e);
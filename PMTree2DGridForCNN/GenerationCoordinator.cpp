@@ -0,0 +1,192 @@
+#include "GenerationCoordinator.h"
+#include "DatasetManifest.h"
+#include <QEventLoop>
+#include <iostream>
+#include <algorithm>
+
+GenerationCoordinator::GenerationCoordinator() {
+	numWorkers = 1;
+	maxRetries = 3;
+	rangeSize = 0;
+	numTrees = 0;
+	finishedTrees = 0;
+	running = 0;
+	failed = false;
+	loop = NULL;
+}
+
+/**
+ * Generate the trees [firstTree, firstTree + numTrees) with the worker processes, and merge
+ * the ranges into the index of the dataset.
+ *
+ * @param program			executable of the workers
+ * @param arguments			options of the workers except the range
+ * @param outputDir			output directory
+ * @param firstTree			index of the first tree
+ * @param numTrees			number of the trees
+ * @param rangeSize			number of the trees per range
+ * @return					0 if all the ranges are complete and in the index
+ */
+int GenerationCoordinator::run(const QString& program, const QStringList& arguments, const QString& outputDir, int firstTree, int numTrees, int rangeSize) {
+	this->program = program;
+	this->arguments = arguments;
+	this->outputDir = outputDir;
+	this->rangeSize = rangeSize;
+	this->numTrees = numTrees;
+	finishedTrees = 0;
+	running = 0;
+	failed = false;
+
+	// the same ranges as DatasetGenerator::generateTrainingData()
+	pending.clear();
+	int endTree = firstTree + numTrees;
+	for (int first = firstTree; first < endTree;) {
+		int end = (std::min)((first / rangeSize + 1) * rangeSize, endTree);
+		pending.push_back(std::make_pair(std::make_pair(first, end), 0));
+		first = end;
+	}
+
+	QEventLoop eventLoop;
+	loop = &eventLoop;
+	workers.assign((std::min)(numWorkers, (int)pending.size()), Worker());
+	for (int i = 0; i < workers.size(); ++i) {
+		launch(i);
+	}
+	if (running > 0) eventLoop.exec();
+	loop = NULL;
+
+	for (int i = 0; i < workers.size(); ++i) {
+		delete workers[i].process;
+	}
+	workers.clear();
+
+	std::cout << "Merging the ranges" << std::endl;
+	if (DatasetIndex::merge(outputDir, QStringList(outputDir), false) < 0) {
+		failed = true;
+	}
+	else if (!DatasetIndex::covers(outputDir, firstTree, endTree)) {
+		std::cout << "Error: trees " << firstTree << " to " << endTree - 1 << " are not all in the index" << std::endl;
+		failed = true;
+	}
+
+	return failed ? 1 : 0;
+}
+
+/**
+ * Return the arguments of this process without the options in "removed" and their values.
+ *
+ * @param arguments		arguments of this process without the program
+ * @param removed		options with a value, such as "--trees"
+ * @return				arguments for the workers
+ */
+QStringList GenerationCoordinator::workerArguments(const QStringList& arguments, const QStringList& removed) {
+	QStringList result;
+	for (int i = 0; i < arguments.size(); ++i) {
+		bool skip = false;
+		for (int k = 0; k < removed.size(); ++k) {
+			if (arguments[i] == removed[k]) {
+				skip = true;
+				i++;	// the value
+				break;
+			}
+			if (arguments[i].startsWith(removed[k] + "=")) {
+				skip = true;
+				break;
+			}
+		}
+		if (!skip) result.push_back(arguments[i]);
+	}
+	return result;
+}
+
+/**
+ * Start a worker for the next pending range, or quit the event loop when all the workers
+ * have finished.
+ */
+void GenerationCoordinator::launch(int slot) {
+	Worker& worker = workers[slot];
+	delete worker.process;
+	worker.process = NULL;
+
+	if (pending.empty() || failed) {
+		if (running == 0 && loop != NULL) loop->quit();
+		return;
+	}
+
+	worker.first = pending.front().first.first;
+	worker.end = pending.front().first.second;
+	worker.retries = pending.front().second;
+	worker.done = 0;
+	worker.buffer.clear();
+	pending.pop_front();
+
+	QStringList args = arguments;
+	args << "--first" << QString::number(worker.first) << "--trees" << QString::number(worker.end - worker.first)
+		<< "--range-size" << QString::number(rangeSize) << "--profile-name" << QString("profile_%1").arg(worker.first, 8, 10, QChar('0')) << "--progress";
+
+	worker.process = new QProcess();
+	worker.process->setProcessChannelMode(QProcess::MergedChannels);
+	QObject::connect(worker.process, &QProcess::readyReadStandardOutput, [this, slot]() { readOutput(slot); });
+	QObject::connect(worker.process, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), [this, slot](int exitCode, QProcess::ExitStatus exitStatus) {
+		finished(slot, exitCode, exitStatus);
+	});
+	running++;
+	worker.process->start(program, args);
+	if (!worker.process->waitForStarted()) {
+		std::cout << "Error: could not start " << program.toUtf8().constData() << std::endl;
+		failed = true;
+		running--;
+		launch(slot);
+	}
+}
+
+/**
+ * Count the trees that the worker has finished, and pass the errors of the worker through.
+ */
+void GenerationCoordinator::readOutput(int slot) {
+	Worker& worker = workers[slot];
+	worker.buffer.append(worker.process->readAllStandardOutput());
+
+	int pos;
+	while ((pos = worker.buffer.indexOf('\n')) >= 0) {
+		QString line = QString::fromUtf8(worker.buffer.left(pos)).trimmed();
+		worker.buffer.remove(0, pos + 1);
+
+		if (line.startsWith("tree ")) {
+			worker.done++;
+			finishedTrees++;
+			std::cout << "\r" << finishedTrees << " / " << numTrees << " trees" << std::flush;
+		}
+		else if (line.startsWith("Error")) {
+			std::cout << std::endl << "[trees " << worker.first << "-" << worker.end - 1 << "] " << line.toUtf8().constData() << std::endl;
+		}
+	}
+}
+
+/**
+ * Start the next range, or the same range again if the worker has failed.
+ */
+void GenerationCoordinator::finished(int slot, int exitCode, QProcess::ExitStatus exitStatus) {
+	Worker& worker = workers[slot];
+	readOutput(slot);
+	running--;
+
+	if (exitStatus != QProcess::NormalExit || exitCode != 0) {
+		std::cout << std::endl << "Worker of trees " << worker.first << "-" << worker.end - 1 << " failed (exit code " << exitCode << ")";
+		finishedTrees -= worker.done;	// the range is generated again
+		if (worker.retries < maxRetries) {
+			std::cout << ", restarting" << std::endl;
+			pending.push_front(std::make_pair(std::make_pair(worker.first, worker.end), worker.retries + 1));
+		}
+		else {
+			std::cout << std::endl;
+			failed = true;
+		}
+	}
+
+	// the process is deleted after its signal has returned
+	QObject::disconnect(worker.process, 0, 0, 0);
+	worker.process->deleteLater();
+	worker.process = NULL;
+	launch(slot);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QProcess>
+#include <vector>
+#include <deque>
+#include <utility>
+
+class QEventLoop;
+
+/**
+ * Coordinator of the headless worker processes that generate the ranges of the training data.
+ * Each worker is this executable with the same options for one range of trees, so the workers
+ * write the same ranges as a single process, and the completed ranges are merged into the index
+ * of the dataset at the end. The workers report the trees they have finished on the standard
+ * output ("tree N", also for the trees of the completed ranges that are skipped), and a worker
+ * that fails is started again for its range, which continues where it stopped since the ranges
+ * are resumable.
+ */
+class GenerationCoordinator {
+public:
+	int numWorkers;
+	int maxRetries;		// number of the restarts of a range
+
+private:
+	class Worker {
+	public:
+		QProcess* process;
+		int first;		// range of the worker
+		int end;
+		int retries;
+		int done;			// number of the trees reported
+		QByteArray buffer;	// output not yet split into lines
+
+	public:
+		Worker() : process(NULL), first(0), end(0), retries(0), done(0) {}
+	};
+
+	QString program;
+	QStringList arguments;
+	QString outputDir;
+	int rangeSize;
+	std::vector<Worker> workers;
+	std::deque<std::pair<std::pair<int, int>, int> > pending;	// ranges not started yet, and their retries
+	int numTrees;
+	int finishedTrees;
+	int running;
+	bool failed;
+	QEventLoop* loop;
+
+public:
+	GenerationCoordinator();
+
+	int run(const QString& program, const QStringList& arguments, const QString& outputDir, int firstTree, int numTrees, int rangeSize);
+	static QStringList workerArguments(const QStringList& arguments, const QStringList& removed);
+
+private:
+	void launch(int slot);
+	void readOutput(int slot);
+	void finished(int slot, int exitCode, QProcess::ExitStatus exitStatus);
+};
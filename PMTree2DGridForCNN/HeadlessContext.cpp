@@ -0,0 +1,172 @@
+#include "HeadlessContext.h"
+
+#ifdef PMTREE_USE_EGL
+#include <EGL/eglext.h>
+#include <cstring>
+#else
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <QSurfaceFormat>
+#endif
+
+#ifdef PMTREE_USE_EGL
+
+HeadlessContext::HeadlessContext() {
+	display = EGL_NO_DISPLAY;
+	context = EGL_NO_CONTEXT;
+}
+
+HeadlessContext::~HeadlessContext() {
+	destroy();
+}
+
+/**
+ * Create the context and make it current.
+ *
+ * @param error		the reason of the failure
+ * @return			true if the context has been created
+ */
+bool HeadlessContext::create(std::string& error) {
+	// the surfaceless platform does not need a display server
+	const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	if (extensions != NULL && strstr(extensions, "EGL_MESA_platform_surfaceless") != NULL) {
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay != NULL) {
+			display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		}
+	}
+	if (display == EGL_NO_DISPLAY) {
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	if (display == EGL_NO_DISPLAY) {
+		error = "no EGL display";
+		return false;
+	}
+
+	EGLint major, minor;
+	if (!eglInitialize(display, &major, &minor)) {
+		error = "eglInitialize failed";
+		return false;
+	}
+
+	const EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_DEPTH_SIZE, 24,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint numConfigs = 0;
+	if (!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+		error = "no EGL config for desktop OpenGL";
+		return false;
+	}
+
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		error = "desktop OpenGL is not supported by EGL";
+		return false;
+	}
+
+	const EGLint contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 2,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+		EGL_NONE
+	};
+	context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+	if (context == EGL_NO_CONTEXT) {
+		error = "OpenGL 4.2 compatibility context is not available";
+		return false;
+	}
+
+	// the context renders only to its own framebuffers (EGL_KHR_surfaceless_context)
+	if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+		error = "eglMakeCurrent failed (EGL_KHR_surfaceless_context is required)";
+		return false;
+	}
+
+	return true;
+}
+
+void HeadlessContext::makeCurrent() {
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+}
+
+void HeadlessContext::destroy() {
+	if (display == EGL_NO_DISPLAY) return;
+
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (context != EGL_NO_CONTEXT) {
+		eglDestroyContext(display, context);
+	}
+	eglTerminate(display);
+	display = EGL_NO_DISPLAY;
+	context = EGL_NO_CONTEXT;
+}
+
+#else
+
+HeadlessContext::HeadlessContext() {
+	context = NULL;
+	surface = NULL;
+}
+
+HeadlessContext::~HeadlessContext() {
+	destroy();
+}
+
+/**
+ * Create the context and make it current.
+ *
+ * @param error		the reason of the failure
+ * @return			true if the context has been created
+ */
+bool HeadlessContext::create(std::string& error) {
+	QSurfaceFormat format;
+	format.setVersion(4, 2);
+	format.setProfile(QSurfaceFormat::CompatibilityProfile);
+	format.setDepthBufferSize(24);
+
+	surface = new QOffscreenSurface();
+	surface->setFormat(format);
+	surface->create();
+	if (!surface->isValid()) {
+		error = "failed to create an offscreen surface";
+		return false;
+	}
+
+	context = new QOpenGLContext();
+	context->setFormat(format);
+	if (!context->create()) {
+		error = "failed to create an OpenGL context";
+		return false;
+	}
+
+	if (!context->makeCurrent(surface)) {
+		error = "failed to make the OpenGL context current";
+		return false;
+	}
+
+	return true;
+}
+
+void HeadlessContext::makeCurrent() {
+	context->makeCurrent(surface);
+}
+
+void HeadlessContext::destroy() {
+	if (context != NULL) {
+		context->doneCurrent();
+		delete context;
+		context = NULL;
+	}
+	if (surface != NULL) {
+		delete surface;
+		surface = NULL;
+	}
+}
+
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+
+#ifdef PMTREE_USE_EGL
+#include <EGL/egl.h>
+#else
+class QOpenGLContext;
+class QOffscreenSurface;
+#endif
+
+/**
+ * OpenGL context that does not need a window.
+ *
+ * With PMTREE_USE_EGL, a surfaceless EGL context is created (EGL_MESA_platform_surfaceless),
+ * which runs on a machine without a display server, e.g. with Mesa's llvmpipe
+ * (LIBGL_ALWAYS_SOFTWARE=1). glew has to be built with GLEW_EGL in this case, and libEGL
+ * has to be linked. The project file has no such configuration yet.
+ * Otherwise, a QOpenGLContext with a hidden QOffscreenSurface is used, which needs a
+ * QGuiApplication but never shows a window.
+ *
+ * The shaders use the compatibility profile (GL_QUADS, glMatrixMode), so a 4.2
+ * compatibility context is requested.
+ */
+class HeadlessContext {
+private:
+#ifdef PMTREE_USE_EGL
+	EGLDisplay display;
+	EGLContext context;
+#else
+	QOpenGLContext* context;
+	QOffscreenSurface* surface;
+#endif
+
+public:
+	HeadlessContext();
+	~HeadlessContext();
+
+	bool create(std::string& error);
+	void makeCurrent();
+	void destroy();
+};
@@ -0,0 +1,325 @@
+#include "LabelRasterizer.h"
+#include "SoftwareRasterizer.h"
+#include "Camera.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#define LABELRASTERIZER_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace {
+	// the primitives thinner than this are widened, so that the skeleton stays connected in the label map
+	const float MIN_RADIUS = 0.5f;
+
+	// the primitives closer to the camera than this are not rasterized
+	const float MIN_DEPTH = 1e-3f;
+
+	// the bin entries of the ellipses are offset by this to tell them from the capsules
+	const int ELLIPSE_BASE = 1 << 30;
+
+	/** project the world point to the screen (top-down pixels) and return the view depth (clip w) */
+	float project(const glm::mat4& mvpMatrix, const glm::vec3& p, int width, int height, float& x, float& y) {
+		glm::vec4 clip = mvpMatrix * glm::vec4(p, 1.0f);
+		if (clip.w < MIN_DEPTH) return clip.w;
+		x = (clip.x / clip.w * 0.5f + 0.5f) * width;
+		y = (0.5f - clip.y / clip.w * 0.5f) * height;
+		return clip.w;
+	}
+}
+
+LabelRasterizer::LabelRasterizer() {
+	numThreads = 0;
+	width = 0;
+	height = 0;
+	tileCols = 0;
+	tileRows = 0;
+}
+
+/**
+ * Rasterize the label map of the skeleton.
+ *
+ * @param segments			segments of the skeleton (world coordinates)
+ * @param leaves			leaves (world coordinates)
+ * @param camera			camera (mvpMatrix and pMatrix are used)
+ * @param width				image width
+ * @param height			image height
+ * @param labels [OUT]		class id of each pixel (CV_8U, top-down)
+ */
+void LabelRasterizer::render(const std::vector<LabelSegment>& segments, const std::vector<LabelLeaf>& leaves, const Camera& camera, int width, int height, cv::Mat& labels) {
+	this->width = width;
+	this->height = height;
+	tileCols = (width + TILE_SIZE - 1) / TILE_SIZE;
+	tileRows = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+	setupPrimitives(segments, leaves, camera);
+
+	labels.create(height, width, CV_8U);
+	SoftwareRasterizer::parallelFor(tileCols * tileRows, numThreads, [&](int tile) { rasterizeTile(tile, labels); });
+}
+
+/**
+ * Convert the label map to the class color image of SoftwareRasterizer (BGRA), e.g. to compare
+ * it with the rendered color image by SoftwareRasterizer::compareClasses().
+ */
+cv::Mat LabelRasterizer::colorize(const cv::Mat& labels) {
+	static const cv::Vec4b colors[4] = { cv::Vec4b(255, 255, 255, 255), cv::Vec4b(0, 0, 255, 255), cv::Vec4b(0, 255, 0, 255), cv::Vec4b(255, 0, 0, 255) };
+
+	cv::Mat image(labels.rows, labels.cols, CV_8UC4);
+	for (int r = 0; r < labels.rows; ++r) {
+		const unsigned char* src = labels.ptr<unsigned char>(r);
+		cv::Vec4b* dst = image.ptr<cv::Vec4b>(r);
+		for (int c = 0; c < labels.cols; ++c) {
+			dst[c] = colors[src[c] & 3];
+		}
+	}
+	return image;
+}
+
+/**
+ * Project the segments and the leaves to the screen, and bin them into the tiles.
+ * The projected radius of a segment is taken at each end point, and the leaf is projected as
+ * the ellipse spanned by its projected half axes. A leaf seen edge-on becomes a thin capsule.
+ */
+void LabelRasterizer::setupPrimitives(const std::vector<LabelSegment>& segments, const std::vector<LabelLeaf>& leaves, const Camera& camera) {
+	const glm::mat4& mvpMatrix = camera.mvpMatrix;
+	float pixelsPerUnit = camera.pMatrix[1][1] * height * 0.5f;	// at the view depth 1
+
+	capsules.clear();
+	ellipses.clear();
+	bins.resize(tileCols * tileRows);
+	for (int i = 0; i < bins.size(); ++i) {
+		bins[i].clear();
+	}
+
+	for (int i = 0; i < segments.size(); ++i) {
+		const LabelSegment& segment = segments[i];
+		float x1, y1, x2, y2;
+		float w1 = project(mvpMatrix, segment.p1, width, height, x1, y1);
+		float w2 = project(mvpMatrix, segment.p2, width, height, x2, y2);
+		if (w1 < MIN_DEPTH || w2 < MIN_DEPTH) continue;
+
+		float r1 = (std::max)(MIN_RADIUS, segment.r1 * pixelsPerUnit / w1);
+		float r2 = (std::max)(MIN_RADIUS, segment.r2 * pixelsPerUnit / w2);
+
+		Capsule capsule;
+		capsule.ax = x1;
+		capsule.ay = y1;
+		capsule.dx = x2 - x1;
+		capsule.dy = y2 - y1;
+		float length2 = capsule.dx * capsule.dx + capsule.dy * capsule.dy;
+		capsule.invLength2 = length2 > 1e-12f ? 1.0f / length2 : 0.0f;
+		capsule.r1 = r1;
+		capsule.dr = r2 - r1;
+		capsule.z1 = w1;
+		capsule.dz = w2 - w1;
+		capsule.cls = segment.cls;
+		addCapsule(capsule, (std::max)(r1, r2));
+	}
+
+	for (int i = 0; i < leaves.size(); ++i) {
+		const LabelLeaf& leaf = leaves[i];
+		float cx, cy, ux, uy, vx, vy;
+		float w = project(mvpMatrix, leaf.center, width, height, cx, cy);
+		float wu = project(mvpMatrix, leaf.center + leaf.axis1, width, height, ux, uy);
+		float wv = project(mvpMatrix, leaf.center + leaf.axis2, width, height, vx, vy);
+		if (w < MIN_DEPTH || wu < MIN_DEPTH || wv < MIN_DEPTH) continue;
+		ux -= cx;
+		uy -= cy;
+		vx -= cx;
+		vy -= cy;
+
+		float det = ux * vy - vx * uy;
+		if (fabs(det) < MIN_RADIUS * MIN_RADIUS) {
+			// edge-on: capsule along the longer axis
+			if (ux * ux + uy * uy < vx * vx + vy * vy) {
+				std::swap(ux, vx);
+				std::swap(uy, vy);
+			}
+			Capsule capsule;
+			capsule.ax = cx - ux;
+			capsule.ay = cy - uy;
+			capsule.dx = ux * 2.0f;
+			capsule.dy = uy * 2.0f;
+			float length2 = capsule.dx * capsule.dx + capsule.dy * capsule.dy;
+			capsule.invLength2 = length2 > 1e-12f ? 1.0f / length2 : 0.0f;
+			capsule.r1 = MIN_RADIUS;
+			capsule.dr = 0.0f;
+			capsule.z1 = w;
+			capsule.dz = 0.0f;
+			capsule.cls = SoftwareRasterizer::CLASS_LEAF;
+			addCapsule(capsule, MIN_RADIUS);
+			continue;
+		}
+
+		Ellipse ellipse;
+		ellipse.cx = cx;
+		ellipse.cy = cy;
+		ellipse.m00 = vy / det;
+		ellipse.m01 = -vx / det;
+		ellipse.m10 = -uy / det;
+		ellipse.m11 = ux / det;
+		ellipse.z = w;
+
+		float extentX = sqrtf(ux * ux + vx * vx);
+		float extentY = sqrtf(uy * uy + vy * vy);
+		ellipse.minX = (std::max)(0, (int)std::floor(cx - extentX));
+		ellipse.maxX = (std::min)(width - 1, (int)std::floor(cx + extentX));
+		ellipse.minY = (std::max)(0, (int)std::floor(cy - extentY));
+		ellipse.maxY = (std::min)(height - 1, (int)std::floor(cy + extentY));
+		if (ellipse.minX > ellipse.maxX || ellipse.minY > ellipse.maxY) continue;
+
+		int index = ellipses.size();
+		ellipses.push_back(ellipse);
+		for (int ty = ellipse.minY / TILE_SIZE; ty <= ellipse.maxY / TILE_SIZE; ++ty) {
+			for (int tx = ellipse.minX / TILE_SIZE; tx <= ellipse.maxX / TILE_SIZE; ++tx) {
+				bins[ty * tileCols + tx].push_back(ELLIPSE_BASE + index);
+			}
+		}
+	}
+}
+
+void LabelRasterizer::addCapsule(const Capsule& capsule, float maxRadius) {
+	float x2 = capsule.ax + capsule.dx;
+	float y2 = capsule.ay + capsule.dy;
+
+	Capsule c = capsule;
+	c.minX = (std::max)(0, (int)std::floor((std::min)(c.ax, x2) - maxRadius));
+	c.maxX = (std::min)(width - 1, (int)std::floor((std::max)(c.ax, x2) + maxRadius));
+	c.minY = (std::max)(0, (int)std::floor((std::min)(c.ay, y2) - maxRadius));
+	c.maxY = (std::min)(height - 1, (int)std::floor((std::max)(c.ay, y2) + maxRadius));
+	if (c.minX > c.maxX || c.minY > c.maxY) return;
+
+	int index = capsules.size();
+	capsules.push_back(c);
+	for (int ty = c.minY / TILE_SIZE; ty <= c.maxY / TILE_SIZE; ++ty) {
+		for (int tx = c.minX / TILE_SIZE; tx <= c.maxX / TILE_SIZE; ++tx) {
+			bins[ty * tileCols + tx].push_back(index);
+		}
+	}
+}
+
+/**
+ * Rasterize the primitives of the tile into the tile buffers of depth and class, and copy the
+ * class to the label map. The class is kept as float, so that it can be selected by the same
+ * mask as the depth.
+ */
+void LabelRasterizer::rasterizeTile(int tile, cv::Mat& labels) {
+	float tileDepth[TILE_SIZE * TILE_SIZE];
+	float tileClass[TILE_SIZE * TILE_SIZE];
+	std::fill(tileDepth, tileDepth + TILE_SIZE * TILE_SIZE, (std::numeric_limits<float>::max)());
+	std::fill(tileClass, tileClass + TILE_SIZE * TILE_SIZE, (float)SoftwareRasterizer::CLASS_BACKGROUND);
+
+	int tileX0 = (tile % tileCols) * TILE_SIZE;
+	int tileY0 = (tile / tileCols) * TILE_SIZE;
+
+	const std::vector<int>& bin = bins[tile];
+	for (int b = 0; b < bin.size(); ++b) {
+		bool isLeaf = bin[b] >= ELLIPSE_BASE;
+		const Capsule* capsule = isLeaf ? NULL : &capsules[bin[b]];
+		const Ellipse* ellipse = isLeaf ? &ellipses[bin[b] - ELLIPSE_BASE] : NULL;
+		int minX = isLeaf ? ellipse->minX : capsule->minX;
+		int maxX = isLeaf ? ellipse->maxX : capsule->maxX;
+		int minY = isLeaf ? ellipse->minY : capsule->minY;
+		int maxY = isLeaf ? ellipse->maxY : capsule->maxY;
+
+		// span in the tile, starting at a multiple of 4 for SSE
+		int x0 = (std::max)(minX, tileX0) - tileX0;
+		int x1 = (std::min)(maxX, tileX0 + TILE_SIZE - 1) - tileX0;
+		int y0 = (std::max)(minY, tileY0) - tileY0;
+		int y1 = (std::min)(maxY, tileY0 + TILE_SIZE - 1) - tileY0;
+		int xStart = x0 & ~3;
+
+		for (int y = y0; y <= y1; ++y) {
+			float py = tileY0 + y + 0.5f;
+			float* depthRow = tileDepth + y * TILE_SIZE;
+			float* classRow = tileClass + y * TILE_SIZE;
+
+#ifdef LABELRASTERIZER_USE_SSE
+			__m128 lane = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+			__m128 spanMin = _mm_set1_ps((float)x0);
+			__m128 spanMax = _mm_set1_ps((float)x1 + 1.0f);
+			for (int x = xStart; x <= x1; x += 4) {
+				__m128 lx = _mm_add_ps(_mm_set1_ps((float)x), lane);
+				__m128 inSpan = _mm_and_ps(_mm_cmpgt_ps(lx, spanMin), _mm_cmplt_ps(lx, spanMax));
+				__m128 px = _mm_add_ps(lx, _mm_set1_ps((float)tileX0));
+				__m128 inside;
+				__m128 z;
+				__m128 cls;
+				if (isLeaf) {
+					__m128 qx = _mm_sub_ps(px, _mm_set1_ps(ellipse->cx));
+					__m128 qy = _mm_set1_ps(py - ellipse->cy);
+					__m128 s = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ellipse->m00), qx), _mm_mul_ps(_mm_set1_ps(ellipse->m01), qy));
+					__m128 t = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ellipse->m10), qx), _mm_mul_ps(_mm_set1_ps(ellipse->m11), qy));
+					inside = _mm_cmple_ps(_mm_add_ps(_mm_mul_ps(s, s), _mm_mul_ps(t, t)), _mm_set1_ps(1.0f));
+					z = _mm_set1_ps(ellipse->z);
+					cls = _mm_set1_ps((float)SoftwareRasterizer::CLASS_LEAF);
+				}
+				else {
+					__m128 qx = _mm_sub_ps(px, _mm_set1_ps(capsule->ax));
+					__m128 qy = _mm_set1_ps(py - capsule->ay);
+					__m128 dx = _mm_set1_ps(capsule->dx);
+					__m128 dy = _mm_set1_ps(capsule->dy);
+					__m128 t = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(qx, dx), _mm_mul_ps(qy, dy)), _mm_set1_ps(capsule->invLength2));
+					t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+					__m128 ex = _mm_sub_ps(qx, _mm_mul_ps(t, dx));
+					__m128 ey = _mm_sub_ps(qy, _mm_mul_ps(t, dy));
+					__m128 r = _mm_add_ps(_mm_set1_ps(capsule->r1), _mm_mul_ps(t, _mm_set1_ps(capsule->dr)));
+					inside = _mm_cmple_ps(_mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey)), _mm_mul_ps(r, r));
+					z = _mm_add_ps(_mm_set1_ps(capsule->z1), _mm_mul_ps(t, _mm_set1_ps(capsule->dz)));
+					cls = _mm_set1_ps((float)capsule->cls);
+				}
+
+				__m128 oldDepth = _mm_loadu_ps(depthRow + x);
+				__m128 mask = _mm_and_ps(_mm_and_ps(inside, inSpan), _mm_cmplt_ps(z, oldDepth));
+				_mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, oldDepth)));
+				_mm_storeu_ps(classRow + x, _mm_or_ps(_mm_and_ps(mask, cls), _mm_andnot_ps(mask, _mm_loadu_ps(classRow + x))));
+			}
+#else
+			for (int x = x0; x <= x1; ++x) {
+				float qx = tileX0 + x + 0.5f;
+				float z;
+				float cls;
+				bool inside;
+				if (isLeaf) {
+					qx -= ellipse->cx;
+					float qy = py - ellipse->cy;
+					float s = ellipse->m00 * qx + ellipse->m01 * qy;
+					float t = ellipse->m10 * qx + ellipse->m11 * qy;
+					inside = s * s + t * t <= 1.0f;
+					z = ellipse->z;
+					cls = (float)SoftwareRasterizer::CLASS_LEAF;
+				}
+				else {
+					qx -= capsule->ax;
+					float qy = py - capsule->ay;
+					float t = (std::min)(1.0f, (std::max)(0.0f, (qx * capsule->dx + qy * capsule->dy) * capsule->invLength2));
+					float ex = qx - t * capsule->dx;
+					float ey = qy - t * capsule->dy;
+					float r = capsule->r1 + t * capsule->dr;
+					inside = ex * ex + ey * ey <= r * r;
+					z = capsule->z1 + t * capsule->dz;
+					cls = (float)capsule->cls;
+				}
+
+				if (inside && z < depthRow[x]) {
+					depthRow[x] = z;
+					classRow[x] = cls;
+				}
+			}
+#endif
+		}
+	}
+
+	int rows = (std::min)(TILE_SIZE, height - tileY0);
+	int cols = (std::min)(TILE_SIZE, width - tileX0);
+	for (int y = 0; y < rows; ++y) {
+		unsigned char* dst = labels.ptr<unsigned char>(tileY0 + y) + tileX0;
+		const float* src = tileClass + y * TILE_SIZE;
+		for (int x = 0; x < cols; ++x) {
+			dst[x] = (unsigned char)src[x];
+		}
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include <opencv2/opencv.hpp>
+
+class Camera;
+
+/**
+ * Segment of the skeleton of the tree: a tapered cylinder from p1 to p2 in the world.
+ */
+struct LabelSegment {
+	glm::vec3 p1;
+	glm::vec3 p2;
+	float r1;			// radius at p1
+	float r2;			// radius at p2
+	unsigned char cls;	// SoftwareRasterizer::CLASS_XXX
+};
+
+/**
+ * Leaf of the tree: an elliptic disc with the half axes axis1 and axis2 in the world.
+ */
+struct LabelLeaf {
+	glm::vec3 center;
+	glm::vec3 axis1;
+	glm::vec3 axis2;
+};
+
+/**
+ * Rasterizer of the class label map from the skeleton of the tree, without rendering the mesh.
+ * The segments are projected as tapered capsules and the leaves as ellipses, and they are
+ * scan-converted tile-parallel from a per-tile list of the primitives, four pixels at once with
+ * SSE. The nearest primitive wins by the view depth of the skeleton.
+ * The label map has one class id (SoftwareRasterizer::CLASS_XXX) per pixel, top-down like the
+ * training images.
+ */
+class LabelRasterizer {
+public:
+	static const int TILE_SIZE = 64;
+
+	/** capsule in screen space: the points a + t * d (0 <= t <= 1) with the radius r1 + t * dr */
+	struct Capsule {
+		float ax, ay;
+		float dx, dy;
+		float invLength2;		// 1 / |d|^2 (0 if a = b)
+		float r1, dr;
+		float z1, dz;			// view depth
+		unsigned char cls;
+		int minX, minY, maxX, maxY;
+	};
+
+	/** ellipse in screen space: the points c + s * u + t * v (s^2 + t^2 <= 1) */
+	struct Ellipse {
+		float cx, cy;
+		float m00, m01, m10, m11;	// inverse of [u v]
+		float z;
+		int minX, minY, maxX, maxY;
+	};
+
+	int numThreads;		// 0 -- number of cores
+
+private:
+	int width;
+	int height;
+	int tileCols;
+	int tileRows;
+	std::vector<Capsule> capsules;
+	std::vector<Ellipse> ellipses;
+	std::vector<std::vector<int> > bins;	// capsule index, or the number of capsules + ellipse index
+
+public:
+	LabelRasterizer();
+
+	void render(const std::vector<LabelSegment>& segments, const std::vector<LabelLeaf>& leaves, const Camera& camera, int width, int height, cv::Mat& labels);
+	static cv::Mat colorize(const cv::Mat& labels);
+
+private:
+	void setupPrimitives(const std::vector<LabelSegment>& segments, const std::vector<LabelLeaf>& leaves, const Camera& camera);
+	void addCapsule(const Capsule& capsule, float maxRadius);
+	void rasterizeTile(int tile, cv::Mat& labels);
+};
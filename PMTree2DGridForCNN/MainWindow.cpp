@@ -26,7 +26,7 @@ void MainWindow::onRandomGeneration() {
 	glWidget->renderManager.removeObjects();
 	glWidget->tree.generateRandom();
 	glWidget->tree.generateGeometry(&glWidget->renderManager, false);
-	glWidget->updateGL();
+	glWidget->update();
 }
 
 void MainWindow::onGenerateTrainingData() {
@@ -4,6 +4,7 @@
 #include <iostream>
 #include "RenderManager.h"
 #include "Camera.h"
+#include "SoftwareRasterizer.h"
 
 namespace pmtree {
 
@@ -11,6 +12,7 @@ namespace pmtree {
 	const int NUM_SEGMENTS = 30;
 	const int NUM_LEVELS = 3;
 	const float MIN_SEGMENT_WIDTH = 0.005f;
+	const float LEAF_LENGTH = 0.1f;
 
 	/**
 	* Shape ratioを返却する。
@@ -160,7 +162,7 @@ namespace pmtree {
 		}
 	}
 
-	bool PMTree2D::generateGeometry(RenderManager* renderManager, bool fixed_width) {
+	bool PMTree2D::generateGeometry(RenderManager* renderManager, bool fixed_width, const QString& object_name) {
 		bool underground = false;
 
 		glm::mat4 modelMat;
@@ -172,7 +174,7 @@ namespace pmtree {
 
 		std::vector<Vertex> vertices;
 		if (generateSegmentGeometry(renderManager, modelMat, length, width, fixed_width, root, vertices)) underground = true;
-		renderManager->addObject("tree", "", vertices, true);
+		renderManager->addObject(object_name, "", vertices, true);
 
 		return underground;
 	}
@@ -180,20 +182,10 @@ namespace pmtree {
 	bool PMTree2D::generateSegmentGeometry(RenderManager* renderManager, const glm::mat4& modelMat, float segment_length, float segment_width, bool fixed_width, boost::shared_ptr<TreeNode>& node, std::vector<Vertex>& vertices) {
 		bool underground = false;
 
-		glm::mat4 mat = modelMat;
+		glm::mat4 mat = segmentMatrix(modelMat, node);
 
-		mat = glm::rotate(mat, node->rotateV / 180.0f * M_PI, glm::vec3(0, 1, 0));
-		mat = glm::rotate(mat, node->curveV / 180.0f * M_PI, glm::vec3(0, 0, 1));
-
-		float w1 = segment_width;
-		if (!fixed_width) {
-			w1 = (segment_width - MIN_SEGMENT_WIDTH) * (NUM_SEGMENTS - node->index) / NUM_SEGMENTS + MIN_SEGMENT_WIDTH;
-		}
-
-		float w2 = segment_width;
-		if (!fixed_width) {
-			w2 = (segment_width - MIN_SEGMENT_WIDTH) * (NUM_SEGMENTS - node->index - 1) / NUM_SEGMENTS + MIN_SEGMENT_WIDTH;
-		}
+		float w1, w2;
+		segmentWidths(segment_width, fixed_width, node, w1, w2);
 
 		glm::vec4 color(1, 0, 0, 1.0);
 		if (node->level > 0) {
@@ -227,15 +219,112 @@ namespace pmtree {
 	}
 
 	void PMTree2D::generateLeafGeometry(RenderManager* renderManager, const glm::mat4& modelMat, float segment_length, boost::shared_ptr<TreeNode>& node, std::vector<Vertex>& vertices) {
+		glm::mat4 mat = leafMatrix(modelMat, node);
+
+		glutils::drawCircle(LEAF_LENGTH * 0.25, LEAF_LENGTH * 0.5, glm::vec4(0, 0, 1, 1.0), mat, vertices);
+	}
+
+	/**
+	 * Generate the skeleton of the tree for LabelRasterizer: the center line of each segment with
+	 * its radii, and the leaves, at the same place as the geometry of generateGeometry().
+	 *
+	 * @param fixed_width	same as generateGeometry()
+	 * @param segments		segments
+	 * @param leaves		leaves
+	 */
+	void PMTree2D::generateSkeleton(bool fixed_width, std::vector<LabelSegment>& segments, std::vector<LabelLeaf>& leaves) {
+		segments.clear();
+		leaves.clear();
+
+		glm::mat4 modelMat;
+		float length = 10.0f / NUM_SEGMENTS;
+		float width = 0.3f;
+		if (fixed_width) {
+			width = 0.03f;
+		}
+
+		generateSegmentSkeleton(modelMat, length, width, fixed_width, root, segments, leaves);
+	}
+
+	void PMTree2D::generateSegmentSkeleton(const glm::mat4& modelMat, float segment_length, float segment_width, bool fixed_width, boost::shared_ptr<TreeNode>& node, std::vector<LabelSegment>& segments, std::vector<LabelLeaf>& leaves) {
+		glm::mat4 mat = segmentMatrix(modelMat, node);
+
+		float w1, w2;
+		segmentWidths(segment_width, fixed_width, node, w1, w2);
+
+		LabelSegment segment;
+		segment.p1 = glm::vec3(mat * glm::vec4(0, 0, 0, 1));
+		segment.p2 = glm::vec3(mat * glm::vec4(0, segment_length, 0, 1));
+		segment.r1 = w1 * 0.5f;
+		segment.r2 = w2 * 0.5f;
+		segment.cls = node->level > 0 ? SoftwareRasterizer::CLASS_BRANCH : SoftwareRasterizer::CLASS_TRUNK;
+		segments.push_back(segment);
+
+		mat = glm::translate(mat, glm::vec3(0, segment_length, 0));
+
+		if (node->children.size() >= 1) {
+			generateSegmentSkeleton(mat, segment_length, segment_width, fixed_width, node->children[0], segments, leaves);
+		}
+
+		if (node->children.size() >= 2) {
+			if (node->level < NUM_LEVELS - 1) {
+				if (fixed_width) {
+					generateSegmentSkeleton(mat, segment_length * node->children[1]->attenuationFactor, segment_width, fixed_width, node->children[1], segments, leaves);
+				}
+				else {
+					generateSegmentSkeleton(mat, segment_length * node->children[1]->attenuationFactor, std::max(MIN_SEGMENT_WIDTH, w1 * node->children[1]->attenuationFactor), fixed_width, node->children[1], segments, leaves);
+				}
+			}
+			else {
+				glm::mat4 leafMat = leafMatrix(mat, node->children[1]);
+
+				LabelLeaf leaf;
+				leaf.center = glm::vec3(leafMat * glm::vec4(0, 0, 0, 1));
+				leaf.axis1 = glm::vec3(leafMat * glm::vec4(LEAF_LENGTH * 0.25f, 0, 0, 0));
+				leaf.axis2 = glm::vec3(leafMat * glm::vec4(0, LEAF_LENGTH * 0.5f, 0, 0));
+				leaves.push_back(leaf);
+			}
+		}
+	}
+
+	/**
+	 * Return the local coordinate system of the segment, whose Y axis is the direction of the segment.
+	 */
+	glm::mat4 PMTree2D::segmentMatrix(const glm::mat4& modelMat, boost::shared_ptr<TreeNode>& node) {
 		glm::mat4 mat = modelMat;
 
 		mat = glm::rotate(mat, node->rotateV / 180.0f * M_PI, glm::vec3(0, 1, 0));
-		mat = glm::rotate(mat, 75.0f / 180.0f * M_PI, glm::vec3(0, 0, 1));
+		mat = glm::rotate(mat, node->curveV / 180.0f * M_PI, glm::vec3(0, 0, 1));
 
-		float leaf_length = 0.1f;
-		mat = glm::translate(mat, glm::vec3(0, leaf_length * 0.5, 0));
+		return mat;
+	}
+
+	/**
+	 * Return the widths of the segment at its base (w1) and its tip (w2).
+	 */
+	void PMTree2D::segmentWidths(float segment_width, bool fixed_width, boost::shared_ptr<TreeNode>& node, float& w1, float& w2) {
+		w1 = segment_width;
+		if (!fixed_width) {
+			w1 = (segment_width - MIN_SEGMENT_WIDTH) * (NUM_SEGMENTS - node->index) / NUM_SEGMENTS + MIN_SEGMENT_WIDTH;
+		}
+
+		w2 = segment_width;
+		if (!fixed_width) {
+			w2 = (segment_width - MIN_SEGMENT_WIDTH) * (NUM_SEGMENTS - node->index - 1) / NUM_SEGMENTS + MIN_SEGMENT_WIDTH;
+		}
+	}
+
+	/**
+	 * Return the local coordinate system of the leaf, whose origin is the center of the leaf.
+	 */
+	glm::mat4 PMTree2D::leafMatrix(const glm::mat4& modelMat, boost::shared_ptr<TreeNode>& node) {
+		glm::mat4 mat = modelMat;
+
+		mat = glm::rotate(mat, node->rotateV / 180.0f * M_PI, glm::vec3(0, 1, 0));
+		mat = glm::rotate(mat, 75.0f / 180.0f * M_PI, glm::vec3(0, 0, 1));
+		mat = glm::translate(mat, glm::vec3(0, LEAF_LENGTH * 0.5, 0));
 
-		glutils::drawCircle(leaf_length * 0.25, leaf_length * 0.5, glm::vec4(0, 0, 1, 1.0), mat, vertices);
+		return mat;
 	}
 
 	void PMTree2D::generateTrainingData(const cv::Mat& image, Camera* camera, int screenWidth, int screenHeight, std::vector<cv::Mat>& localImages, std::vector<std::vector<float> >& parameters) {
@@ -4,7 +4,9 @@
 #include "boost/shared_ptr.hpp"
 #include <string>
 #include <vector>
+#include <QString>
 #include "Vertex.h"
+#include "LabelRasterizer.h"
 #include <opencv2/opencv.hpp>
 
 class RenderManager;
@@ -43,7 +45,8 @@ namespace pmtree {
 		PMTree2D();
 
 		void generateRandom();
-		bool generateGeometry(RenderManager* renderManager, bool fixed_width);
+		bool generateGeometry(RenderManager* renderManager, bool fixed_width, const QString& object_name = "tree");
+		void generateSkeleton(bool fixed_width, std::vector<LabelSegment>& segments, std::vector<LabelLeaf>& leaves);
 		void generateTrainingData(const cv::Mat& image, Camera* camera, int screenWidth, int screenHeight, std::vector<cv::Mat>& localImages, std::vector<std::vector<float> >& parameters);
 		void generateTrainingData(const glm::mat4& modelMat, float segment_length, boost::shared_ptr<TreeNode>& node, const cv::Mat& imagePadded, int padding, Camera* camera, int screenWidth, int screenHeight, std::vector<cv::Mat>& localImages, std::vector<std::vector<float> >& parameters);
 		std::string to_string();
@@ -53,6 +56,10 @@ namespace pmtree {
 	private:
 		bool generateSegmentGeometry(RenderManager* renderManager, const glm::mat4& modelMat, float segment_length, float segment_width, bool fixed_width, boost::shared_ptr<TreeNode>& node, std::vector<Vertex>& vertices);
 		void generateLeafGeometry(RenderManager* renderManager, const glm::mat4& modelMat, float segment_length, boost::shared_ptr<TreeNode>& node, std::vector<Vertex>& vertices);
+		void generateSegmentSkeleton(const glm::mat4& modelMat, float segment_length, float segment_width, bool fixed_width, boost::shared_ptr<TreeNode>& node, std::vector<LabelSegment>& segments, std::vector<LabelLeaf>& leaves);
+		glm::mat4 segmentMatrix(const glm::mat4& modelMat, boost::shared_ptr<TreeNode>& node);
+		void segmentWidths(float segment_width, bool fixed_width, boost::shared_ptr<TreeNode>& node, float& w1, float& w2);
+		glm::mat4 leafMatrix(const glm::mat4& modelMat, boost::shared_ptr<TreeNode>& node);
 	};
 
 }
\ No newline at end of file
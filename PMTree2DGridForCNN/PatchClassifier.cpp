@@ -0,0 +1,260 @@
+#include "PatchClassifier.h"
+#include <cstring>
+#include <iostream>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define PATCHCLASSIFIER_USE_SSE
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PATCHCLASSIFIER_USE_NEON
+#include <arm_neon.h>
+#endif
+
+/**
+ * Classify the pixels of the color image, and build the summed-area table.
+ *
+ * @param image		color image (BGRA or BGR)
+ */
+void PatchClassifier::setImage(const cv::Mat& image) {
+	classifyPixels(image, classes);
+	buildSums();
+}
+
+/**
+ * Build the summed-area table from the label map of LabelRasterizer, whose class ids are the
+ * same as the ones of the patches.
+ *
+ * @param labels	class id of each pixel (CV_8U)
+ */
+void PatchClassifier::setLabels(const cv::Mat& labels) {
+	classes = labels;
+	buildSums();
+}
+
+/**
+ * Return the type of the patch.
+ *
+ * @param rect		patch in the image given to setImage() / setLabels()
+ * @return			PATCH_XXX
+ */
+int PatchClassifier::classify(const cv::Rect& rect) const {
+	int trunk, branch, leaf;
+	count(rect, trunk, branch, leaf);
+	return decide(trunk, branch, leaf, rect.area());
+}
+
+/**
+ * Return the number of the pixels of each class in the rectangle.
+ */
+void PatchClassifier::count(const cv::Rect& rect, int& trunk, int& branch, int& leaf) const {
+	const cv::Vec3i& s00 = sums.at<cv::Vec3i>(rect.y, rect.x);
+	const cv::Vec3i& s01 = sums.at<cv::Vec3i>(rect.y, rect.x + rect.width);
+	const cv::Vec3i& s10 = sums.at<cv::Vec3i>(rect.y + rect.height, rect.x);
+	const cv::Vec3i& s11 = sums.at<cv::Vec3i>(rect.y + rect.height, rect.x + rect.width);
+
+	trunk = s11[0] - s01[0] - s10[0] + s00[0];
+	branch = s11[1] - s01[1] - s10[1] + s00[1];
+	leaf = s11[2] - s01[2] - s10[2] + s00[2];
+}
+
+/**
+ * Decide the type of the patch from the number of the pixels of each class.
+ * A patch is background if less than 1% of the pixels belong to the tree, and otherwise the
+ * class with the most pixels (trunk first, then branch, on ties).
+ *
+ * @param trunk		number of the trunk pixels
+ * @param branch	number of the branch pixels
+ * @param leaf		number of the leaf pixels
+ * @param area		number of the pixels of the patch
+ * @return			PATCH_XXX
+ */
+int PatchClassifier::decide(int trunk, int branch, int leaf, int area) {
+	int threshold = area * 0.01;
+
+	if (trunk + branch + leaf < threshold) return PATCH_BACKGROUND;
+	else if (trunk > branch && trunk > leaf) return PATCH_TRUNK;
+	else if (branch > leaf) return PATCH_BRANCH;
+	else return PATCH_LEAF;
+}
+
+/**
+ * Classify each pixel of the color image.
+ * The rows of a BGRA image are classified 16 pixels at once with SSE2 / NEON, and the result is
+ * the same as classifyPixelsScalar().
+ *
+ * @param image			color image (BGRA or BGR)
+ * @param classes		class id of each pixel (CV_8U)
+ */
+void PatchClassifier::classifyPixels(const cv::Mat& image, cv::Mat& classes) {
+	if (image.channels() != 4) {
+		classifyPixelsScalar(image, classes);
+		return;
+	}
+
+	classifyRowsBGRA(image, classes);
+}
+
+/**
+ * Classify each pixel of the color image one by one. This is the reference of classifyPixels().
+ *
+ * @param image			color image (BGRA or BGR)
+ * @param classes		class id of each pixel (CV_8U)
+ */
+void PatchClassifier::classifyPixelsScalar(const cv::Mat& image, cv::Mat& classes) {
+	classes.create(image.rows, image.cols, CV_8U);
+
+	int channels = image.channels();
+	for (int r = 0; r < image.rows; ++r) {
+		const unsigned char* src = image.ptr<unsigned char>(r);
+		unsigned char* dst = classes.ptr<unsigned char>(r);
+		for (int c = 0; c < image.cols; ++c, src += channels) {
+			dst[c] = classifyPixel(src[0], src[1], src[2]);
+		}
+	}
+}
+
+/**
+ * Compare the SIMD classification with classifyPixelsScalar() for all the 2^24 colors, on full
+ * rows and on unaligned rows whose length is not a multiple of 16.
+ * This is run by the --self-test option of the headless mode.
+ *
+ * @return			true if they are the same
+ */
+bool PatchClassifier::verify() {
+	cv::Mat image(256, 256, CV_8UC4);
+	cv::Mat roi = image(cv::Rect(3, 0, 250, 256));
+	cv::Mat classes, reference;
+
+	for (int blue = 0; blue < 256; ++blue) {
+		for (int green = 0; green < 256; ++green) {
+			for (int red = 0; red < 256; ++red) {
+				image.at<cv::Vec4b>(green, red) = cv::Vec4b(blue, green, red, 255);
+			}
+		}
+
+		for (int k = 0; k < 2; ++k) {
+			const cv::Mat& src = k == 0 ? image : roi;
+			classifyPixelsScalar(src, reference);
+			classifyRowsBGRA(src, classes);
+			if (cv::countNonZero(classes != reference) > 0) {
+				std::cout << "Error: SIMD pixel classification differs from the scalar one (blue = " << blue << ")" << std::endl;
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Classify each pixel of the BGRA image, 16 pixels at once as long as they are left in the row.
+ */
+void PatchClassifier::classifyRowsBGRA(const cv::Mat& image, cv::Mat& classes) {
+	classes.create(image.rows, image.cols, CV_8U);
+
+	for (int r = 0; r < image.rows; ++r) {
+		const unsigned char* src = image.ptr<unsigned char>(r);
+		unsigned char* dst = classes.ptr<unsigned char>(r);
+		int c = classifyRowSIMD(src, dst, image.cols);
+		for (; c < image.cols; ++c) {
+			dst[c] = classifyPixel(src[c * 4], src[c * 4 + 1], src[c * 4 + 2]);
+		}
+	}
+}
+
+/**
+ * Classify the pixels of a BGRA row with SIMD as long as 16 pixels are left.
+ * The comparisons are the ones of classifyPixel(). Trunk, branch and leaf exclude each other, so
+ * the class id is the OR of their masks, and it is cleared for the white pixels.
+ *
+ * @param src		BGRA pixels
+ * @param dst		class id of each pixel
+ * @param count		number of the pixels
+ * @return			number of the pixels classified
+ */
+int PatchClassifier::classifyRowSIMD(const unsigned char* src, unsigned char* dst, int count) {
+	int c = 0;
+
+#if defined(PATCHCLASSIFIER_USE_SSE)
+	// SSE2 has only the signed comparison of the bytes, so the bytes are offset by 128
+	const __m128i bias = _mm_set1_epi8((char)0x80);
+	const __m128i white = _mm_set1_epi8((char)(240 ^ 0x80));
+	const __m128i lowByte = _mm_set1_epi32(0xff);
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i two = _mm_set1_epi8(2);
+	const __m128i three = _mm_set1_epi8(3);
+
+	for (; c + 16 <= count; c += 16) {
+		__m128i p[4];
+		for (int i = 0; i < 4; ++i) {
+			p[i] = _mm_loadu_si128((const __m128i*)(src + (c + i * 4) * 4));
+		}
+
+		// deinterleave the channels into 16 bytes each
+		__m128i ch[3];
+		for (int k = 0; k < 3; ++k) {
+			__m128i q0 = _mm_and_si128(_mm_srli_epi32(p[0], k * 8), lowByte);
+			__m128i q1 = _mm_and_si128(_mm_srli_epi32(p[1], k * 8), lowByte);
+			__m128i q2 = _mm_and_si128(_mm_srli_epi32(p[2], k * 8), lowByte);
+			__m128i q3 = _mm_and_si128(_mm_srli_epi32(p[3], k * 8), lowByte);
+			ch[k] = _mm_xor_si128(_mm_packus_epi16(_mm_packs_epi32(q0, q1), _mm_packs_epi32(q2, q3)), bias);
+		}
+		__m128i b = ch[0];
+		__m128i g = ch[1];
+		__m128i r = ch[2];
+
+		__m128i isWhite = _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi8(b, white), _mm_cmpgt_epi8(g, white)), _mm_cmpgt_epi8(r, white));
+		__m128i isTrunk = _mm_and_si128(_mm_cmpgt_epi8(r, g), _mm_cmpgt_epi8(r, b));
+		__m128i isBranch = _mm_and_si128(_mm_cmpgt_epi8(g, r), _mm_cmpgt_epi8(g, b));
+		__m128i isLeaf = _mm_and_si128(_mm_cmpgt_epi8(b, g), _mm_cmpgt_epi8(b, r));
+
+		__m128i cls = _mm_or_si128(_mm_or_si128(_mm_and_si128(isTrunk, one), _mm_and_si128(isBranch, two)), _mm_and_si128(isLeaf, three));
+		_mm_storeu_si128((__m128i*)(dst + c), _mm_andnot_si128(isWhite, cls));
+	}
+#elif defined(PATCHCLASSIFIER_USE_NEON)
+	const uint8x16_t white = vdupq_n_u8(240);
+	const uint8x16_t one = vdupq_n_u8(1);
+	const uint8x16_t two = vdupq_n_u8(2);
+	const uint8x16_t three = vdupq_n_u8(3);
+
+	for (; c + 16 <= count; c += 16) {
+		uint8x16x4_t p = vld4q_u8(src + c * 4);
+		uint8x16_t b = p.val[0];
+		uint8x16_t g = p.val[1];
+		uint8x16_t r = p.val[2];
+
+		uint8x16_t isWhite = vandq_u8(vandq_u8(vcgtq_u8(b, white), vcgtq_u8(g, white)), vcgtq_u8(r, white));
+		uint8x16_t isTrunk = vandq_u8(vcgtq_u8(r, g), vcgtq_u8(r, b));
+		uint8x16_t isBranch = vandq_u8(vcgtq_u8(g, r), vcgtq_u8(g, b));
+		uint8x16_t isLeaf = vandq_u8(vcgtq_u8(b, g), vcgtq_u8(b, r));
+
+		uint8x16_t cls = vorrq_u8(vorrq_u8(vandq_u8(isTrunk, one), vandq_u8(isBranch, two)), vandq_u8(isLeaf, three));
+		vst1q_u8(dst + c, vbicq_u8(cls, isWhite));
+	}
+#endif
+
+	return c;
+}
+
+/**
+ * Build the summed-area table of the class ids: sums(r, c) is the number of the pixels of each
+ * class in the rows [0, r) and the columns [0, c).
+ */
+void PatchClassifier::buildSums() {
+	sums.create(classes.rows + 1, classes.cols + 1, CV_32SC3);
+	memset(sums.ptr(0), 0, sums.cols * sizeof(cv::Vec3i));
+
+	for (int r = 0; r < classes.rows; ++r) {
+		const unsigned char* src = classes.ptr<unsigned char>(r);
+		const cv::Vec3i* above = sums.ptr<cv::Vec3i>(r);
+		cv::Vec3i* dst = sums.ptr<cv::Vec3i>(r + 1);
+
+		// counts of the row so far (index 0 is the background)
+		int run[4] = { 0, 0, 0, 0 };
+		dst[0] = cv::Vec3i(0, 0, 0);
+		for (int c = 0; c < classes.cols; ++c) {
+			run[src[c] & 3]++;
+			dst[c + 1] = cv::Vec3i(above[c + 1][0] + run[1], above[c + 1][1] + run[2], above[c + 1][2] + run[3]);
+		}
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * Classifier of the patches of the training images.
+ * Each pixel is classified once into background / trunk / branch / leaf, and a summed-area table
+ * of the number of the pixels of each class is built, so that the class counts of any rectangle
+ * are obtained in O(1) regardless of the patch size and the stride. The decision from the counts
+ * is the same as the scan of the pixels of each patch (DatasetGenerator::computePatchType()),
+ * which is compared on the rendered trees with --validate.
+ */
+class PatchClassifier {
+public:
+	enum { PATCH_BACKGROUND = 0, PATCH_TRUNK, PATCH_BRANCH, PATCH_LEAF };
+
+private:
+	cv::Mat classes;	// class id of each pixel (CV_8U)
+	cv::Mat sums;		// summed-area table of the trunk, branch and leaf pixels ((rows + 1) x (cols + 1), CV_32SC3)
+
+public:
+	PatchClassifier() {}
+
+	void setImage(const cv::Mat& image);
+	void setLabels(const cv::Mat& labels);
+	int classify(const cv::Rect& rect) const;
+	void count(const cv::Rect& rect, int& trunk, int& branch, int& leaf) const;
+
+	/** class of a pixel of the rendered color image: the dominant channel, or background if white */
+	static int classifyPixel(int blue, int green, int red) {
+		if (blue > 240 && green > 240 && red > 240) return PATCH_BACKGROUND;
+		else if (red > green && red > blue) return PATCH_TRUNK;
+		else if (green > red && green > blue) return PATCH_BRANCH;
+		else if (blue > green && blue > red) return PATCH_LEAF;
+		else return PATCH_BACKGROUND;
+	}
+
+	static int decide(int trunk, int branch, int leaf, int area);
+	static void classifyPixels(const cv::Mat& image, cv::Mat& classes);
+	static void classifyPixelsScalar(const cv::Mat& image, cv::Mat& classes);
+	static bool verify();
+
+private:
+	void buildSums();
+	static void classifyRowsBGRA(const cv::Mat& image, cv::Mat& classes);
+	static int classifyRowSIMD(const unsigned char* src, unsigned char* dst, int count);
+};
@@ -0,0 +1,114 @@
+#include "PatchDeduplicator.h"
+#include <iostream>
+#include <opencv2/imgproc/imgproc.hpp>
+
+PatchDeduplicator::PatchDeduplicator() {
+	threshold = -1;
+}
+
+/**
+ * Clear the index for a new range of the trees.
+ *
+ * @param numTypes		number of the types of the patches
+ */
+void PatchDeduplicator::begin(int numTypes) {
+	types.assign(numTypes, TypeIndex());
+	checked.assign(numTypes, 0);
+	rejected.assign(numTypes, 0);
+}
+
+/**
+ * Add the hash of the patch to the index unless a stored patch of the same type is within the
+ * threshold.
+ *
+ * @param type		type of the patch
+ * @param hash		hash of the patch (computeHash())
+ * @return			false if the patch is a duplicate
+ */
+bool PatchDeduplicator::add(int type, unsigned long long hash) {
+	TypeIndex& index = types[type];
+	checked[type]++;
+
+	for (int b = 0; b < NUM_BANDS; ++b) {
+		auto it = index.bands[b].find((unsigned int)(hash >> (b * 16)) & 0xffff);
+		if (it == index.bands[b].end()) continue;
+
+		const std::vector<int>& candidates = it->second;
+		for (int i = 0; i < candidates.size(); ++i) {
+			if (hammingDistance(index.hashes[candidates[i]], hash) <= threshold) {
+				rejected[type]++;
+				return false;
+			}
+		}
+	}
+
+	int id = (int)index.hashes.size();
+	index.hashes.push_back(hash);
+	for (int b = 0; b < NUM_BANDS; ++b) {
+		index.bands[b][(unsigned int)(hash >> (b * 16)) & 0xffff].push_back(id);
+	}
+
+	return true;
+}
+
+/**
+ * Print the number of the duplicates of each type.
+ */
+void PatchDeduplicator::printSummary() const {
+	for (int type = 0; type < checked.size(); ++type) {
+		std::cout << "Type " << type << ": " << rejected[type] << " of " << checked[type] << " patches rejected as duplicates" << std::endl;
+	}
+}
+
+/**
+ * Return the settings that the stored patches depend on.
+ */
+QString PatchDeduplicator::parameterString() const {
+	return enabled() ? QString("dedup=%1").arg(threshold) : QString("dedup=off");
+}
+
+/**
+ * Compute the average hash of the patch: bit (r * 8 + c) is set if the block (r, c) of the 8x8
+ * blocks is brighter than the mean of the blocks.
+ *
+ * @param patch		line patch (BGRA or BGR)
+ * @return			hash
+ */
+unsigned long long PatchDeduplicator::computeHash(const cv::Mat& patch) {
+	cv::Mat blocks;
+	cv::resize(patch, blocks, cv::Size(8, 8), 0, 0, cv::INTER_AREA);
+
+	int channels = (std::min)(blocks.channels(), 3);
+	int values[64];
+	int sum = 0;
+	for (int r = 0; r < 8; ++r) {
+		const unsigned char* pixel = blocks.ptr<unsigned char>(r);
+		for (int c = 0; c < 8; ++c, pixel += blocks.channels()) {
+			int value = 0;
+			for (int k = 0; k < channels; ++k) {
+				value += pixel[k];
+			}
+			values[r * 8 + c] = value;
+			sum += value;
+		}
+	}
+
+	// compare with the mean without rounding (value > sum / 64)
+	unsigned long long hash = 0;
+	for (int i = 0; i < 64; ++i) {
+		if (values[i] * 64 > sum) hash |= 1ULL << i;
+	}
+
+	return hash;
+}
+
+/**
+ * Return the number of the bits that differ.
+ */
+int PatchDeduplicator::hammingDistance(unsigned long long a, unsigned long long b) {
+	unsigned long long x = a ^ b;
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (int)((x * 0x0101010101010101ULL) >> 56);
+}
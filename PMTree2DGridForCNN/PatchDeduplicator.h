@@ -0,0 +1,44 @@
+#pragma once
+
+#include <QString>
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <unordered_map>
+
+/**
+ * Filter of the near-duplicate patches.
+ * Each line patch is reduced to a 64-bit average hash (8x8 block means compared with their
+ * mean), and a patch is rejected if a stored patch of the same type is within the Hamming
+ * distance threshold. The hashes of each type are indexed by four bands of 16 bits. Two hashes
+ * within the distance 3 share at least one band, so the search is exact up to threshold 3, and
+ * misses some of the candidates beyond it. The index is per range of the trees, so that the
+ * ranges stay independent of each other.
+ */
+class PatchDeduplicator {
+public:
+	static const int NUM_BANDS = 4;
+
+	int threshold;		// maximum Hamming distance of the duplicates (-1 -- disabled)
+
+private:
+	class TypeIndex {
+	public:
+		std::vector<unsigned long long> hashes;
+		std::unordered_map<unsigned int, std::vector<int> > bands[NUM_BANDS];	// band value -> indices of the hashes
+	};
+
+	std::vector<TypeIndex> types;
+	std::vector<int> checked;
+	std::vector<int> rejected;
+
+public:
+	PatchDeduplicator();
+
+	bool enabled() const { return threshold >= 0; }
+	void begin(int numTypes);
+	bool add(int type, unsigned long long hash);
+	void printSummary() const;
+	QString parameterString() const;
+	static unsigned long long computeHash(const cv::Mat& patch);
+	static int hammingDistance(unsigned long long a, unsigned long long b);
+};
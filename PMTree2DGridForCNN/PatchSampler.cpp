@@ -0,0 +1,128 @@
+#include "PatchSampler.h"
+#include <QStringList>
+#include <iostream>
+#include <algorithm>
+
+namespace {
+	// splitmix64 finalizer
+	unsigned long long mix(unsigned long long h) {
+		h += 0x9E3779B97F4A7C15ULL;
+		h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+		return h ^ (h >> 31);
+	}
+}
+
+PatchSampler::PatchSampler() {
+	spanFirst = 0;
+	spanTrees = 0;
+	seed = 0;
+}
+
+/**
+ * Start the range of the trees [first, end).
+ *
+ * @param numTypes		number of the types of the patches
+ * @param seed			seed of the coins
+ * @param first			index of the first tree of the range
+ * @param end			index of the tree after the last one
+ */
+void PatchSampler::begin(int numTypes, unsigned int seed, int first, int end) {
+	this->seed = seed;
+	target.assign(numTypes, -1);
+	accepted.assign(numTypes, 0);
+	overQuota.assign(numTypes, 0);
+	dropped.assign(numTypes, 0);
+
+	// the share of the range, which sums up to the quota over the ranges of the span
+	for (int type = 0; type < numTypes && type < quota.size(); ++type) {
+		if (quota[type] < 0 || spanTrees <= 0) continue;
+		long long lo = (long long)quota[type] * (std::min)(spanTrees, (std::max)(0, first - spanFirst)) / spanTrees;
+		long long hi = (long long)quota[type] * (std::max)(0, (std::min)(spanTrees, end - spanFirst)) / spanTrees;
+		target[type] = (int)(hi - lo);
+	}
+}
+
+/**
+ * Decide whether the patch may be stored. The patch counts toward the quota when store() is
+ * called for it, since the later stages (deduplication) may still reject it.
+ *
+ * @param type		type of the patch
+ * @param tree		index of the tree
+ * @param x			position of the patch in the image of the tree
+ * @param y			position of the patch in the image of the tree
+ * @return			true if the patch may be stored
+ */
+bool PatchSampler::accept(int type, int tree, int x, int y) {
+	if (target[type] >= 0 && accepted[type] >= target[type]) {
+		overQuota[type]++;
+		return false;
+	}
+	if (type < acceptance.size() && acceptance[type] < 1.0f && random(seed, tree, x, y) >= acceptance[type]) {
+		dropped[type]++;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Count the stored patch toward the quota of its type.
+ */
+void PatchSampler::store(int type) {
+	accepted[type]++;
+}
+
+/**
+ * Return true if all the types have a quota and all the quotas are filled, so that the rest of
+ * the range would store no patch.
+ */
+bool PatchSampler::filled() const {
+	for (int type = 0; type < target.size(); ++type) {
+		if (target[type] < 0 || accepted[type] < target[type]) return false;
+	}
+	return !target.empty();
+}
+
+/**
+ * Print the number of the patches of each type that have been stored and dropped.
+ */
+void PatchSampler::printSummary() const {
+	for (int type = 0; type < accepted.size(); ++type) {
+		std::cout << "Type " << type << ": " << accepted[type] << " stored";
+		if (target[type] >= 0) std::cout << " (quota " << target[type] << ")";
+		std::cout << ", " << overQuota[type] << " over quota, " << dropped[type] << " dropped by probability" << std::endl;
+	}
+}
+
+/**
+ * Return the settings that the selected patches depend on.
+ */
+QString PatchSampler::parameterString() const {
+	// the span matters only if there is a quota
+	QStringList quotas;
+	bool limited = false;
+	for (int i = 0; i < quota.size(); ++i) {
+		quotas.push_back(QString::number(quota[i]));
+		if (quota[i] >= 0) limited = true;
+	}
+	QStringList probabilities;
+	for (int i = 0; i < acceptance.size(); ++i) {
+		probabilities.push_back(QString::number(acceptance[i]));
+	}
+
+	QString str = QString("quota=%1 accept=%2").arg(quotas.join(",")).arg(probabilities.join(","));
+	if (limited) str += QString(" span=%1,%2").arg(spanFirst).arg(spanTrees);
+	return str;
+}
+
+/**
+ * Return a uniform random number in [0, 1) from the seed, the tree and the position of the patch.
+ */
+float PatchSampler::random(unsigned int seed, int tree, int x, int y) {
+	unsigned long long h = mix(seed);
+	h = mix(h ^ (unsigned int)tree);
+	h = mix(h ^ (((unsigned long long)(unsigned int)x << 32) | (unsigned int)y));
+
+	return (float)(h >> 40) / (float)(1 << 24);
+}
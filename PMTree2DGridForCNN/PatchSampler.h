@@ -0,0 +1,39 @@
+#pragma once
+
+#include <QString>
+#include <vector>
+
+/**
+ * Selector of the patches to store, which balances the types of the patches.
+ * Each type has a target number of the patches (quota) and a probability to keep a patch. A
+ * patch is decided right after the classification, so that the dropped patches are never copied
+ * or encoded. The quota of the whole run is divided among the ranges of the trees in proportion
+ * to the number of the trees, and the coin of each patch is a hash of the seed, the tree and the
+ * position of the patch, so the same patches are selected regardless of the processes that
+ * generate the ranges.
+ */
+class PatchSampler {
+public:
+	std::vector<int> quota;			// number of the patches of each type in the whole run (-1 -- no limit)
+	std::vector<float> acceptance;	// probability to keep a patch of each type (1 if not given)
+	int spanFirst;					// trees that the quota is divided among
+	int spanTrees;
+
+private:
+	unsigned int seed;
+	std::vector<int> target;		// quota of the current range
+	std::vector<int> accepted;
+	std::vector<int> overQuota;
+	std::vector<int> dropped;
+
+public:
+	PatchSampler();
+
+	void begin(int numTypes, unsigned int seed, int first, int end);
+	bool accept(int type, int tree, int x, int y);
+	void store(int type);
+	bool filled() const;
+	void printSummary() const;
+	QString parameterString() const;
+	static float random(unsigned int seed, int tree, int x, int y);
+};
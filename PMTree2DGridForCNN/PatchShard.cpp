@@ -0,0 +1,256 @@
+#include "PatchShard.h"
+#include <QDir>
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <opencv2/highgui/highgui.hpp>
+
+// the index is mapped as an array of the records, so the layout must not depend on the compiler
+static_assert(sizeof(ShardRecord) == 32, "ShardRecord must be 32 bytes");
+
+ShardWriter::ShardWriter() {
+	shardSize = 0;
+	shardIndex = 0;
+	dataSize = 0;
+}
+
+ShardWriter::~ShardWriter() {
+	close();
+}
+
+/**
+ * Start writing the shards into the directory.
+ *
+ * @param dir			output directory (with the trailing separator)
+ * @param shardSize		maximum size of the data file of a shard in bytes
+ * @return				true if the first shard has been created
+ */
+bool ShardWriter::open(const QString& dir, unsigned long long shardSize) {
+	close();
+
+	this->dir = dir;
+	this->shardSize = shardSize;
+	shardIndex = 0;
+	QDir().mkpath(dir);
+	return openShard();
+}
+
+/**
+ * Append the payload of a patch to the current shard, and its record to the index.
+ *
+ * @param record		record of the patch, whose offset is filled here
+ * @param payload		record.length bytes
+ * @return				true if written
+ */
+bool ShardWriter::append(ShardRecord& record, const unsigned char* payload) {
+	if (!dataFile.isOpen()) return false;
+
+	if (dataSize > 0 && dataSize + record.length > shardSize) {
+		shardIndex++;
+		if (!openShard()) return false;
+	}
+
+	record.offset = dataSize;
+	if (dataFile.write((const char*)payload, record.length) != record.length) return false;
+	if (indexFile.write((const char*)&record, sizeof(ShardRecord)) != sizeof(ShardRecord)) return false;
+	dataSize += record.length;
+
+	return true;
+}
+
+/**
+ * Close the current shard.
+ */
+void ShardWriter::close() {
+	dataFile.close();
+	indexFile.close();
+}
+
+/**
+ * Return the base name of the shard (without .pak / .idx).
+ */
+QString ShardWriter::shardName(const QString& dir, int index) {
+	return dir + QString("shard_%1").arg(index, 5, 10, QChar('0'));
+}
+
+bool ShardWriter::openShard() {
+	close();
+
+	QString name = shardName(dir, shardIndex);
+	dataFile.setFileName(name + ".pak");
+	indexFile.setFileName(name + ".idx");
+	if (!dataFile.open(QIODevice::WriteOnly | QIODevice::Truncate) || !indexFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		std::cout << "Error: could not create the shard " << name.toUtf8().constData() << std::endl;
+		close();
+		return false;
+	}
+
+	int version = VERSION;
+	indexFile.write("PMTS", 4);
+	indexFile.write((const char*)&version, sizeof(int));
+	dataSize = 0;
+
+	return true;
+}
+
+ShardReader::ShardReader() {
+	data = NULL;
+	records = NULL;
+	numRecords = 0;
+	dataLength = 0;
+}
+
+ShardReader::~ShardReader() {
+	close();
+}
+
+/**
+ * Map the shard into memory.
+ * A record that is incomplete or points beyond the data file (interrupted writer) ends the shard.
+ *
+ * @param baseName		file name of the shard without .pak / .idx
+ * @return				true if the shard is valid
+ */
+bool ShardReader::open(const QString& baseName) {
+	close();
+
+	dataFile.setFileName(baseName + ".pak");
+	indexFile.setFileName(baseName + ".idx");
+	if (!dataFile.open(QIODevice::ReadOnly) || !indexFile.open(QIODevice::ReadOnly)) {
+		close();
+		return false;
+	}
+
+	qint64 indexLength = indexFile.size();
+	const unsigned char* index = indexLength > 0 ? indexFile.map(0, indexLength) : NULL;
+	int version = 0;
+	if (index == NULL || indexLength < 8 || strncmp((const char*)index, "PMTS", 4) != 0) {
+		close();
+		return false;
+	}
+	memcpy(&version, index + 4, sizeof(int));
+	if (version != ShardWriter::VERSION) {
+		close();
+		return false;
+	}
+	records = (const ShardRecord*)(index + 8);
+	numRecords = (int)((indexLength - 8) / sizeof(ShardRecord));
+
+	dataLength = dataFile.size();
+	data = dataLength > 0 ? dataFile.map(0, dataLength) : NULL;
+	while (numRecords > 0 && records[numRecords - 1].offset + records[numRecords - 1].length > (unsigned long long)dataLength) {
+		numRecords--;
+	}
+
+	return true;
+}
+
+void ShardReader::close() {
+	dataFile.close();
+	indexFile.close();
+	data = NULL;
+	records = NULL;
+	numRecords = 0;
+	dataLength = 0;
+}
+
+/**
+ * Return the payload of the patch.
+ */
+bool ShardReader::payload(int i, const unsigned char*& ptr, int& length) const {
+	if (i < 0 || i >= numRecords || (data == NULL && records[i].length > 0)) return false;
+
+	ptr = data + records[i].offset;
+	length = records[i].length;
+	return true;
+}
+
+/**
+ * Return the image of the patch. A raw image refers to the mapped file without copying, so it
+ * is valid while the shard is open.
+ */
+cv::Mat ShardReader::image(int i) const {
+	const unsigned char* ptr;
+	int length;
+	if (!payload(i, ptr, length)) return cv::Mat();
+
+	const ShardRecord& r = records[i];
+	if (r.encoding == ShardRecord::ENCODING_RAW) {
+		if (length != (int)r.width * r.height * r.channels) return cv::Mat();
+		return cv::Mat(r.height, r.width, CV_8UC(r.channels), (void*)ptr);
+	}
+	else {
+		return cv::imdecode(cv::Mat(1, length, CV_8U, (void*)ptr), cv::IMREAD_UNCHANGED);
+	}
+}
+
+/**
+ * Return the base names of the shards in the directory, in the order of writing.
+ */
+QStringList ShardReader::list(const QString& dir) {
+	QStringList names;
+	for (int i = 0; QFile::exists(ShardWriter::shardName(dir, i) + ".idx"); ++i) {
+		names.push_back(ShardWriter::shardName(dir, i));
+	}
+	return names;
+}
+
+/**
+ * Write the patches of the shards as one PNG file per patch in the directory of the type of
+ * the patch, which is the layout of the original dataset. The patches are numbered in the order
+ * of the shards, so the file names are the same as if they had been written as files directly.
+ *
+ * @param shardDirs			directories of the shards in the order of the patches
+ * @param baseResultDir		output directory
+ * @return					number of the patches written, or -1 on error
+ */
+int ShardReader::exportLegacy(const QStringList& shardDirs, const QString& baseResultDir) {
+	QStringList names;
+	for (int i = 0; i < shardDirs.size(); ++i) {
+		QStringList shards = list(shardDirs[i]);
+		if (shards.empty()) {
+			std::cout << "Error: no shards in " << shardDirs[i].toUtf8().constData() << std::endl;
+			return -1;
+		}
+		names += shards;
+	}
+
+	std::vector<int> count;
+	int total = 0;
+	for (int s = 0; s < names.size(); ++s) {
+		ShardReader reader;
+		if (!reader.open(names[s])) {
+			std::cout << "Error: invalid shard " << names[s].toUtf8().constData() << std::endl;
+			return -1;
+		}
+
+		for (int i = 0; i < reader.size(); ++i) {
+			const ShardRecord& r = reader.record(i);
+			if (r.type >= count.size()) count.resize(r.type + 1, 0);
+
+			QString resultDir = QString(baseResultDir + "pmtree2dgrid_%1/").arg(r.type, 2, 10, QChar('0'));
+			if (count[r.type] == 0) QDir().mkpath(resultDir);
+			QString filename = QDir::toNativeSeparators(resultDir + QString("image_%1.png").arg(count[r.type]++, 6, 10, QChar('0')));
+
+			// the PNG payloads are copied as they are
+			bool written;
+			if (r.encoding == ShardRecord::ENCODING_PNG) {
+				const unsigned char* ptr;
+				int length;
+				QFile file(filename);
+				written = reader.payload(i, ptr, length) && file.open(QIODevice::WriteOnly) && file.write((const char*)ptr, length) == length;
+			}
+			else {
+				cv::Mat patch = reader.image(i);
+				written = !patch.empty() && cv::imwrite(filename.toUtf8().constData(), patch);
+			}
+			if (!written) {
+				std::cout << "Error: could not write " << filename.toUtf8().constData() << std::endl;
+				return -1;
+			}
+			total++;
+		}
+	}
+
+	return total;
+}
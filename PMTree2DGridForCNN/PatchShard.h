@@ -0,0 +1,85 @@
+#pragma once
+
+#include <QString>
+#include <QFile>
+#include <QStringList>
+#include <opencv2/opencv.hpp>
+
+/**
+ * Entry of the index of a shard (32 bytes, little-endian as written by the host).
+ */
+struct ShardRecord {
+	enum { ENCODING_RAW = 0, ENCODING_PNG };
+
+	unsigned long long offset;	// offset of the payload in the data file
+	unsigned int length;		// length of the payload in bytes
+	int tree;					// index of the tree
+	unsigned short x;			// position of the patch in the image of the tree
+	unsigned short y;
+	unsigned short width;
+	unsigned short height;
+	unsigned char type;			// PatchClassifier::PATCH_XXX
+	unsigned char encoding;		// ENCODING_XXX
+	unsigned char channels;
+	unsigned char reserved;
+	unsigned int reserved2;
+};
+
+/**
+ * Writer of the shards of the patches.
+ * A shard is a pair of append-only files: shard_NNNNN.pak has the payloads one after another,
+ * and shard_NNNNN.idx has the header "PMTS" + version followed by one ShardRecord per patch.
+ * A new shard is started when the data file would exceed shardSize. Since the index is written
+ * after the payload, an interrupted shard is still readable up to its last complete record.
+ */
+class ShardWriter {
+public:
+	static const int VERSION = 1;
+
+private:
+	QString dir;
+	unsigned long long shardSize;
+	int shardIndex;
+	QFile dataFile;
+	QFile indexFile;
+	unsigned long long dataSize;
+
+public:
+	ShardWriter();
+	~ShardWriter();
+
+	bool open(const QString& dir, unsigned long long shardSize);
+	bool append(ShardRecord& record, const unsigned char* payload);
+	void close();
+	static QString shardName(const QString& dir, int index);
+
+private:
+	bool openShard();
+};
+
+/**
+ * Reader of a shard, which maps both files into memory for random access to the patches.
+ */
+class ShardReader {
+private:
+	QFile dataFile;
+	QFile indexFile;
+	const unsigned char* data;
+	const ShardRecord* records;
+	int numRecords;
+	qint64 dataLength;
+
+public:
+	ShardReader();
+	~ShardReader();
+
+	bool open(const QString& baseName);
+	void close();
+	int size() const { return numRecords; }
+	const ShardRecord& record(int i) const { return records[i]; }
+	cv::Mat image(int i) const;
+	bool payload(int i, const unsigned char*& ptr, int& length) const;
+
+	static QStringList list(const QString& dir);
+	static int exportLegacy(const QStringList& shardDirs, const QString& baseResultDir);
+};
@@ -0,0 +1,250 @@
+#include "PatchWriter.h"
+#include <QDir>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <opencv2/highgui/highgui.hpp>
+
+PatchWriter::PatchWriter() {
+	numThreads = 0;
+	maxQueued = 4096;
+	batchSize = 16;
+	format = FORMAT_FILES;
+	compress = true;
+	shardSize = 256ULL << 20;
+	nextSequence = 0;
+	busy = 0;
+	failures = 0;
+	stopping = false;
+	nextCommit = 0;
+}
+
+PatchWriter::~PatchWriter() {
+	close();
+}
+
+/**
+ * Create the directories of all the types (or the first shard), and start the workers.
+ *
+ * @param baseResultDir		output directory
+ * @param numTypes			number of the types of the patches
+ * @return					true if the output has been created
+ */
+bool PatchWriter::open(const QString& baseResultDir, int numTypes) {
+	close();
+
+	this->baseResultDir = baseResultDir;
+	typeDirs.clear();
+	count.assign(numTypes, 0);
+	nextSequence = 0;
+	nextCommit = 0;
+	encoded.clear();
+	failures = 0;
+	stopping = false;
+
+	if (format == FORMAT_SHARDS) {
+		if (!shardWriter.open(baseResultDir, shardSize)) return false;
+	}
+	else {
+		typeDirs.resize(numTypes);
+		for (int type = 0; type < numTypes; ++type) {
+			QString dir = QString(baseResultDir + "pmtree2dgrid_%1/").arg(type, 2, 10, QChar('0'));
+			QDir().mkpath(dir);
+			typeDirs[type] = QDir::toNativeSeparators(dir);
+		}
+	}
+
+	int n = numThreads > 0 ? numThreads : (int)std::thread::hardware_concurrency();
+	n = (std::max)(1, n);
+	for (int i = 0; i < n; ++i) {
+		workers.push_back(std::thread(&PatchWriter::work, this));
+	}
+
+	return true;
+}
+
+/**
+ * Reserve the next index of the type for the patch, and add a copy of the patch to the batch.
+ * The batch is submitted when it is full.
+ *
+ * @param type		type of the patch
+ * @param tree		index of the tree
+ * @param x			position of the patch in the image of the tree
+ * @param y			position of the patch in the image of the tree
+ * @param patch		image of the patch
+ */
+void PatchWriter::add(int type, int tree, int x, int y, const cv::Mat& patch) {
+	batch.push_back(PatchJob());
+	PatchJob& job = batch.back();
+	job.sequence = nextSequence++;
+	job.type = type;
+	job.index = count[type]++;
+	job.tree = tree;
+	job.x = x;
+	job.y = y;
+	job.image = patch.clone();
+	if ((int)batch.size() >= batchSize) flush();
+}
+
+/**
+ * Submit the batch to the workers. This waits while the queue is full.
+ */
+void PatchWriter::flush() {
+	if (batch.empty()) return;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	queueChanged.wait(lock, [this]() { return (int)queue.size() < maxQueued; });
+	for (size_t i = 0; i < batch.size(); ++i) {
+		queue.push_back(PatchJob());
+		std::swap(queue.back(), batch[i]);
+	}
+	batch.clear();
+	lock.unlock();
+	queueChanged.notify_all();
+}
+
+/**
+ * Wait until all the patches have been written.
+ *
+ * @return		true if all the patches so far have been written
+ */
+bool PatchWriter::finish() {
+	flush();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	queueChanged.wait(lock, [this]() { return queue.empty() && busy == 0; });
+	if (failures > 0) {
+		std::cout << "Error: " << failures << " patches could not be written" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Write the remaining patches, and stop the workers.
+ *
+ * @return		true if all the patches have been written
+ */
+bool PatchWriter::close() {
+	if (workers.empty()) return true;
+
+	bool written = finish();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	queueChanged.notify_all();
+	for (size_t i = 0; i < workers.size(); ++i) {
+		workers[i].join();
+	}
+	workers.clear();
+	shardWriter.close();
+
+	return written;
+}
+
+/**
+ * Worker thread, which takes up to batchSize patches from the queue at once and encodes them.
+ */
+void PatchWriter::work() {
+	std::vector<PatchJob> jobs;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			queueChanged.wait(lock, [this]() { return stopping || !queue.empty(); });
+			if (queue.empty()) return;
+
+			int n = (std::min)((int)queue.size(), batchSize);
+			jobs.resize(n);
+			for (int i = 0; i < n; ++i) {
+				std::swap(jobs[i], queue.front());
+				queue.pop_front();
+			}
+			busy++;
+		}
+		queueChanged.notify_all();
+
+		int failed = 0;
+		for (size_t i = 0; i < jobs.size(); ++i) {
+			if (!encode(jobs[i])) failed++;
+		}
+		if (format == FORMAT_SHARDS) {
+			failed += commit(jobs);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busy--;
+			failures += failed;
+		}
+		queueChanged.notify_all();
+	}
+}
+
+/**
+ * Write the PNG file of the patch, or encode the payload of the shard.
+ *
+ * @return		false if failed
+ */
+bool PatchWriter::encode(PatchJob& job) {
+	if (format == FORMAT_FILES) {
+		bool written = cv::imwrite(filename(job).toUtf8().constData(), job.image);
+		job.image.release();
+		return written;
+	}
+
+	if (compress) {
+		if (cv::imencode(".png", job.image, job.payload)) return true;
+		job.payload.clear();
+		return false;
+	}
+	else {
+		cv::Mat image = job.image.isContinuous() ? job.image : job.image.clone();
+		job.payload.assign(image.data, image.data + image.total() * image.elemSize());
+		return true;
+	}
+}
+
+/**
+ * Append the encoded patches to the shards as soon as all the preceding patches have been
+ * appended. The patches that arrive early wait in the map.
+ *
+ * @param jobs		encoded patches
+ * @return			number of the patches that could not be written
+ */
+int PatchWriter::commit(std::vector<PatchJob>& jobs) {
+	std::lock_guard<std::mutex> lock(commitMutex);
+
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		std::swap(encoded[jobs[i].sequence], jobs[i]);
+	}
+
+	int failed = 0;
+	for (auto it = encoded.begin(); it != encoded.end() && it->first == nextCommit; it = encoded.erase(it), ++nextCommit) {
+		PatchJob& job = it->second;
+		if (job.payload.empty()) continue;	// counted as a failure by the encoder
+
+		ShardRecord record;
+		memset(&record, 0, sizeof(ShardRecord));
+		record.length = (unsigned int)job.payload.size();
+		record.tree = job.tree;
+		record.x = job.x;
+		record.y = job.y;
+		record.width = job.image.cols;
+		record.height = job.image.rows;
+		record.type = job.type;
+		record.encoding = compress ? ShardRecord::ENCODING_PNG : ShardRecord::ENCODING_RAW;
+		record.channels = job.image.channels();
+		if (!shardWriter.append(record, job.payload.data())) failed++;
+	}
+
+	return failed;
+}
+
+/**
+ * Return the file name of the patch.
+ */
+QString PatchWriter::filename(const PatchJob& job) const {
+	return typeDirs[job.type] + QString("image_%1.png").arg(job.index, 6, 10, QChar('0'));
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <QString>
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "PatchShard.h"
+
+/**
+ * One patch waiting to be encoded.
+ */
+class PatchJob {
+public:
+	int sequence;		// order of the patch in the output
+	int type;
+	int index;			// index of the patch in the directory of the type
+	int tree;
+	int x, y;			// position of the patch in the image of the tree
+	cv::Mat image;		// own copy, since the rendered image is reused for the next tree
+	std::vector<unsigned char> payload;	// encoded image for the shards
+
+public:
+	PatchJob() : sequence(0), type(0), index(0), tree(0), x(0), y(0) {}
+};
+
+/**
+ * Output stage of the patches, which encodes them on a pool of worker threads while the next
+ * tree is being rendered.
+ * The index of each patch is reserved by add() on the calling thread in the order of the
+ * patches, so the output does not depend on the timing of the threads. The patches are
+ * submitted in batches, and the queue is bounded by maxQueued patches, so the producer waits
+ * if the encoders fall behind instead of holding all the patches in memory.
+ *
+ * With FORMAT_FILES, each patch is a PNG file in the directory of its type. With FORMAT_SHARDS,
+ * the encoded patches are appended to the shards in the order of add(), so that the shards are
+ * the same for any number of threads (see ShardWriter).
+ */
+class PatchWriter {
+public:
+	enum { FORMAT_FILES = 0, FORMAT_SHARDS };
+
+	int numThreads;		// 0 -- number of cores
+	int maxQueued;		// maximum number of the patches in the queue
+	int batchSize;		// number of the patches that a worker takes at once
+	int format;			// FORMAT_XXX
+	bool compress;		// PNG payloads in the shards (raw pixels otherwise)
+	unsigned long long shardSize;	// maximum size of a shard in bytes
+
+private:
+	QString baseResultDir;
+	std::vector<QString> typeDirs;	// directory of each type (native separators, with the trailing separator)
+	std::vector<int> count;			// next index of each type
+	int nextSequence;
+
+	std::vector<PatchJob> batch;	// patches not submitted yet
+	std::deque<PatchJob> queue;
+	int busy;						// number of the workers encoding
+	int failures;
+	bool stopping;
+	std::mutex mutex;
+	std::condition_variable queueChanged;
+	std::vector<std::thread> workers;
+
+	// encoded patches waiting for the preceding ones before they are appended to the shards
+	ShardWriter shardWriter;
+	std::map<int, PatchJob> encoded;
+	int nextCommit;
+	std::mutex commitMutex;
+
+public:
+	PatchWriter();
+	~PatchWriter();
+
+	bool open(const QString& baseResultDir, int numTypes);
+	void add(int type, int tree, int x, int y, const cv::Mat& patch);
+	void flush();
+	bool finish();
+	bool close();
+	const std::vector<int>& counts() const { return count; }
+
+private:
+	void work();
+	bool encode(PatchJob& job);
+	int commit(std::vector<PatchJob>& jobs);
+	QString filename(const PatchJob& job) const;
+};
@@ -0,0 +1,145 @@
+#include "PixelReadback.h"
+#include <stdexcept>
+
+PixelReadback::PixelReadback() {
+	width = 0;
+	height = 0;
+	writeIndex = 0;
+	numQueued = 0;
+	numMapped = 0;
+}
+
+PixelReadback::~PixelReadback() {
+	clear();
+}
+
+/**
+ * Allocate the pixel buffer objects.
+ * The buffers are reallocated only when the number or the size of the images changes.
+ *
+ * @param numBuffers	number of images that can be in flight
+ * @param width			width of the images
+ * @param height		height of the images
+ */
+void PixelReadback::init(int numBuffers, int width, int height) {
+	if (numBuffers == (int)buffers.size() && width == this->width && height == this->height && numQueued == 0 && numMapped == 0) return;
+
+	clear();
+	this->width = width;
+	this->height = height;
+
+	buffers.resize(numBuffers);
+	for (int i = 0; i < numBuffers; ++i) {
+		glGenBuffers(1, &buffers[i].pbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[i].pbo);
+		glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 4, NULL, GL_STREAM_READ);
+		buffers[i].fence = 0;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+/**
+ * Start copying the color buffer of the framebuffer into the next pixel buffer object.
+ * This call does not wait for the GPU.
+ *
+ * @param framebuffer	framebuffer to read (0 for the default framebuffer)
+ * @param attachment	index of the color attachment (ignored for the default framebuffer)
+ */
+void PixelReadback::read(GLuint framebuffer, int attachment) {
+	if (numQueued + numMapped >= (int)buffers.size()) {
+		throw std::runtime_error("PixelReadback: all the buffers are in use");
+	}
+
+	Buffer& buffer = buffers[writeIndex];
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	if (framebuffer != 0) {
+		glReadBuffer(GL_COLOR_ATTACHMENT0 + attachment);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer.pbo);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, width, height, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if (framebuffer != 0) {
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+	}
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+	buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	writeIndex = (writeIndex + 1) % (int)buffers.size();
+	numQueued++;
+}
+
+/**
+ * Wait until the oldest read has finished, and map its buffer.
+ *
+ * @return		BGRA image in the order of the rows in the framebuffer (bottom-up unless
+ *				the image has been rendered with RenderManager::flipY)
+ */
+cv::Mat PixelReadback::acquire() {
+	if (numQueued == 0) {
+		throw std::runtime_error("PixelReadback: nothing to acquire");
+	}
+
+	Buffer& buffer = buffers[bufferIndex(numQueued)];
+
+	// the first wait flushes the commands so that the fence is signaled eventually
+	GLenum status = glClientWaitSync(buffer.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ULL);
+	while (status == GL_TIMEOUT_EXPIRED) {
+		status = glClientWaitSync(buffer.fence, 0, 1000000000ULL);
+	}
+	glDeleteSync(buffer.fence);
+	buffer.fence = 0;
+	if (status == GL_WAIT_FAILED) {
+		throw std::runtime_error("PixelReadback: glClientWaitSync failed");
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer.pbo);
+	void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, width * height * 4, GL_MAP_READ_BIT);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if (data == NULL) {
+		throw std::runtime_error("PixelReadback: glMapBufferRange failed");
+	}
+
+	numQueued--;
+	numMapped++;
+
+	return cv::Mat(height, width, CV_8UC4, data, width * 4);
+}
+
+/**
+ * Unmap the oldest acquired buffer so that read() can use it again.
+ * The image returned by acquire() must not be used after this call.
+ */
+void PixelReadback::release() {
+	if (numMapped == 0) return;
+
+	Buffer& buffer = buffers[bufferIndex(numQueued + numMapped)];
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer.pbo);
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	numMapped--;
+}
+
+void PixelReadback::clear() {
+	while (numMapped > 0) release();
+
+	for (int i = 0; i < buffers.size(); ++i) {
+		if (buffers[i].fence != 0) glDeleteSync(buffers[i].fence);
+		glDeleteBuffers(1, &buffers[i].pbo);
+	}
+	buffers.clear();
+	writeIndex = 0;
+	numQueued = 0;
+	numMapped = 0;
+}
+
+/**
+ * Index of the buffer that was written "offset" reads ago.
+ */
+int PixelReadback::bufferIndex(int offset) const {
+	int n = (int)buffers.size();
+	return (writeIndex - offset + n * 2) % n;
+}
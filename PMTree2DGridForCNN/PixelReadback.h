@@ -0,0 +1,41 @@
+#pragma once
+
+#include "glew.h"
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+/**
+ * Asynchronous readback of the rendered images through a ring of pixel buffer objects.
+ * read() only issues glReadPixels into the next buffer, and acquire() maps the oldest one
+ * after its fence has been signaled, so the GPU can render the next image while the CPU
+ * processes the previous one. The returned cv::Mat is a view of the mapped memory (BGRA)
+ * and is valid until the matching release().
+ */
+class PixelReadback {
+private:
+	struct Buffer {
+		GLuint pbo;
+		GLsync fence;
+	};
+
+	std::vector<Buffer> buffers;
+	int width;
+	int height;
+	int writeIndex;		// next buffer that read() uses
+	int numQueued;		// read, but not acquired yet
+	int numMapped;		// acquired, but not released yet
+
+public:
+	PixelReadback();
+	~PixelReadback();
+
+	void init(int numBuffers, int width, int height);
+	void read(GLuint framebuffer, int attachment = 0);
+	int pending() const { return numQueued; }
+	cv::Mat acquire();
+	void release();
+
+private:
+	void clear();
+	int bufferIndex(int offset) const;
+};
@@ -0,0 +1,284 @@
+#include "Profiler.h"
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <QFile>
+#include <QTextStream>
+
+ProfileStats::ProfileStats(int window) {
+	this->window = window;
+	count = 0;
+	total = 0.0;
+	last = 0.0;
+	minValue = 0.0;
+	maxValue = 0.0;
+}
+
+void ProfileStats::add(double ms) {
+	if (count == 0) {
+		minValue = ms;
+		maxValue = ms;
+	}
+	else {
+		minValue = (std::min)(minValue, ms);
+		maxValue = (std::max)(maxValue, ms);
+	}
+	count++;
+	total += ms;
+	last = ms;
+
+	recent.push_back(ms);
+	if (recent.size() > window) recent.pop_front();
+}
+
+double ProfileStats::mean() const {
+	if (count == 0) return 0.0;
+	return total / count;
+}
+
+double ProfileStats::rollingMean() const {
+	if (recent.empty()) return 0.0;
+
+	double sum = 0.0;
+	for (int i = 0; i < recent.size(); ++i) {
+		sum += recent[i];
+	}
+	return sum / recent.size();
+}
+
+double ProfileStats::rollingMax() const {
+	double ret = 0.0;
+	for (int i = 0; i < recent.size(); ++i) {
+		ret = (std::max)(ret, recent[i]);
+	}
+	return ret;
+}
+
+GPUTimer::GPUTimer() {
+	for (int i = 0; i < NUM_QUERY_BUFFERS; ++i) {
+		queries[i] = 0;
+		pending[i] = false;
+		frames[i] = 0;
+	}
+}
+
+Profiler::Profiler() {
+	enabled = true;
+	frame = 0;
+	droppedQueries = 0;
+}
+
+Profiler::~Profiler() {
+	for (auto it = gpuTimers.begin(); it != gpuTimers.end(); ++it) {
+		if (it->second.queries[0] != 0) {
+			glDeleteQueries(GPUTimer::NUM_QUERY_BUFFERS, it->second.queries);
+		}
+	}
+}
+
+/**
+ * Start a new frame.
+ * The queries of the slot that is going to be reused in this frame were issued
+ * NUM_QUERY_BUFFERS frames ago, so their results are read here without waiting.
+ */
+void Profiler::beginFrame() {
+	if (!enabled) return;
+
+	frame++;
+	int slot = frame % GPUTimer::NUM_QUERY_BUFFERS;
+	for (auto it = gpuTimers.begin(); it != gpuTimers.end(); ++it) {
+		collect(it->first, it->second, slot, false);
+	}
+}
+
+/**
+ * Start the GL_TIME_ELAPSED query of the specified pass.
+ * GL does not allow nested time queries, so the passes have to be measured one after another.
+ *
+ * @param name		pass name
+ */
+void Profiler::beginGPU(const std::string& name) {
+	if (!enabled) return;
+
+	if (!activeGPUTimer.empty()) {
+		std::cout << "Profiler: " << name << " started while " << activeGPUTimer << " is active" << std::endl;
+		endGPU();
+	}
+
+	GPUTimer& timer = gpuTimers[name];
+	if (timer.queries[0] == 0) {
+		glGenQueries(GPUTimer::NUM_QUERY_BUFFERS, timer.queries);
+	}
+
+	int slot = frame % GPUTimer::NUM_QUERY_BUFFERS;
+	if (timer.pending[slot]) {
+		collect(name, timer, slot, false);
+	}
+
+	glBeginQuery(GL_TIME_ELAPSED, timer.queries[slot]);
+	timer.pending[slot] = true;
+	timer.frames[slot] = frame;
+	activeGPUTimer = name;
+}
+
+void Profiler::endGPU() {
+	if (!enabled || activeGPUTimer.empty()) return;
+
+	glEndQuery(GL_TIME_ELAPSED);
+	activeGPUTimer.clear();
+}
+
+void Profiler::addCPUSample(const std::string& name, double ms) {
+	if (!enabled) return;
+
+	if (cpuStats.find(name) == cpuStats.end()) {
+		cpuStats.insert(std::make_pair(name, ProfileStats()));
+	}
+	cpuStats[name].add(ms);
+	trace.push_back(ProfileEvent(frame, false, name, ms));
+}
+
+/**
+ * Wait for all the outstanding GPU queries and add their results.
+ * Call this only at the end of a run, since it stalls until the GPU is idle.
+ */
+void Profiler::flush() {
+	endGPU();
+	for (auto it = gpuTimers.begin(); it != gpuTimers.end(); ++it) {
+		for (int slot = 0; slot < GPUTimer::NUM_QUERY_BUFFERS; ++slot) {
+			collect(it->first, it->second, slot, true);
+		}
+	}
+}
+
+void Profiler::clear() {
+	gpuStats.clear();
+	cpuStats.clear();
+	trace.clear();
+	droppedQueries = 0;
+}
+
+const ProfileStats& Profiler::getGPUStats(const std::string& name) {
+	if (gpuStats.find(name) == gpuStats.end()) {
+		gpuStats.insert(std::make_pair(name, ProfileStats()));
+	}
+	return gpuStats[name];
+}
+
+const ProfileStats& Profiler::getCPUStats(const std::string& name) {
+	if (cpuStats.find(name) == cpuStats.end()) {
+		cpuStats.insert(std::make_pair(name, ProfileStats()));
+	}
+	return cpuStats[name];
+}
+
+void Profiler::printSummary() {
+	std::cout << std::fixed << std::setprecision(3);
+	for (auto it = gpuStats.begin(); it != gpuStats.end(); ++it) {
+		std::cout << "GPU " << std::setw(12) << std::left << it->first << " mean: " << it->second.mean() << " ms, rolling: " << it->second.rollingMean() << " ms, max: " << it->second.maxValue << " ms (" << it->second.count << " samples)" << std::endl;
+	}
+	for (auto it = cpuStats.begin(); it != cpuStats.end(); ++it) {
+		std::cout << "CPU " << std::setw(12) << std::left << it->first << " mean: " << it->second.mean() << " ms, rolling: " << it->second.rollingMean() << " ms, max: " << it->second.maxValue << " ms (" << it->second.count << " samples)" << std::endl;
+	}
+	if (droppedQueries > 0) {
+		std::cout << "GPU queries dropped: " << droppedQueries << std::endl;
+	}
+	std::cout.unsetf(std::ios::fixed);
+	std::cout << std::right << std::setprecision(6);
+}
+
+/**
+ * Write the trace as "frame,type,name,ms" lines.
+ */
+bool Profiler::dumpCSV(const QString& filename) {
+	QFile file(filename);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+		std::cout << "Profiler: could not open " << filename.toUtf8().constData() << std::endl;
+		return false;
+	}
+
+	QTextStream out(&file);
+	out << "frame,type,name,ms\n";
+	for (int i = 0; i < trace.size(); ++i) {
+		out << trace[i].frame << "," << (trace[i].gpu ? "gpu" : "cpu") << "," << trace[i].name.c_str() << "," << trace[i].ms << "\n";
+	}
+
+	return true;
+}
+
+/**
+ * Write the summary statistics and the trace as a JSON file.
+ */
+bool Profiler::dumpJSON(const QString& filename) {
+	QFile file(filename);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+		std::cout << "Profiler: could not open " << filename.toUtf8().constData() << std::endl;
+		return false;
+	}
+
+	QTextStream out(&file);
+	out << "{\n";
+	out << "  \"frames\": " << frame << ",\n";
+	out << "  \"droppedQueries\": " << droppedQueries << ",\n";
+
+	for (int type = 0; type < 2; ++type) {
+		std::map<std::string, ProfileStats>& stats = type == 0 ? gpuStats : cpuStats;
+		out << (type == 0 ? "  \"gpu\": {" : "  \"cpu\": {");
+		for (auto it = stats.begin(); it != stats.end(); ++it) {
+			if (it != stats.begin()) out << ",";
+			out << "\n    \"" << it->first.c_str() << "\": { \"count\": " << it->second.count << ", \"mean\": " << it->second.mean() << ", \"min\": " << it->second.minValue << ", \"max\": " << it->second.maxValue << ", \"total\": " << it->second.total << " }";
+		}
+		out << "\n  },\n";
+	}
+
+	out << "  \"trace\": [";
+	for (int i = 0; i < trace.size(); ++i) {
+		if (i > 0) out << ",";
+		out << "\n    { \"frame\": " << trace[i].frame << ", \"type\": \"" << (trace[i].gpu ? "gpu" : "cpu") << "\", \"name\": \"" << trace[i].name.c_str() << "\", \"ms\": " << trace[i].ms << " }";
+	}
+	out << "\n  ]\n";
+	out << "}\n";
+
+	return true;
+}
+
+/**
+ * Read the result of the query in the specified slot.
+ *
+ * @param name		pass name
+ * @param timer		GPU timer of the pass
+ * @param slot		query slot
+ * @param wait		true -- block until the result is available / false -- drop the result if it is not available yet
+ */
+void Profiler::collect(const std::string& name, GPUTimer& timer, int slot, bool wait) {
+	if (!timer.pending[slot]) return;
+
+	GLint available = 0;
+	glGetQueryObjectiv(timer.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available && !wait) {
+		droppedQueries++;
+		timer.pending[slot] = false;
+		return;
+	}
+
+	GLuint64 elapsed = 0;
+	glGetQueryObjectui64v(timer.queries[slot], GL_QUERY_RESULT, &elapsed);
+	timer.pending[slot] = false;
+
+	double ms = elapsed * 1e-6;
+	if (gpuStats.find(name) == gpuStats.end()) {
+		gpuStats.insert(std::make_pair(name, ProfileStats()));
+	}
+	gpuStats[name].add(ms);
+	trace.push_back(ProfileEvent(timer.frames[slot], true, name, ms));
+}
+
+ScopedCPUTimer::ScopedCPUTimer(Profiler* profiler, const std::string& name) {
+	this->profiler = profiler;
+	this->name = name;
+	timer.start();
+}
+
+ScopedCPUTimer::~ScopedCPUTimer() {
+	profiler->addCPUSample(name, timer.nsecsElapsed() * 1e-6);
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "glew.h"
+#include <QElapsedTimer>
+#include <QString>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+
+/**
+ * Rolling statistics of one timer [ms].
+ */
+class ProfileStats {
+public:
+	int window;					// number of recent samples kept for the rolling values
+	std::deque<double> recent;
+	long long count;
+	double total;
+	double last;
+	double minValue;
+	double maxValue;
+
+public:
+	ProfileStats(int window = 120);
+	void add(double ms);
+	double mean() const;
+	double rollingMean() const;
+	double rollingMax() const;
+};
+
+/**
+ * One entry of the trace that is dumped at the end of a dataset run.
+ */
+class ProfileEvent {
+public:
+	long long frame;
+	bool gpu;
+	std::string name;
+	double ms;
+
+public:
+	ProfileEvent(long long frame, bool gpu, const std::string& name, double ms) : frame(frame), gpu(gpu), name(name), ms(ms) {}
+};
+
+/**
+ * GL_TIME_ELAPSED queries of one render pass.
+ * Each pass owns one query per frame slot, so that the result of frame N is read
+ * when the slot is reused at frame N + NUM_QUERY_BUFFERS, i.e., without stalling the pipeline.
+ */
+class GPUTimer {
+public:
+	enum { NUM_QUERY_BUFFERS = 2 };
+
+	GLuint queries[NUM_QUERY_BUFFERS];
+	bool pending[NUM_QUERY_BUFFERS];
+	long long frames[NUM_QUERY_BUFFERS];
+
+public:
+	GPUTimer();
+};
+
+/**
+ * Per-pass GPU timers and CPU timers of the render pipeline.
+ * The statistics are kept per timer name, and every sample is also recorded in the trace
+ * so that it can be written to a CSV/JSON file.
+ */
+class Profiler {
+public:
+	bool enabled;
+	long long frame;
+	int droppedQueries;			// GPU results that were not available when the slot was reused
+
+	std::map<std::string, GPUTimer> gpuTimers;
+	std::map<std::string, ProfileStats> gpuStats;
+	std::map<std::string, ProfileStats> cpuStats;
+	std::vector<ProfileEvent> trace;
+
+private:
+	std::string activeGPUTimer;
+
+public:
+	Profiler();
+	~Profiler();
+
+	void beginFrame();
+	void beginGPU(const std::string& name);
+	void endGPU();
+	void addCPUSample(const std::string& name, double ms);
+	void flush();
+	void clear();
+
+	const ProfileStats& getGPUStats(const std::string& name);
+	const ProfileStats& getCPUStats(const std::string& name);
+	void printSummary();
+	bool dumpCSV(const QString& filename);
+	bool dumpJSON(const QString& filename);
+
+private:
+	void collect(const std::string& name, GPUTimer& timer, int slot, bool wait);
+};
+
+/**
+ * Measure the CPU time of a scope and add it to the profiler on destruction.
+ */
+class ScopedCPUTimer {
+private:
+	Profiler* profiler;
+	std::string name;
+	QElapsedTimer timer;
+
+public:
+	ScopedCPUTimer(Profiler* profiler, const std::string& name);
+	~ScopedCPUTimer();
+};
+
+/**
+ * Accumulate the CPU time of many short sections (e.g., per patch) into one sample.
+ */
+class CPUTimer {
+public:
+	double elapsed;				// accumulated time [ms]
+
+private:
+	QElapsedTimer timer;
+
+public:
+	CPUTimer() : elapsed(0.0) {}
+	void start() { timer.start(); }
+	void stop() { elapsed += timer.nsecsElapsed() * 1e-6; }
+};
@@ -0,0 +1,96 @@
+#include "RenderBackend.h"
+#include "HeadlessContext.h"
+#include <iostream>
+
+/**
+ * Read the color buffer of framebuffer().
+ * OpenGL stores the rows bottom-up, so the image is flipped to the top-down order of QImage.
+ * The pixels are read in BGRA, which is the memory layout of QImage::Format_ARGB32.
+ */
+QImage RenderBackend::readImage() {
+	QImage img(width(), height(), QImage::Format_ARGB32);
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer());
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, width(), height(), GL_BGRA, GL_UNSIGNED_BYTE, img.bits());
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+	return img.mirrored(false, true);
+}
+
+OffscreenBackend::OffscreenBackend(HeadlessContext* context) {
+	this->context = context;
+	fbo = 0;
+	depthRenderbuffer = 0;
+	_width = 0;
+	_height = 0;
+}
+
+OffscreenBackend::~OffscreenBackend() {
+	release();
+}
+
+/**
+ * (Re)create the framebuffer with the given size.
+ * The context has to be current.
+ *
+ * @param width				width
+ * @param height			height
+ * @param numColorBuffers	number of color buffers (GL_COLOR_ATTACHMENT0, 1, ...)
+ */
+void OffscreenBackend::resize(int width, int height, int numColorBuffers) {
+	if (fbo != 0 && width == _width && height == _height && numColorBuffers == colorTex.size()) return;
+
+	release();
+	_width = width;
+	_height = height;
+
+	colorTex.resize(numColorBuffers);
+	glGenTextures(numColorBuffers, colorTex.data());
+	for (int i = 0; i < numColorBuffers; ++i) {
+		glBindTexture(GL_TEXTURE_2D, colorTex[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenRenderbuffers(1, &depthRenderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	for (int i = 0; i < numColorBuffers; ++i) {
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, colorTex[i], 0);
+	}
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRenderbuffer);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		printf("ERROR: offscreen framebuffer is not complete (%d x %d)\n", width, height);
+		exit(1);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void OffscreenBackend::makeCurrent() {
+	if (context != NULL) {
+		context->makeCurrent();
+	}
+}
+
+void OffscreenBackend::release() {
+	if (fbo != 0) {
+		glDeleteFramebuffers(1, &fbo);
+		glDeleteTextures(colorTex.size(), colorTex.data());
+		glDeleteRenderbuffers(1, &depthRenderbuffer);
+		fbo = 0;
+		colorTex.clear();
+		depthRenderbuffer = 0;
+	}
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "glew.h"
+#include <QImage>
+#include <vector>
+
+class HeadlessContext;
+
+/**
+ * Target of the render pipeline.
+ * RenderManager::renderFrame() draws the final image into framebuffer() at width() x height(),
+ * so that the same pass sequence runs in the Qt widget and in a command-line process.
+ */
+class RenderBackend {
+public:
+	virtual ~RenderBackend() {}
+
+	virtual void makeCurrent() = 0;
+	virtual GLuint framebuffer() = 0;
+	virtual int width() = 0;
+	virtual int height() = 0;
+	virtual int numColorBuffers() { return 1; }
+	virtual QImage readImage();
+};
+
+/**
+ * Render backend that owns its own framebuffer (RGBA8 color buffers + depth).
+ * It does not need a window, so the image can have any resolution. With several color
+ * buffers, the post passes of a pipeline write their images to separate buffers in one frame.
+ * If a headless context is given, it is made current before rendering. Otherwise, the
+ * framebuffer is created in the context that is current (e.g. the one of the widget).
+ */
+class OffscreenBackend : public RenderBackend {
+public:
+	HeadlessContext* context;
+	GLuint fbo;
+	std::vector<GLuint> colorTex;
+	GLuint depthRenderbuffer;
+
+private:
+	int _width;
+	int _height;
+
+public:
+	OffscreenBackend(HeadlessContext* context = NULL);
+	~OffscreenBackend();
+
+	void resize(int width, int height, int numColorBuffers = 1);
+	void makeCurrent();
+	GLuint framebuffer() { return fbo; }
+	int width() { return _width; }
+	int height() { return _height; }
+	int numColorBuffers() { return (int)colorTex.size(); }
+
+private:
+	void release();
+};
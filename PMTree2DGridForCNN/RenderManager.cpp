@@ -1,13 +1,26 @@
 ﻿#include "RenderManager.h"
 #include <iostream>
 #include "Shader.h"
+#include "Camera.h"
+#include "RenderBackend.h"
 #include <QImage>
 #include <QGLWidget>
 #include <sstream>
+#include <stdexcept>
+#include <limits>
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#define RENDERMANAGER_USE_SSE
+#include <xmmintrin.h>
+#endif
 
 GeometryObject::GeometryObject() {
 	vaoCreated = false;
 	vaoOutdated = true;
+	bbMin = glm::vec3((std::numeric_limits<float>::max)());
+	bbMax = -bbMin;
 }
 
 GeometryObject::GeometryObject(const std::vector<Vertex>& vertices, bool lighting) {
@@ -15,11 +28,46 @@ GeometryObject::GeometryObject(const std::vector<Vertex>& vertices, bool lightin
 	this->lighting = lighting;
 	vaoCreated = false;
 	vaoOutdated = true;
+	bbMin = glm::vec3((std::numeric_limits<float>::max)());
+	bbMax = -bbMin;
+	if (!vertices.empty()) expandBounds(vertices.data(), vertices.size());
 }
 
 void GeometryObject::addVertices(const std::vector<Vertex>& vertices) {
 	this->vertices.insert(this->vertices.end(), vertices.begin(), vertices.end());
 	vaoOutdated = true;
+	if (!vertices.empty()) expandBounds(vertices.data(), vertices.size());
+}
+
+/**
+ * Expand the bounding box by the new vertices.
+ * The position is loaded as 4 floats (x, y, z, normal.x), and the min/max of all the
+ * components are reduced at once with SSE. The 4th lane is ignored.
+ *
+ * @param v		new vertices
+ * @param num	number of the new vertices
+ */
+void GeometryObject::expandBounds(const Vertex* v, size_t num) {
+#ifdef RENDERMANAGER_USE_SSE
+	__m128 minV = _mm_set_ps(0.0f, bbMin.z, bbMin.y, bbMin.x);
+	__m128 maxV = _mm_set_ps(0.0f, bbMax.z, bbMax.y, bbMax.x);
+	for (size_t i = 0; i < num; ++i) {
+		__m128 p = _mm_loadu_ps(&v[i].position.x);
+		minV = _mm_min_ps(minV, p);
+		maxV = _mm_max_ps(maxV, p);
+	}
+
+	float minF[4], maxF[4];
+	_mm_storeu_ps(minF, minV);
+	_mm_storeu_ps(maxF, maxV);
+	bbMin = glm::vec3(minF[0], minF[1], minF[2]);
+	bbMax = glm::vec3(maxF[0], maxF[1], maxF[2]);
+#else
+	for (size_t i = 0; i < num; ++i) {
+		bbMin = glm::min(bbMin, v[i].position);
+		bbMax = glm::max(bbMax, v[i].position);
+	}
+#endif
 }
 
 /**
@@ -70,19 +118,34 @@ RenderManager::RenderManager() {
 	uKernelSize = 64;// 16;
 	uRadius = 1;// 17.0f;
 	uPower = 2.0f;
+	modelMatrix = glm::mat4();
+	flipY = false;
+	gbufferWidth = 0;
+	gbufferHeight = 0;
+	aoScale = 2;
+	aoWidth = 0;
+	aoHeight = 0;
+	fragNoiseTex = 0;
+	fragAOTex = 0;
+	fragDataFB_AO = 0;
+	secondPassVBO = 0;
+	secondPassVAO = 0;
 }
 
 RenderManager::~RenderManager() {
 	shader.cleanShaders();
 
+	// the software renderer uses RenderManager without a GL context (init() is not called)
+	if (secondPassVAO == 0) return;
+
 	//delete
 	glDeleteVertexArrays(1,&secondPassVBO);
 	glDeleteVertexArrays(1,&secondPassVAO);
 }
 
-void RenderManager::init(const std::string& vertex_file, const std::string& geometry_file, const std::string& fragment_file, bool useShadow, int shadowMapSize) {
+void RenderManager::init(const std::string& vertex_file, const std::string& geometry_file, const std::string& fragment_file, bool useShadow, int shadowQuality) {
 	this->useShadow = useShadow;
-	this->softShadow = true;
+	this->shadowFilter = ShadowMapping::FILTER_PCF4;
 	renderingMode = RENDERING_MODE_BASIC;
 	renderingMode = RENDERING_MODE_LINE;
 
@@ -93,26 +156,50 @@ void RenderManager::init(const std::string& vertex_file, const std::string& geom
 	}
 
 	// init program shader
+	// texture units of the samplers in pass 1
+	std::map<std::string, int> pass1Samplers;
+	pass1Samplers["tex0"] = 0;
+	pass1Samplers["shadowMap"] = 6;
+
+	// texture units of the G-buffer that the full screen passes read (see resize())
+	std::map<std::string, int> gbufferSamplers;
+	gbufferSamplers["tex0"] = 1;			// color, light intensity
+	gbufferSamplers["tex1"] = 2;			// normal
+	gbufferSamplers["tex3"] = 4;			// AO
+	gbufferSamplers["hatchingTexture"] = 5;
+	gbufferSamplers["noiseTex"] = 7;
+	gbufferSamplers["depthTex"] = 8;
+
 	// PASS 1
 	fragDataNamesP1.push_back("def_diffuse");
 	fragDataNamesP1.push_back("def_normal");
-	fragDataNamesP1.push_back("def_originPos");
-	fragDataNamesP1.push_back("def_intensity");
-	programs["pass1"] = shader.createProgram("shaders/lc_vert_pass1.glsl", "shaders/lc_frag_pass1.glsl", fragDataNamesP1);
+	registerProgram("pass1", "shaders/lc_vert_pass1.glsl", "shaders/lc_frag_pass1.glsl", fragDataNamesP1, std::vector<std::string>(), pass1Samplers);
+	registerProgram("pass1_line", "shaders/lc_vert_pass1.glsl", "shaders/lc_frag_pass1.glsl", fragDataNamesP1, std::vector<std::string>(1, "LINE_ONLY"), pass1Samplers);
 	// PASS 2
 	std::vector<QString> fragDataNamesP2;
 	fragDataNamesP2.push_back("def_AO");
-	programs["ssao"] = shader.createProgram("shaders/lc_vert_ssao.glsl", "shaders/lc_frag_ssao.glsl", fragDataNamesP2);
+	registerProgram("ssao", "shaders/lc_vert_ssao.glsl", "shaders/lc_frag_ssao.glsl", fragDataNamesP2, std::vector<std::string>(), gbufferSamplers);
 	// PASS 3
-	programs["blur"] = shader.createProgram("shaders/lc_vert_blur.glsl", "shaders/lc_frag_blur.glsl");
+	registerProgram("blur", "shaders/lc_vert_blur.glsl", "shaders/lc_frag_blur.glsl", std::vector<QString>(), std::vector<std::string>(), gbufferSamplers);
+	registerProgram("blur_ssao", "shaders/lc_vert_blur.glsl", "shaders/lc_frag_blur.glsl", std::vector<QString>(), std::vector<std::string>(1, "USE_SSAO"), gbufferSamplers);
 
 	// Line rendering
-	programs["line"] = shader.createProgram("shaders/lc_vert_line.glsl", "shaders/lc_frag_line.glsl");
+	registerProgram("line", "shaders/lc_vert_line.glsl", "shaders/lc_frag_line.glsl", std::vector<QString>(), std::vector<std::string>(), gbufferSamplers);
+	registerProgram("line_hatching", "shaders/lc_vert_line.glsl", "shaders/lc_frag_line.glsl", std::vector<QString>(), std::vector<std::string>(1, "USE_HATCHING"), gbufferSamplers);
 
 	// Shadow mapping
-	programs["shadow"] = shader.createProgram("shaders/lc_vert_shadow.glsl", "shaders/lc_frag_shadow.glsl");
+	registerProgram("shadow", "shaders/lc_vert_shadow.glsl", "shaders/lc_frag_shadow.glsl");
+
+	buildPipelines();
+
+	// compile only the programs that the current rendering mode uses.
+	// the others are compiled when they are used for the first time.
+	std::vector<std::string> names = requiredPrograms(renderingMode);
+	for (int i = 0; i < names.size(); ++i) {
+		getProgram(names[i]);
+	}
 
-	glUseProgram(programs["pass1"]);
+	glUseProgram(getProgram(pipeline().gbufferProgram));
 
 
 	//////////////////////////////////////////////
@@ -143,6 +230,10 @@ void RenderManager::init(const std::string& vertex_file, const std::string& geom
 	glBindVertexArray(0);
 	// fragm
 	fragDataFB=INT_MAX;
+
+	// SSAO resources that do not depend on the window size
+	createNoiseTexture();
+	resizeSsaoKernel();
 	
 	///// load 3d texture for hatching
 	std::vector<QString> hatchingTextureFiles;
@@ -157,79 +248,202 @@ void RenderManager::init(const std::string& vertex_file, const std::string& geom
 	hatchingTextureFiles.push_back("hatching/hatching8.png");
 	hatchingTextures = load3DTexture(hatchingTextureFiles);
 	
-	shadow.init(programs["shadow"], shadowMapSize, shadowMapSize);
+	// the shadow map is allocated when a rendering mode that uses shadows renders the first frame
+	shadow.init(getProgram("shadow"), shadowQuality);
+}
+
+void RenderManager::registerProgram(const std::string& name, const std::string& vertex_file, const std::string& fragment_file, const std::vector<QString>& fragDataNames, const std::vector<std::string>& defines, const std::map<std::string, int>& samplers) {
+	programSources[name] = ProgramSource(vertex_file, fragment_file, fragDataNames, defines, samplers);
+}
+
+/**
+ * Return the program id.
+ * If the program has not been created yet, it is compiled (or loaded from the program cache) here.
+ *
+ * @param name		program name
+ * @return			program id
+ */
+GLuint RenderManager::getProgram(const std::string& name) {
+	auto it = programs.find(name);
+	if (it != programs.end()) return it->second;
+
+	auto src = programSources.find(name);
+	if (src == programSources.end()) {
+		std::stringstream ss;
+		ss << "Unknown program: " << name;
+		throw std::runtime_error(ss.str());
+	}
+
+	GLuint program = shader.createProgram(src->second.vertex_file, src->second.fragment_file, src->second.fragDataNames, src->second.defines);
+	programs[name] = program;
+
+	// the texture units never change, so the samplers are set only once
+	if (!src->second.samplers.empty()) {
+		GLint currentProgram = 0;
+		glGetIntegerv(GL_CURRENT_PROGRAM, &currentProgram);
+		glUseProgram(program);
+		for (auto it = src->second.samplers.begin(); it != src->second.samplers.end(); ++it) {
+			glUniform1i(glGetUniformLocation(program, it->first.c_str()), it->second);
+		}
+		glUseProgram(currentProgram);
+	}
+
+	return program;
+}
+
+/**
+ * Set up the passes of each rendering mode.
+ * The line mode does not read the color and the shadow, so pass 1 writes only the normal
+ * and the depth with the LINE_ONLY variant.
+ */
+void RenderManager::buildPipelines() {
+	pipelines.clear();
+
+	RenderPipeline basic;
+	basic.gbufferProgram = "pass1";
+	basic.postPrograms.push_back("blur");
+	basic.drawBuffers.push_back(GL_COLOR_ATTACHMENT0);
+	basic.drawBuffers.push_back(GL_COLOR_ATTACHMENT1);
+	basic.useShadow = useShadow;
+	pipelines[RENDERING_MODE_BASIC] = basic;
+	pipelines[RENDERING_MODE_SKETCHY] = basic;
+
+	RenderPipeline ssao = basic;
+	ssao.aoProgram = "ssao";
+	ssao.postPrograms[0] = "blur_ssao";
+	pipelines[RENDERING_MODE_SSAO] = ssao;
+
+	RenderPipeline line;
+	line.gbufferProgram = "pass1_line";
+	line.postPrograms.push_back("line");
+	line.drawBuffers.push_back(GL_NONE);
+	line.drawBuffers.push_back(GL_COLOR_ATTACHMENT1);
+	line.useShadow = false;
+	pipelines[RENDERING_MODE_LINE] = line;
+
+	// hatching needs the light intensity, which includes the shadow
+	RenderPipeline hatching = basic;
+	hatching.postPrograms[0] = "line_hatching";
+	pipelines[RENDERING_MODE_HATCHING] = hatching;
+
+	// color and line images from one G-buffer (for the training data).
+	// The normals and the depth that the line pass reads are the same as in the line mode.
+	RenderPipeline combined = basic;
+	combined.postPrograms.push_back("line");
+	pipelines[RENDERING_MODE_COMBINED] = combined;
+}
+
+/**
+ * Return the pipeline of the current rendering mode.
+ */
+const RenderPipeline& RenderManager::pipeline() {
+	auto it = pipelines.find(renderingMode);
+	if (it == pipelines.end()) {
+		std::stringstream ss;
+		ss << "Unknown rendering mode: " << renderingMode;
+		throw std::runtime_error(ss.str());
+	}
+	return it->second;
+}
+
+/**
+ * Return the names of the programs that are used in the specified rendering mode.
+ */
+std::vector<std::string> RenderManager::requiredPrograms(int renderingMode) {
+	std::vector<std::string> names;
+
+	auto it = pipelines.find(renderingMode);
+	if (it == pipelines.end()) return names;
+
+	names.push_back(it->second.gbufferProgram);
+	if (it->second.useShadow) {
+		names.push_back("shadow");
+	}
+	if (!it->second.aoProgram.empty()) {
+		names.push_back(it->second.aoProgram);
+	}
+	names.insert(names.end(), it->second.postPrograms.begin(), it->second.postPrograms.end());
+
+	return names;
+}
+
+/**
+ * Bind the G-buffer textures to the texture units that the samplers of the full screen passes refer to.
+ */
+void RenderManager::bindGBufferTextures() {
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, fragDataTex[0]);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, fragDataTex[1]);
+	glActiveTexture(GL_TEXTURE4);
+	glBindTexture(GL_TEXTURE_2D, fragAOTex);
+	glActiveTexture(GL_TEXTURE5);
+	glBindTexture(GL_TEXTURE_3D, hatchingTextures);
+	glActiveTexture(GL_TEXTURE7);
+	glBindTexture(GL_TEXTURE_2D, fragNoiseTex);
+	glActiveTexture(GL_TEXTURE8);
+	glBindTexture(GL_TEXTURE_2D, fragDepthTex);
+	glActiveTexture(GL_TEXTURE0);
 }
 
 void RenderManager::resize(int winWidth, int winHeight){
-		
+	passCache.invalidate();
+
 	if(fragDataTex.size()>0){
 		glDeleteTextures(fragDataTex.size(),&fragDataTex[0]);
 		glDeleteTextures(1,&fragDepthTex);
-		glDeleteTextures(1, &fragNoiseTex);
+		glDeleteTextures(1, &fragAOTex);
 		fragDataTex.clear();
 		glDeleteFramebuffers(1,&fragDataFB);
+		glDeleteFramebuffers(1, &fragDataFB_AO);
 	}
 
+	gbufferWidth = winWidth;
+	gbufferHeight = winHeight;
+
+	// AO buffer is 1/aoScale of the window, rounded up so that every pixel is covered
+	aoWidth = (winWidth + aoScale - 1) / aoScale;
+	aoHeight = (winHeight + aoScale - 1) / aoScale;
+
 
 	// The texture we're going to render to
 	fragDataTex.resize(fragDataNamesP1.size());
 
-	// TEX1: Diffuse Texture
+	// The position is reconstructed from the depth, and the light intensity is stored in the alpha channel
+	// of the diffuse texture, so the G-buffer has only two color targets.
+
+	// TEX1: Diffuse Texture (rgb: shaded color, a: light intensity)
 	glActiveTexture(GL_TEXTURE1);
 	glEnable(GL_TEXTURE_2D);
 	glGenTextures(1, &fragDataTex[0]);
 	glBindTexture(GL_TEXTURE_2D, fragDataTex[0]);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);// GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,  GL_CLAMP);// GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, winWidth, winHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);//NULL means reserve texture memory, but texels are undefined
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, winWidth, winHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);//NULL means reserve texture memory, but texels are undefined
 
-	// TEX2: Normal Texture
+	// TEX2: Normal Texture (octahedral encoding)
 	glActiveTexture (GL_TEXTURE2);
 	glEnable( GL_TEXTURE_2D );
 	glGenTextures(1, &fragDataTex[1]);
 	glBindTexture(GL_TEXTURE_2D, fragDataTex[1]);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,  GL_CLAMP);// GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,  GL_CLAMP);// GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, winWidth, winHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16_SNORM, winWidth, winHeight, 0, GL_RG, GL_SHORT, NULL);
 
-	// TEX3: Original Position Texture
-	glActiveTexture(GL_TEXTURE3);
-	glEnable(GL_TEXTURE_2D);
-	glGenTextures(1, &fragDataTex[2]);
-	glBindTexture(GL_TEXTURE_2D, fragDataTex[2]);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);// GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);// GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, winWidth, winHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-
-
-	// TEX4: AO Texture
+	// TEX4: AO Texture (low resolution, single channel)
 	glActiveTexture(GL_TEXTURE4);
 	glEnable(GL_TEXTURE_2D);
 	glGenTextures(1, &fragAOTex);
 	glBindTexture(GL_TEXTURE_2D, fragAOTex);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);// GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);// GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, winWidth, winHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-
-
-	// TEX5: Light intensity
-	glActiveTexture(GL_TEXTURE5);
-	glEnable(GL_TEXTURE_2D);
-	glGenTextures(1, &fragDataTex[3]);
-	glBindTexture(GL_TEXTURE_2D, fragDataTex[3]);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);// GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);// GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, winWidth, winHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, aoWidth, aoHeight, 0, GL_RED, GL_FLOAT, NULL);
 
 
 	/////////////////////////////////////////
@@ -246,30 +460,20 @@ void RenderManager::resize(int winWidth, int winHeight){
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 		
-	glActiveTexture(GL_TEXTURE9);
-		glEnable(GL_TEXTURE_2D);
-		glGenTextures(1, &fragDepthTex_AO);
-		glBindTexture(GL_TEXTURE_2D, fragDepthTex_AO);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, winWidth, winHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
 	/////////////////////////////////////////
 
 	// FRAME BUFFER
 	fragDataFB = 0;
 	glGenFramebuffers(1, &fragDataFB);
+	glBindFramebuffer(GL_FRAMEBUFFER, fragDataFB);
 		
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fragDataTex[0], 0);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, fragDataTex[1], 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, fragDataTex[2], 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, fragDataTex[3], 0);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, fragDepthTex, 0);
 	// Set the list of draw buffers.
-	GLenum DrawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
-	glDrawBuffers(3, DrawBuffers); // "3" is the size of DrawBuffers
+	GLenum DrawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, DrawBuffers); // "2" is the size of DrawBuffers
 
 	// Always check that our framebuffer is ok
 	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE){
@@ -279,14 +483,15 @@ void RenderManager::resize(int winWidth, int winHeight){
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
 	// FRAME BUFFER AO
+	// the AO pass is a full screen quad without depth test, so it needs no depth attachment.
 	fragDataFB_AO = 0;
 	glGenFramebuffers(1, &fragDataFB_AO);
+	glBindFramebuffer(GL_FRAMEBUFFER, fragDataFB_AO);
 
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fragAOTex, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, fragDepthTex, 0);
 	// Set the list of draw buffers.
 	GLenum DrawBuffers_AO[] = { GL_COLOR_ATTACHMENT0 };
-	glDrawBuffers(1, DrawBuffers_AO); // "3" is the size of DrawBuffers
+	glDrawBuffers(1, DrawBuffers_AO);
 
 	// Always check that our framebuffer is ok
 	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
@@ -295,9 +500,18 @@ void RenderManager::resize(int winWidth, int winHeight){
 	}
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-	//////////////////////////////////////////////////////////////////////////////////
-	// Noise
-	fragNoiseTex = 0;
+	glActiveTexture(GL_TEXTURE0);
+}//
+
+/**
+ * Create the NOISE_SIZE x NOISE_SIZE texture of random rotation vectors for SSAO.
+ * It is tiled over the AO buffer with GL_REPEAT, so it does not depend on the window size.
+ */
+void RenderManager::createNoiseTexture() {
+	if (fragNoiseTex != 0) {
+		glDeleteTextures(1, &fragNoiseTex);
+	}
+
 	glActiveTexture(GL_TEXTURE7);
 	glEnable(GL_TEXTURE_2D);
 	glGenTextures(1, &fragNoiseTex);
@@ -306,25 +520,19 @@ void RenderManager::resize(int winWidth, int winHeight){
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		
+
 	qsrand(5648943215);
-		
-	int sizeX = winWidth;
-	int sizeZ = winHeight;
 
-	std::vector<GLfloat> data(sizeX*sizeZ*3);
-	for (int c = 0; c < sizeX*sizeZ*3; c++) {
+	std::vector<GLfloat> data(NOISE_SIZE * NOISE_SIZE * 3);
+	for (int c = 0; c < data.size(); c++) {
 		if (c % 3 == 0 || c % 3 == 1)
 			data[c] = (float(qrand()) / RAND_MAX)*2.0f - 1.0f;
 		else
 			data[c] = 0.0f; //0 in component z
 	}
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, sizeX, sizeZ, 0, GL_RGB, GL_FLOAT, &data[0]);
-	glGenerateMipmap(GL_TEXTURE_2D);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, NOISE_SIZE, NOISE_SIZE, 0, GL_RGB, GL_FLOAT, &data[0]);
 	glActiveTexture(GL_TEXTURE0);
-		
-	resizeSsaoKernel();
-}//
+}
 
 template<typename T>
 T lerp(T v0, T v1, T t) {
@@ -376,6 +584,8 @@ void RenderManager::addObject(const QString& object_name, const QString& texture
 	} else {
 		objects[object_name][texId] = GeometryObject(vertices, lighting);
 	}
+
+	invalidateScene();
 }
 
 void RenderManager::removeObjects() {
@@ -383,48 +593,145 @@ void RenderManager::removeObjects() {
 		removeObject(it.key());
 	}
 	objects.clear();
+	modelMatrix = glm::mat4();
 }
 
 void RenderManager::removeObject(const QString& object_name) {
 	for (auto it = objects[object_name].begin(); it != objects[object_name].end(); ++it) {
+		if (!it->vaoCreated) continue;
 		glDeleteBuffers(1, &it->vbo);
 		glDeleteVertexArrays(1, &it->vao);
 	}
 
 	objects[object_name].clear();
+	invalidateScene();
 }
 
+/**
+ * Scale and translate the scene so that it fits in the unit cube centered at the origin.
+ * Only the model matrix is changed, so the vertices do not have to be uploaded again.
+ */
 void RenderManager::centerObjects() {
-	glm::vec3 minPt((std::numeric_limits<float>::max)(), (std::numeric_limits<float>::max)(), (std::numeric_limits<float>::max)());
-	glm::vec3 maxPt = -minPt;
-
-	// もとのサイズを計算
-	for (auto it = objects.begin(); it != objects.end(); ++it) {
-		for (auto it2 = it.value().begin(); it2 != it.value().end(); ++it2) {
-			for (int k = 0; k < it2->vertices.size(); ++k) {
-				minPt.x = (std::min)(minPt.x, it2->vertices[k].position.x);
-				minPt.y = (std::min)(minPt.y, it2->vertices[k].position.y);
-				minPt.z = (std::min)(minPt.z, it2->vertices[k].position.z);
-				maxPt.x = (std::max)(maxPt.x, it2->vertices[k].position.x);
-				maxPt.y = (std::max)(maxPt.y, it2->vertices[k].position.y);
-				maxPt.z = (std::max)(maxPt.z, it2->vertices[k].position.z);
-			}
-		}
-	}
+	glm::vec3 minPt, maxPt;
+	if (!sceneBounds(minPt, maxPt, false)) return;
 
 	glm::vec3 center = (maxPt + minPt) * 0.5f;
 
 	float size = (std::max)(maxPt.x - minPt.x, (std::max)(maxPt.y - minPt.y, maxPt.z - minPt.z));
-	float scale = 1.0f / size;
+	float scale = size > 0.0f ? 1.0f / size : 1.0f;
 
 	// 単位立方体に入るよう、縮尺・移動
+	modelMatrix = glm::scale(glm::mat4(), glm::vec3(scale, scale, scale)) * glm::translate(glm::mat4(), -center);
+
+	invalidateScene();
+}
+
+/**
+ * Compute the bounding box of the object before the model matrix is applied.
+ *
+ * @param object_name		object name
+ * @param minPt				[OUT] min corner
+ * @param maxPt				[OUT] max corner
+ * @return					false if the object has no vertex
+ */
+bool RenderManager::objectBounds(const QString& object_name, glm::vec3& minPt, glm::vec3& maxPt) {
+	minPt = glm::vec3((std::numeric_limits<float>::max)());
+	maxPt = -minPt;
+
+	if (!objects.contains(object_name)) return false;
+
+	bool found = false;
+	for (auto it = objects[object_name].begin(); it != objects[object_name].end(); ++it) {
+		if (it->empty()) continue;
+		minPt = glm::min(minPt, it->bbMin);
+		maxPt = glm::max(maxPt, it->bbMax);
+		found = true;
+	}
+
+	return found;
+}
+
+/**
+ * Compute the bounding box of all the objects from the bounding boxes of the objects.
+ *
+ * @param minPt				[OUT] min corner
+ * @param maxPt				[OUT] max corner
+ * @param applyModelMatrix	true -- return the bounding box after the model matrix is applied
+ * @return					false if there is no vertex
+ */
+bool RenderManager::sceneBounds(glm::vec3& minPt, glm::vec3& maxPt, bool applyModelMatrix) {
+	minPt = glm::vec3((std::numeric_limits<float>::max)());
+	maxPt = -minPt;
+
+	// in the atlas mode, the objects of the cells are moved apart
+	if (!atlasCells.empty() && applyModelMatrix) {
+		bool found = false;
+		for (int i = 0; i < atlasCells.size(); ++i) {
+			glm::vec3 p0, p1;
+			if (!objectBounds(atlasCells[i].object_name, p0, p1)) continue;
+
+			glm::mat4 model = cellModelMatrix(atlasCells[i]);
+			p0 = glm::vec3(model * glm::vec4(p0, 1.0f));
+			p1 = glm::vec3(model * glm::vec4(p1, 1.0f));
+			minPt = glm::min(minPt, glm::min(p0, p1));
+			maxPt = glm::max(maxPt, glm::max(p0, p1));
+			found = true;
+		}
+		return found;
+	}
+
+	bool found = false;
 	for (auto it = objects.begin(); it != objects.end(); ++it) {
 		for (auto it2 = it.value().begin(); it2 != it.value().end(); ++it2) {
-			for (int k = 0; k < it2->vertices.size(); ++k) {
-				it2->vertices[k].position = (it2->vertices[k].position - center) * scale;
-			}
+			if (it2->empty()) continue;
+			minPt = glm::min(minPt, it2->bbMin);
+			maxPt = glm::max(maxPt, it2->bbMax);
+			found = true;
 		}
 	}
+	if (!found) return false;
+
+	if (applyModelMatrix) {
+		// the model matrix consists of a uniform scale and a translation, so the corners stay the corners
+		glm::vec3 p0 = glm::vec3(modelMatrix * glm::vec4(minPt, 1.0f));
+		glm::vec3 p1 = glm::vec3(modelMatrix * glm::vec4(maxPt, 1.0f));
+		minPt = glm::min(p0, p1);
+		maxPt = glm::max(p0, p1);
+	}
+
+	return true;
+}
+
+/**
+ * Mark the shadow map and the cached passes as outdated, e.g. when the geometry has changed.
+ */
+void RenderManager::invalidateScene() {
+	shadow.invalidate();
+	passCache.invalidate();
+}
+
+/**
+ * Render the objects of each cell into its own rectangle with its own camera (see AtlasCell).
+ *
+ * @param cells		cells of the atlas
+ */
+void RenderManager::setAtlas(const std::vector<AtlasCell>& cells) {
+	atlasCells = cells;
+	invalidateScene();
+}
+
+void RenderManager::clearAtlas() {
+	if (atlasCells.empty()) return;
+
+	atlasCells.clear();
+	invalidateScene();
+}
+
+/**
+ * Model matrix of the objects of the cell.
+ */
+glm::mat4 RenderManager::cellModelMatrix(const AtlasCell& cell) {
+	return glm::translate(glm::mat4(), cell.offset) * modelMatrix;
 }
 
 void RenderManager::renderAll() {
@@ -442,6 +749,8 @@ void RenderManager::renderAllExcept(const QString& object_name) {
 }
 
 void RenderManager::render(const QString& object_name) {
+	GLuint program = getProgram(pipeline().gbufferProgram);
+
 	for (auto it = objects[object_name].begin(); it != objects[object_name].end(); ++it) {
 		GLuint texId = it.key();
 		
@@ -452,29 +761,16 @@ void RenderManager::render(const QString& object_name) {
 			// テクスチャなら、バインドする
 			glActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_2D, texId);
-			glUniform1i(glGetUniformLocation(programs["pass1"], "textureEnabled"), 1);
-			glUniform1i(glGetUniformLocation(programs["pass1"], "tex0"), 0);
+			glUniform1i(glGetUniformLocation(program, "textureEnabled"), 1);
 		} else {
-			glUniform1i(glGetUniformLocation(programs["pass1"], "textureEnabled"), 0);
+			glUniform1i(glGetUniformLocation(program, "textureEnabled"), 0);
 		}
 
 		if (it->lighting) {
-			glUniform1i(glGetUniformLocation(programs["pass1"], "lighting"), 1);
+			glUniform1i(glGetUniformLocation(program, "lighting"), 1);
 		}
 		else {
-			glUniform1i(glGetUniformLocation(programs["pass1"], "lighting"), 0);
-		}
-
-		if (useShadow) {
-			glUniform1i(glGetUniformLocation(programs["pass1"], "useShadow"), 1);
-			if (softShadow) {
-				glUniform1i(glGetUniformLocation(programs["pass1"], "softShadow"), 1);
-			}
-			else {
-				glUniform1i(glGetUniformLocation(programs["pass1"], "softShadow"), 0);
-			}
-		} else {
-			glUniform1i(glGetUniformLocation(programs["pass1"], "useShadow"), 0);
+			glUniform1i(glGetUniformLocation(program, "lighting"), 0);
 		}
 
 		// 描画
@@ -485,111 +781,324 @@ void RenderManager::render(const QString& object_name) {
 	}
 }
 
-void RenderManager::updateShadowMap(GLWidget3D* glWidget3D, const glm::vec3& light_dir, const glm::mat4& light_mvpMatrix) {
-	if (useShadow) {
-		shadow.update(glWidget3D, light_dir, light_mvpMatrix);
+/**
+ * Draw all the objects with the program that is currently in use.
+ * In the atlas mode, the objects of each cell are drawn with the model matrix of the cell.
+ */
+void RenderManager::drawScene() {
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LEQUAL);
+	glDepthMask(true);
+
+	if (atlasCells.empty()) {
+		renderAll();
+		return;
+	}
+
+	GLint program;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+	for (int i = 0; i < atlasCells.size(); ++i) {
+		glm::mat4 model = cellModelMatrix(atlasCells[i]);
+		glUniformMatrix4fv(glGetUniformLocation(program, "modelMatrix"), 1, GL_FALSE, &model[0][0]);
+		render(atlasCells[i].object_name);
 	}
 }
 
-GLuint RenderManager::loadTexture(const QString& filename) {
-	QImage img;
-	if (!img.load(filename)) {
-		std::stringstream ss;
-		ss << "load texture failed : " << filename.toUtf8().constData();
-		std::cout << ss.str() << std::endl;
-		throw ss.str();
+/**
+ * Render the shadow map again if the geometry or the light has changed since the last update.
+ * The light frustum is fitted to the current scene before rendering.
+ */
+void RenderManager::updateShadowMap() {
+	if (!useShadow || !shadow.dirty) return;
+
+	glm::vec3 minPt, maxPt;
+	if (sceneBounds(minPt, maxPt)) {
+		shadow.fitToBounds(minPt, maxPt);
 	}
 
-	QImage GL_formatted_image;
-	GL_formatted_image = QGLWidget::convertToGLFormat(img);
-	if (GL_formatted_image.isNull()) {
-		std::stringstream ss;
-		ss << "Failed to convert to gl format : " << filename.toUtf8().constData();
-		std::cout << ss.str() << std::endl;
-		throw ss.str();
+	glUseProgram(shadow.programId);
+	glUniformMatrix4fv(glGetUniformLocation(shadow.programId, "modelMatrix"), 1, GL_FALSE, &modelMatrix[0][0]);
+
+	profiler.beginGPU("shadow");
+	shadow.update(this);
+	profiler.endGPU();
+}
+
+/**
+ * Return true if the G-buffer of the last frame can be reused for the pipeline.
+ * The normals and the depth of all the pass 1 variants are the same, so e.g. the G-buffer of the
+ * hatching mode can be reused in the line mode. The color attachment depends on the light as well.
+ */
+bool RenderManager::gbufferUpToDate(const RenderPipeline& pipeline, const Camera& camera, const glm::vec3& light_dir) {
+	if (!passCache.gbufferValid) return false;
+	if (passCache.mvpMatrix != camera.mvpMatrix || passCache.modelMatrix != modelMatrix) return false;
+
+	bool readsColor = false;
+	for (int i = 0; i < pipeline.drawBuffers.size(); ++i) {
+		if (pipeline.drawBuffers[i] == GL_NONE) continue;
+		if (std::find(passCache.drawBuffers.begin(), passCache.drawBuffers.end(), pipeline.drawBuffers[i]) == passCache.drawBuffers.end()) return false;
+		if (pipeline.drawBuffers[i] == GL_COLOR_ATTACHMENT0) readsColor = true;
 	}
 
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
+	if (readsColor) {
+		if (passCache.light_dir != light_dir || passCache.useShadow != pipeline.useShadow) return false;
+		if (pipeline.useShadow && passCache.shadowFilter != shadowFilter) return false;
+	}
 
-	GLuint texture;
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, GL_formatted_image.width(), GL_formatted_image.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, GL_formatted_image.bits());
-	glGenerateMipmap(GL_TEXTURE_2D);
+	return true;
+}
 
-	return texture;
+/**
+ * Return true if the AO buffer of the last frame can be reused for the pipeline.
+ */
+bool RenderManager::aoUpToDate(const RenderPipeline& pipeline) {
+	return passCache.aoValid && passCache.aoProgram == pipeline.aoProgram && passCache.uRadius == uRadius && passCache.uPower == uPower && passCache.uKernelSize == uKernelSize && passCache.aoScale == aoScale;
 }
 
-GLuint RenderManager::load3DTexture(const std::vector<QString> & pathes) {
-	GLsizei width, height, depth = (GLsizei)pathes.size();
-
-	std::vector<QImage> formatedImages(pathes.size());
-
-	// load and format each image
-	{
-		for (uint i = 0; i < pathes.size(); ++i) {
-			QImage imageToConvert;
-			if (!imageToConvert.load(pathes[i])) {
-				std::stringstream ss;
-				ss << "Failed to load 3D texture : " << pathes[i].toUtf8().constData();
-				std::cout << ss.str() << std::endl;
-				throw ss.str();
-			}
+/**
+ * Render one frame with the passes of the current rendering mode.
+ * The final image is written to the framebuffer of the backend, and the G-buffer is resized
+ * to the size of the backend if necessary. The projection matrix of the camera has to match
+ * the aspect ratio of the backend.
+ *
+ * @param camera		camera
+ * @param light_dir		direction of the directional light
+ * @param backend		render target (the widget, or an offscreen framebuffer)
+ */
+void RenderManager::renderFrame(Camera& camera, const glm::vec3& light_dir, RenderBackend* backend) {
+	const int width = backend->width();
+	const int height = backend->height();
+	if (width != gbufferWidth || height != gbufferHeight) {
+		resize(width, height);
+	}
 
-			QImage GL_formatted_image = QGLWidget::convertToGLFormat(imageToConvert);
-			if (GL_formatted_image.isNull()) {
-				std::stringstream ss;
-				ss << "Failed to convert to gl format : " << pathes[i].toUtf8().constData();
-				std::cout << ss.str() << std::endl;
-				throw ss.str();
-			}
+	profiler.beginFrame();
 
-			formatedImages[i] = GL_formatted_image;
+	// publish the textures that have been decoded by the worker threads
+	if (textureLoader.update() > 0) {
+		passCache.invalidate();
+	}
 
-			if (i == 0) {
-				width = formatedImages[i].width();
-				height = formatedImages[i].height();
-			}
-			else {
-				if (width != formatedImages[i].width() || height != formatedImages[i].height())	{
-					std::stringstream ss;
-					ss << "Texture3D::load() failed : different dimensions of images. " << pathes[0].toUtf8().constData() << " " << pathes[i].toUtf8().constData();
-					std::cout << ss.str() << std::endl;
-					throw ss.str();
-				}
+	glViewport(0, 0, width, height);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	glMatrixMode(GL_MODELVIEW);
+
+	const RenderPipeline& pipeline = this->pipeline();
+
+	// the shadow map is rendered again only when the geometry or the light has changed
+	if (pipeline.useShadow) {
+		if (shadow.dirty) passCache.invalidate();
+		updateShadowMap();
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// PASS 1: Render to texture
+	GLuint program;
+	if (!gbufferUpToDate(pipeline, camera, light_dir)) {
+		program = getProgram(pipeline.gbufferProgram);
+		glUseProgram(program);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, fragDataFB);
+
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fragDataTex[0], 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, fragDataTex[1], 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, fragDepthTex, 0);
+
+		// write only the attachments that the later passes of this mode read
+		glDrawBuffers(pipeline.drawBuffers.size(), pipeline.drawBuffers.data());
+
+		// Always check that our framebuffer is ok
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			printf("+ERROR: GL_FRAMEBUFFER_COMPLETE false\n");
+			exit(1);
+		}
+
+		glUniformMatrix4fv(glGetUniformLocation(program, "mvpMatrix"), 1, false, &camera.mvpMatrix[0][0]);
+		glUniformMatrix4fv(glGetUniformLocation(program, "modelMatrix"), 1, false, &modelMatrix[0][0]);
+		if (pipeline.useShadow) {
+			glUniform1i(glGetUniformLocation(program, "useShadow"), 1);
+			glUniform1i(glGetUniformLocation(program, "shadowFilter"), shadowFilter);
+			glUniformMatrix4fv(glGetUniformLocation(program, "light_mvpMatrix"), 1, false, &shadow.light_mvpMatrix[0][0]);
+			glActiveTexture(GL_TEXTURE6);
+			glBindTexture(GL_TEXTURE_2D, shadow.textureDepth);
+			glActiveTexture(GL_TEXTURE0);
+		}
+		else {
+			glUniform1i(glGetUniformLocation(program, "useShadow"), 0);
+		}
+		glUniform3f(glGetUniformLocation(program, "lightDir"), light_dir.x, light_dir.y, light_dir.z);
+
+		glEnable(GL_DEPTH_TEST);
+		glDepthFunc(GL_LEQUAL);
+		profiler.beginGPU("pass1");
+		if (atlasCells.empty()) {
+			drawScene();
+		}
+		else {
+			// each tree is drawn with its own camera, and clipped to its cell
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			glDepthMask(true);
+			glEnable(GL_SCISSOR_TEST);
+			for (int i = 0; i < atlasCells.size(); ++i) {
+				const AtlasCell& cell = atlasCells[i];
+				glm::mat4 model = cellModelMatrix(cell);
+				glScissor(cell.x, cell.y, cell.width, cell.height);
+				glUniformMatrix4fv(glGetUniformLocation(program, "mvpMatrix"), 1, false, &cell.mvpMatrix[0][0]);
+				glUniformMatrix4fv(glGetUniformLocation(program, "modelMatrix"), 1, false, &model[0][0]);
+				render(cell.object_name);
 			}
+			glDisable(GL_SCISSOR_TEST);
 		}
+		profiler.endGPU();
+
+		passCache.gbufferValid = true;
+		passCache.mvpMatrix = camera.mvpMatrix;
+		passCache.modelMatrix = modelMatrix;
+		passCache.light_dir = light_dir;
+		passCache.drawBuffers = pipeline.drawBuffers;
+		passCache.useShadow = pipeline.useShadow;
+		passCache.shadowFilter = shadowFilter;
+		passCache.aoValid = false;
 	}
 
-	GLuint texture;
+	// the samplers of the full screen passes are set when the programs are created, so only the textures have to be bound.
+	bindGBufferTextures();
+	glm::mat4 invMvpMatrix = glm::inverse(camera.mvpMatrix);
+
+	glDisable(GL_DEPTH_TEST);
+	glDepthFunc(GL_ALWAYS);
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// PASS 2: Create AO
+	if (!pipeline.aoProgram.empty() && !aoUpToDate(pipeline)) {
+		program = getProgram(pipeline.aoProgram);
+		glUseProgram(program);
+		glBindFramebuffer(GL_FRAMEBUFFER, fragDataFB_AO);
 
-	// create empty 3D texture
-	{
-	   glGenTextures(1, &texture);
-	   glBindTexture(GL_TEXTURE_3D, texture);
-	   glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	   glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	   glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	   glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	   glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		GLenum DrawBuffers[1] = { GL_COLOR_ATTACHMENT0 };
+		glDrawBuffers(1, DrawBuffers); // "1" is the size of DrawBuffers
+
+		// AO is computed at the resolution of the AO buffer
+		glViewport(0, 0, aoWidth, aoHeight);
+		glClearColor(1, 1, 1, 1);
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		// Always check that our framebuffer is ok
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			printf("++ERROR: GL_FRAMEBUFFER_COMPLETE false\n");
+			exit(1);
+		}
 
-	   // allocate memory for 3D texture
-	   glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, width, height, depth, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glUniform2f(glGetUniformLocation(program, "pixelSize"), 2.0f / width, 2.0f / height);
+		// one noise texel per AO pixel
+		glUniform2f(glGetUniformLocation(program, "noiseScale"), (float)aoWidth / NOISE_SIZE, (float)aoHeight / NOISE_SIZE);
+
+		glUniformMatrix4fv(glGetUniformLocation(program, "mvpMatrix"), 1, false, &camera.mvpMatrix[0][0]);
+		glUniformMatrix4fv(glGetUniformLocation(program, "invMvpMatrix"), 1, false, &invMvpMatrix[0][0]);
+		glUniformMatrix4fv(glGetUniformLocation(program, "pMatrix"), 1, false, &camera.pMatrix[0][0]);
+
+		glUniform1i(glGetUniformLocation(program, "uKernelSize"), uKernelSize);
+		glUniform3fv(glGetUniformLocation(program, "uKernelOffsets"), uKernelOffsets.size(), (const GLfloat*)uKernelOffsets.data());
+
+		glUniform1f(glGetUniformLocation(program, "uPower"), uPower);
+		glUniform1f(glGetUniformLocation(program, "uRadius"), uRadius);
+
+		profiler.beginGPU("ssao");
+		drawScreenQuad(program, aoScale);
+		profiler.endGPU();
+		glViewport(0, 0, width, height);
+
+		passCache.aoValid = true;
+		passCache.aoProgram = pipeline.aoProgram;
+		passCache.uRadius = uRadius;
+		passCache.uPower = uPower;
+		passCache.uKernelSize = uKernelSize;
+		passCache.aoScale = aoScale;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// PASS 3: Line / Blur
+	// Each post pass writes to its own color buffer of the target. The default framebuffer has only one,
+	// so only the first pass is drawn there.
+	glBindFramebuffer(GL_FRAMEBUFFER, backend->framebuffer());
+	int numPasses = (std::min)((int)pipeline.postPrograms.size(), backend->numColorBuffers());
+	for (int i = 0; i < numPasses; ++i) {
+		program = getProgram(pipeline.postPrograms[i]);
+		glUseProgram(program);
+
+		if (backend->framebuffer() != 0) {
+			glDrawBuffer(GL_COLOR_ATTACHMENT0 + i);
+		}
+		glClearColor(1, 1, 1, 1);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		glUniform2f(glGetUniformLocation(program, "pixelSize"), 1.0f / width, 1.0f / height);
+		glUniform1i(glGetUniformLocation(program, "flipY"), flipY ? 1 : 0);
+		glUniformMatrix4fv(glGetUniformLocation(program, "pMatrix"), 1, false, &camera.pMatrix[0][0]);
+		glUniformMatrix4fv(glGetUniformLocation(program, "invMvpMatrix"), 1, false, &invMvpMatrix[0][0]);
+
+		profiler.beginGPU(pipeline.postPrograms[i]);
+		drawScreenQuad(program, 1, flipY);
+		profiler.endGPU();
+	}
+	if (backend->framebuffer() != 0) {
+		glDrawBuffer(GL_COLOR_ATTACHMENT0);
 	}
+	glDepthFunc(GL_LEQUAL);
+}
+
+/**
+ * Draw the full screen quad of a post pass with the program in use.
+ * In the atlas mode, the quad is drawn once for each cell with the camera of the cell,
+ * clipped to the cell, so that the positions are reconstructed with the right matrix.
+ *
+ * @param program	program in use
+ * @param scale		the current framebuffer is 1/scale of the render target (e.g. the AO buffer)
+ * @param flipped	the vertex shader of the program writes the rows top-down (flipY)
+ */
+void RenderManager::drawScreenQuad(GLuint program, int scale, bool flipped) {
+	glBindVertexArray(secondPassVAO);
 
-	// copy image data to each layer of 3D texture
-	{
-		for (uint i = 0; i < pathes.size(); ++i) {
-			glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, (GLint)i, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, formatedImages[i].bits());
+	if (atlasCells.empty()) {
+		glDrawArrays(GL_QUADS, 0, 4);
+	}
+	else {
+		glEnable(GL_SCISSOR_TEST);
+		for (int i = 0; i < atlasCells.size(); ++i) {
+			const AtlasCell& cell = atlasCells[i];
+			// the cells are bottom-up, so they are mirrored when the rows are written top-down
+			int cellY = flipped ? gbufferHeight - cell.y - cell.height : cell.y;
+			int x0 = cell.x / scale;
+			int y0 = cellY / scale;
+			int x1 = (cell.x + cell.width + scale - 1) / scale;
+			int y1 = (cellY + cell.height + scale - 1) / scale;
+			glScissor(x0, y0, x1 - x0, y1 - y0);
+
+			glm::mat4 invMvpMatrix = glm::inverse(cell.mvpMatrix);
+			glUniformMatrix4fv(glGetUniformLocation(program, "mvpMatrix"), 1, false, &cell.mvpMatrix[0][0]);
+			glUniformMatrix4fv(glGetUniformLocation(program, "invMvpMatrix"), 1, false, &invMvpMatrix[0][0]);
+			glDrawArrays(GL_QUADS, 0, 4);
 		}
+		glDisable(GL_SCISSOR_TEST);
 	}
 
-	glGenerateMipmap(GL_TEXTURE_3D);
-	glBindTexture(GL_TEXTURE_3D, 0);
+	glBindVertexArray(0);
+}
+
+/**
+ * Start loading the texture on a worker thread.
+ * The texture is published by textureLoader.update() once it has been decoded.
+ */
+GLuint RenderManager::loadTexture(const QString& filename) {
+	return textureLoader.load2D(filename);
+}
 
-	return texture;
-}
\ No newline at end of file
+/**
+ * Start loading the 3D texture on worker threads.
+ * The texture is published by textureLoader.update() once all the layers have been decoded.
+ */
+GLuint RenderManager::load3DTexture(const std::vector<QString> & pathes) {
+	return textureLoader.load3D(pathes);
+}
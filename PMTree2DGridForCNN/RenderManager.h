@@ -8,8 +8,13 @@
 #include "GLUtils.h"
 #include <boost/shared_ptr.hpp>
 #include "Shader.h"
+#include "Profiler.h"
+#include "TextureLoader.h"
 #include <map>
 
+class Camera;
+class RenderBackend;
+
 class GeometryObject {
 public:
 	GLuint vao;
@@ -18,31 +23,135 @@ public:
 	bool lighting;
 	bool vaoCreated;
 	bool vaoOutdated;
+	glm::vec3 bbMin;	// bounding box of the vertices, updated in addVertices()
+	glm::vec3 bbMax;
 
 public:
 	GeometryObject();
 	GeometryObject(const std::vector<Vertex>& vertices, bool lighting = true);
 	void addVertices(const std::vector<Vertex>& vertices);
 	void createVAO();
+	bool empty() const { return vertices.empty(); }
+
+private:
+	void expandBounds(const Vertex* v, size_t num);
+};
+
+/**
+ * Source files and compile options of a program.
+ * Programs are compiled when they are used for the first time.
+ */
+class ProgramSource {
+public:
+	std::string vertex_file;
+	std::string fragment_file;
+	std::vector<QString> fragDataNames;
+	std::vector<std::string> defines;
+	std::map<std::string, int> samplers;	// texture unit of each sampler, set once when the program is created
+
+public:
+	ProgramSource() {}
+	ProgramSource(const std::string& vertex_file, const std::string& fragment_file, const std::vector<QString>& fragDataNames, const std::vector<std::string>& defines, const std::map<std::string, int>& samplers) : vertex_file(vertex_file), fragment_file(fragment_file), fragDataNames(fragDataNames), defines(defines), samplers(samplers) {}
+};
+
+/**
+ * Passes of one rendering mode.
+ * Each mode uses the shader variants that are specialized for it, and pass 1 writes only
+ * the G-buffer attachments that the later passes read.
+ */
+class RenderPipeline {
+public:
+	std::string gbufferProgram;			// pass 1
+	std::string aoProgram;				// AO pass (empty if the mode does not use AO)
+	std::vector<std::string> postPrograms;	// full screen passes that write to the render target (the i-th one to its i-th color buffer)
+	std::vector<GLenum> drawBuffers;	// G-buffer attachments that pass 1 writes
+	bool useShadow;						// pass 1 looks up the shadow map
+
+public:
+	RenderPipeline() : useShadow(false) {}
+};
+
+/**
+ * One cell of the atlas mode, in which several trees are rendered into one frame.
+ * The objects of the cell are moved to "offset" in the world, so that the trees do not
+ * overlap in the shadow map, and are drawn into the rectangle of the cell with their own
+ * camera. The rectangle is in pixels of the render target (bottom-up, as glScissor).
+ */
+class AtlasCell {
+public:
+	QString object_name;
+	int x;
+	int y;
+	int width;
+	int height;
+	glm::vec3 offset;
+	glm::mat4 mvpMatrix;	// from the world to the NDC of the whole render target
+
+public:
+	AtlasCell() : x(0), y(0), width(0), height(0) {}
+};
+
+/**
+ * Inputs of pass 1 and the AO pass of the last frame.
+ * A frame runs pass 1 again only if the G-buffer lacks an attachment that the current mode reads,
+ * or if it was rendered with other inputs, and the AO pass only if pass 1 or the AO parameters
+ * have changed. The post passes are cheap and always run.
+ */
+class PassCache {
+public:
+	bool gbufferValid;
+	glm::mat4 mvpMatrix;
+	glm::mat4 modelMatrix;
+	glm::vec3 light_dir;
+	std::vector<GLenum> drawBuffers;	// G-buffer attachments that pass 1 wrote
+	bool useShadow;
+	int shadowFilter;
+
+	bool aoValid;
+	std::string aoProgram;
+	float uRadius;
+	float uPower;
+	float uKernelSize;
+	int aoScale;
+
+public:
+	PassCache() : gbufferValid(false), useShadow(false), shadowFilter(0), aoValid(false), uRadius(0), uPower(0), uKernelSize(0), aoScale(0) {}
+	void invalidate() { gbufferValid = false; aoValid = false; }
 };
 
 class RenderManager {
 public:
-	static enum { RENDERING_MODE_BASIC = 0, RENDERING_MODE_SSAO, RENDERING_MODE_LINE, RENDERING_MODE_HATCHING, RENDERING_MODE_SKETCHY };
+	static enum { RENDERING_MODE_BASIC = 0, RENDERING_MODE_SSAO, RENDERING_MODE_LINE, RENDERING_MODE_HATCHING, RENDERING_MODE_SKETCHY, RENDERING_MODE_COMBINED };
 
 public:
 	Shader shader;
+	std::map<std::string, ProgramSource> programSources;
 	std::map<std::string, GLuint> programs;
+	std::map<int, RenderPipeline> pipelines;
 
 	QMap<QString, QMap<GLuint, GeometryObject> > objects;
 	QMap<QString, GLuint> textures;
+	TextureLoader textureLoader;
 
 	bool useShadow;
-	bool softShadow;
+	int shadowFilter;		// ShadowMapping::FILTER_HARD / FILTER_PCF4 / FILTER_PCF16
 	ShadowMapping shadow;
 	GLuint hatchingTextures;
 
 	int renderingMode;
+	bool flipY;				// the post pass writes the rows top-down (for the readback of the generated images)
+
+	// applied to all the objects in the vertex shaders of pass 1 and the shadow pass (see centerObjects())
+	glm::mat4 modelMatrix;
+
+	// atlas mode (empty: the whole scene is drawn with the camera of renderFrame())
+	std::vector<AtlasCell> atlasCells;
+
+	// per-pass GPU timers and CPU timers
+	Profiler profiler;
+
+	// inputs of the G-buffer and the AO buffer, to skip the passes whose inputs have not changed
+	PassCache passCache;
 
 	// SSAO
 	std::vector<QString> fragDataNamesP1;//Multi target fragmebuffer names P1
@@ -52,13 +161,18 @@ public:
 	GLuint fragDataFB;
 	GLuint fragAOTex;
 	GLuint fragDataFB_AO;
-	GLuint fragDepthTex_AO;
+	int gbufferWidth;	// size of the G-buffer, which follows the size of the render target
+	int gbufferHeight;
+	int aoScale;		// AO is computed at 1/aoScale of the window resolution (1, 2, or 4)
+	int aoWidth;
+	int aoHeight;
 	
 	// second pass
 	GLuint secondPassVBO;
 	GLuint secondPassVAO;
 	//void renderSecondPass();
 	// ssao
+	static const int NOISE_SIZE = 4;	// the noise texture is tiled every NOISE_SIZE x NOISE_SIZE AO pixels
 	float uRadius;
 	float uPower;
 	float uKernelSize;
@@ -69,21 +183,39 @@ public:
 	RenderManager();
 	~RenderManager();
 
-	void init(const std::string& vertex_file, const std::string& geometry_file, const std::string& fragment_file, bool useShadow, int shadowMapSize = 4096);
+	void init(const std::string& vertex_file, const std::string& geometry_file, const std::string& fragment_file, bool useShadow, int shadowQuality = ShadowMapping::QUALITY_MEDIUM);
+	void registerProgram(const std::string& name, const std::string& vertex_file, const std::string& fragment_file, const std::vector<QString>& fragDataNames = std::vector<QString>(), const std::vector<std::string>& defines = std::vector<std::string>(), const std::map<std::string, int>& samplers = std::map<std::string, int>());
+	GLuint getProgram(const std::string& name);
+	void buildPipelines();
+	const RenderPipeline& pipeline();
+	std::vector<std::string> requiredPrograms(int renderingMode);
+	void bindGBufferTextures();
 	
 	// ssao
 	void resize(int width,int height);
 	void resizeSsaoKernel();
+	void createNoiseTexture();
 
 	void addFaces(const std::vector<boost::shared_ptr<glutils::Face> >& faces);
 	void addObject(const QString& object_name, const QString& texture_file, const std::vector<Vertex>& vertices, bool lighting);
 	void removeObjects();
 	void removeObject(const QString& object_name);
 	void centerObjects();
+	bool objectBounds(const QString& object_name, glm::vec3& minPt, glm::vec3& maxPt);
+	bool sceneBounds(glm::vec3& minPt, glm::vec3& maxPt, bool applyModelMatrix = true);
+	void invalidateScene();
+	void setAtlas(const std::vector<AtlasCell>& cells);
+	void clearAtlas();
+	glm::mat4 cellModelMatrix(const AtlasCell& cell);
 	void renderAll();
 	void renderAllExcept(const QString& object_name);
 	void render(const QString& object_name);
-	void updateShadowMap(GLWidget3D* glWidget3D, const glm::vec3& light_dir, const glm::mat4& light_mvpMatrix);
+	void drawScene();
+	void updateShadowMap();
+	bool gbufferUpToDate(const RenderPipeline& pipeline, const Camera& camera, const glm::vec3& light_dir);
+	bool aoUpToDate(const RenderPipeline& pipeline);
+	void renderFrame(Camera& camera, const glm::vec3& light_dir, RenderBackend* backend);
+	void drawScreenQuad(GLuint program, int scale = 1, bool flipped = false);
 	
 
 private:
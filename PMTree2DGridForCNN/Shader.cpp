@@ -3,13 +3,18 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <cstring>
 #include <QFile>
+#include <QSaveFile>
+#include <QDir>
 #include <QTextStream>
+#include <QCryptographicHash>
 
 using namespace std;
 
 Shader::Shader() {
-
+	useCache = true;
+	cacheDir = "shader_cache";
 }
 
 Shader::~Shader() {
@@ -29,16 +34,49 @@ uint Shader::createProgram(const string& vertex_file, const string& fragment_fil
 }
 
 uint Shader::createProgram(const string& vertex_file, const string& fragment_file, const std::vector<QString>& fragDataNamesP1) {
-	std::cout << "Compiling " << vertex_file << std::endl;
+	return createProgram(vertex_file, fragment_file, fragDataNamesP1, std::vector<std::string>());
+}
 
-	std::string source;
-	loadTextFile(vertex_file, source);
-	GLuint vertex_shader = compileShader(source, GL_VERTEX_SHADER);
+/**
+ * 指定されたvertex shader、fragment shaderを読み込んでコンパイルし、
+ * プログラムにリンクする。
+ * 同じソース、defines、ドライバでリンク済みのprogram binaryがキャッシュにあれば、
+ * コンパイルせずにそれを使用する。
+ *
+ * @param vertex_file		vertex shader file
+ * @param fragment_file		frament shader file
+ * @param fragDataNamesP1	names of the fragment outputs
+ * @param defines			macros that are defined at the top of both shaders (e.g. "USE_HATCHING" or "NUM_SAMPLES 16")
+ * @return					program id
+ */
+uint Shader::createProgram(const string& vertex_file, const string& fragment_file, const std::vector<QString>& fragDataNamesP1, const std::vector<std::string>& defines) {
+	std::string vertex_source;
+	loadTextFile(vertex_file, vertex_source);
+	insertDefines(defines, vertex_source);
 
-	std::cout << "Compiling " << fragment_file << std::endl;
+	std::string fragment_source;
+	loadTextFile(fragment_file, fragment_source);
+	insertDefines(defines, fragment_source);
+
+	QString cacheFile;
+	if (useCache) {
+		cacheFile = cacheFileName(vertex_source, fragment_source, fragDataNamesP1, defines);
+		GLuint program = loadProgramBinary(cacheFile);
+		if (program != 0) {
+			std::cout << "Loaded " << vertex_file << ", " << fragment_file << " from the program cache" << std::endl;
+
+			programs.push_back(program);
+			vertex_shaders.push_back(0);
+			fragment_shaders.push_back(0);
+			return program;
+		}
+	}
+
+	std::cout << "Compiling " << vertex_file << std::endl;
+	GLuint vertex_shader = compileShader(vertex_source, GL_VERTEX_SHADER);
 
-	loadTextFile(fragment_file, source);
-	GLuint fragment_shader = compileShader(source, GL_FRAGMENT_SHADER);
+	std::cout << "Compiling " << fragment_file << std::endl;
+	GLuint fragment_shader = compileShader(fragment_source, GL_FRAGMENT_SHADER);
 
 	// create program
 	GLuint program = glCreateProgram();
@@ -51,6 +89,9 @@ uint Shader::createProgram(const string& vertex_file, const string& fragment_fil
 			glBindFragDataLocation(program, i, fragDataNamesP1[i].toUtf8().constData());
 		}
 	}
+	if (useCache) {
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
 	glLinkProgram(program);
 	
 	GLint status;
@@ -69,6 +110,10 @@ uint Shader::createProgram(const string& vertex_file, const string& fragment_fil
 		throw runtime_error(ss.str());
 	}
 	
+	if (useCache) {
+		saveProgramBinary(program, cacheFile);
+	}
+	
 	programs.push_back(program);
 	vertex_shaders.push_back(vertex_shader);
 	fragment_shaders.push_back(fragment_shader);
@@ -76,12 +121,19 @@ uint Shader::createProgram(const string& vertex_file, const string& fragment_fil
 	return program;
 }
 
+void Shader::setCacheDirectory(const QString& dir) {
+	cacheDir = dir;
+}
+
 void Shader::cleanShaders() {
 	for (int pN = 0; pN<programs.size(); pN++){
-		glDetachShader(programs[pN], vertex_shaders[pN]);
-		glDetachShader(programs[pN], fragment_shaders[pN]);
-		glDeleteShader(vertex_shaders[pN]);
-		glDeleteShader(fragment_shaders[pN]);
+		// programs loaded from the cache have no shader objects
+		if (vertex_shaders[pN] != 0) {
+			glDetachShader(programs[pN], vertex_shaders[pN]);
+			glDetachShader(programs[pN], fragment_shaders[pN]);
+			glDeleteShader(vertex_shaders[pN]);
+			glDeleteShader(fragment_shaders[pN]);
+		}
 		glDeleteProgram(programs[pN]);
 	}
 	programs.clear();
@@ -131,6 +183,113 @@ void Shader::loadTextFile(const string& filename, string& str) {
 	str = std::string(text.toUtf8().constData());
 }
 
+/**
+ * Insert "#define" lines right after the "#version" line.
+ *
+ * @param defines			macros to define
+ * @param source [IN/OUT]	shader text
+ */
+void Shader::insertDefines(const std::vector<std::string>& defines, std::string& source) {
+	if (defines.size() == 0) return;
+
+	std::stringstream ss;
+	for (int i = 0; i < defines.size(); ++i) {
+		ss << "#define " << defines[i] << "\n";
+	}
+
+	// #version must be the first directive of the shader
+	size_t pos = 0;
+	if (source.compare(0, 8, "#version") == 0) {
+		pos = source.find('\n');
+		pos = (pos == std::string::npos) ? source.size() : pos + 1;
+	}
+	source.insert(pos, ss.str());
+}
+
+/**
+ * Return the cache file name of the program.
+ * The key includes everything that changes the linked binary: the shader sources
+ * (with the defines inserted), the fragment output names, and the driver.
+ */
+QString Shader::cacheFileName(const std::string& vertex_source, const std::string& fragment_source, const std::vector<QString>& fragDataNamesP1, const std::vector<std::string>& defines) {
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	hash.addData(vertex_source.c_str(), vertex_source.size() + 1);
+	hash.addData(fragment_source.c_str(), fragment_source.size() + 1);
+	for (int i = 0; i < fragDataNamesP1.size(); ++i) {
+		hash.addData(fragDataNamesP1[i].toUtf8());
+		hash.addData("\n", 1);
+	}
+	for (int i = 0; i < defines.size(); ++i) {
+		hash.addData(defines[i].c_str(), defines[i].size() + 1);
+	}
+
+	GLenum driverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION };
+	for (int i = 0; i < 4; ++i) {
+		const char* str = (const char*)glGetString(driverStrings[i]);
+		if (str != NULL) hash.addData(str, strlen(str) + 1);
+	}
+
+	return cacheDir + "/" + QString(hash.result().toHex()) + ".bin";
+}
+
+/**
+ * Create a program from the cached binary.
+ *
+ * @param filename	cache file
+ * @return			program id, or 0 if the cache does not exist or the driver rejects it
+ */
+GLuint Shader::loadProgramBinary(const QString& filename) {
+	QFile file(filename);
+	if (!file.open(QIODevice::ReadOnly)) return 0;
+	QByteArray data = file.readAll();
+	file.close();
+
+	// header: "PMSB" + binary format
+	if (data.size() <= 8 || strncmp(data.constData(), "PMSB", 4) != 0) return 0;
+	GLenum format;
+	memcpy(&format, data.constData() + 4, sizeof(GLenum));
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, format, data.constData() + 8, data.size() - 8);
+
+	GLint status;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (status == GL_FALSE) {
+		// the driver was updated or the binary is broken, so compile the shaders again
+		glDeleteProgram(program);
+		QFile::remove(filename);
+		return 0;
+	}
+
+	return program;
+}
+
+/**
+ * Store the linked program binary to the cache.
+ */
+void Shader::saveProgramBinary(GLuint program, const QString& filename) {
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) return;	// the driver does not support program binaries
+
+	std::vector<char> binary(length);
+	GLenum format;
+	glGetProgramBinary(program, length, NULL, &format, binary.data());
+
+	QDir().mkpath(cacheDir);
+
+	// write to a temporary file and rename it, so that other worker processes never read a partial file
+	QSaveFile file(filename);
+	if (!file.open(QIODevice::WriteOnly)) {
+		std::cout << "Could not write the program cache: " << filename.toUtf8().constData() << std::endl;
+		return;
+	}
+	file.write("PMSB", 4);
+	file.write((const char*)&format, sizeof(GLenum));
+	file.write(binary.data(), binary.size());
+	file.commit();
+}
+
 /**
  * compile a shader.
  *
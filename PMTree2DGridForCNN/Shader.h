@@ -11,12 +11,22 @@ public:
 
 	uint createProgram(const std::string& vertex_file, const std::string& fragment_file);
 	uint createProgram(const std::string& vertex_file, const std::string& fragment_file, const std::vector<QString>& fragDataNamesP1);
+	uint createProgram(const std::string& vertex_file, const std::string& fragment_file, const std::vector<QString>& fragDataNamesP1, const std::vector<std::string>& defines);
+	void setCacheDirectory(const QString& dir);
 	void cleanShaders();
 
 private:
 	void loadTextFile(const std::string& filename, std::string& str);
+	void insertDefines(const std::vector<std::string>& defines, std::string& source);
 	GLuint compileShader(const std::string& source, GLuint mode);
-	
+	QString cacheFileName(const std::string& vertex_source, const std::string& fragment_source, const std::vector<QString>& fragDataNamesP1, const std::vector<std::string>& defines);
+	GLuint loadProgramBinary(const QString& filename);
+	void saveProgramBinary(GLuint program, const QString& filename);
+
+public:
+	bool useCache;		// store the linked programs to disk and reuse them in the next launch
+	QString cacheDir;
+
 private:
 	std::vector<GLuint> programs;
 	std::vector<GLuint> vertex_shaders;
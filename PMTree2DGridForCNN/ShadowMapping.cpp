@@ -1,29 +1,114 @@
 ﻿#include "ShadowMapping.h"
-#include "GLWidget3D.h"
+#include "RenderManager.h"
 #include <glm/gtc/matrix_transform.hpp>
 #include <iostream>
+#include <limits>
+#include <algorithm>
 
 #ifndef M_PI
 #define M_PI	3.1415926535
 #endif
 
 ShadowMapping::ShadowMapping() {
+	programId = 0;
+	fboDepth = 0;
+	textureDepth = 0;
+	width = 2048;
+	height = 2048;
+	allocatedWidth = 0;
+	allocatedHeight = 0;
+	light_dir = glm::vec3(0, -1, 0);
+	dirty = true;
+}
+
+ShadowMapping::~ShadowMapping() {
+	if (textureDepth != 0) {
+		glDeleteTextures(1, &textureDepth);
+		glDeleteFramebuffers(1, &fboDepth);
+	}
 }
 
 /**
  * シャドウマッピングの初期化。
- * 本関数は、GLWidget3D::initializeGL()内で呼び出すこと。
+ * 本関数は、RenderManager::init()内で呼び出される。
+ * シャドウマップのメモリは、最初にupdate()が呼ばれた時に確保する。
  *
  * @param programId		シェイダーのprogram id
- * @param width			シャドウマッピングの幅
- * @param height		シャドウマッピングの高さ
+ * @param quality		QUALITY_LOW / QUALITY_MEDIUM / QUALITY_HIGH
  */
-void ShadowMapping::init(int programId, int width, int height) {
+void ShadowMapping::init(int programId, int quality) {
 	this->programId = programId;
-	this->width = width;
-	this->height = height;
+	setQuality(quality);
+}
 
-	glUseProgram(programId);
+/**
+ * Set the size of the shadow map.
+ * Since the light frustum is fitted to the scene, a small map is enough for a single tree.
+ */
+void ShadowMapping::setQuality(int quality) {
+	if (quality == QUALITY_LOW) {
+		width = height = 1024;
+	}
+	else if (quality == QUALITY_HIGH) {
+		width = height = 4096;
+	}
+	else {
+		width = height = 2048;
+	}
+	dirty = true;
+}
+
+/**
+ * Set the direction of the light.
+ * The light frustum is fitted again in the next fitToBounds().
+ *
+ * @param light_dir		光の進行方向
+ */
+void ShadowMapping::setLightDir(const glm::vec3& light_dir) {
+	this->light_dir = glm::normalize(light_dir);
+	dirty = true;
+}
+
+/**
+ * Fit the orthographic light frustum to the bounding box of the scene.
+ *
+ * @param minPt		bounding box of the scene
+ * @param maxPt		bounding box of the scene
+ */
+void ShadowMapping::fitToBounds(const glm::vec3& minPt, const glm::vec3& maxPt) {
+	glm::vec3 center = (minPt + maxPt) * 0.5f;
+	float radius = (std::max)(glm::length(maxPt - minPt) * 0.5f, 0.01f);
+
+	glm::vec3 up = fabs(light_dir.y) > 0.99f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+	glm::mat4 light_mvMatrix = glm::lookAt(center - light_dir * radius * 2.0f, center, up);
+
+	// bounding box in the light coordinates
+	glm::vec3 lightMin((std::numeric_limits<float>::max)());
+	glm::vec3 lightMax(-(std::numeric_limits<float>::max)());
+	for (int i = 0; i < 8; ++i) {
+		glm::vec3 corner(i & 1 ? maxPt.x : minPt.x, i & 2 ? maxPt.y : minPt.y, i & 4 ? maxPt.z : minPt.z);
+		glm::vec3 p = glm::vec3(light_mvMatrix * glm::vec4(corner, 1.0f));
+		lightMin = glm::min(lightMin, p);
+		lightMax = glm::max(lightMax, p);
+	}
+
+	// a few texels of margin so that the filter taps at the border stay inside the map
+	float margin = (std::max)(lightMax.x - lightMin.x, lightMax.y - lightMin.y) * 4.0f / width;
+	glm::mat4 light_pMatrix = glm::ortho(lightMin.x - margin, lightMax.x + margin, lightMin.y - margin, lightMax.y + margin, -lightMax.z - margin, -lightMin.z + margin);
+	light_mvpMatrix = light_pMatrix * light_mvMatrix;
+	dirty = true;
+}
+
+/**
+ * Allocate the shadow map of the current size.
+ */
+void ShadowMapping::allocate() {
+	if (textureDepth != 0 && allocatedWidth == width && allocatedHeight == height) return;
+
+	if (textureDepth != 0) {
+		glDeleteTextures(1, &textureDepth);
+		glDeleteFramebuffers(1, &fboDepth);
+	}
 			
 	// FBO作成
 	glGenFramebuffers(1, &fboDepth);
@@ -38,10 +123,13 @@ void ShadowMapping::init(int programId, int width, int height) {
 	glBindTexture(GL_TEXTURE_2D, textureDepth);
 
 	// テクスチャパラメータの設定
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);	// テクスチャの外側、つまり、光源の外側は、影ってことにする(?)
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);	// ただ、そもそも光源の外にならないよう、projection行列を設定すべき！
+	// sampler2DShadowでデプスを比較し、GL_LINEARで2x2のPCFをハードウェアで行う
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);	// 光源の視錐台はシーンに合わせてあるので、外側はサンプルされない
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 		
     // テクスチャ領域の確保(GL_DEPTH_COMPONENTを用いる)
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
@@ -54,17 +142,25 @@ void ShadowMapping::init(int programId, int width, int height) {
 	glActiveTexture(GL_TEXTURE0);
 		
 	glBindFramebuffer(GL_FRAMEBUFFER,0);
+
+	allocatedWidth = width;
+	allocatedHeight = height;
 }
 
 /**
  * シャドウマップを作成し、GL_TEXTURE6にテクスチャとして保存する。
+ * ジオメトリ、または光源が変わっていない場合は、何もしない。
  *
- * @param glWidget3D		GLWidget3Dクラス。このクラスのdrawScene(1)を呼び出してシーンを描画し、シャドウマップを生成する。
- * @param light_dir			光の進行方向
+ * @param renderManager	RenderManagerクラス。このクラスのdrawScene()を呼び出してシーンを描画し、シャドウマップを生成する。
  */
-void ShadowMapping::update(GLWidget3D* glWidget3D, const glm::vec3& light_dir, const glm::mat4& light_mvpMatrix) {
-	int origWidth = glWidget3D->width();
-	int origHeigh = glWidget3D->height();
+void ShadowMapping::update(RenderManager* renderManager) {
+	if (!dirty) return;
+
+	allocate();
+
+	// 描画先はウィジェットとは限らないので、現在のビューポートを保存しておく
+	GLint origViewport[4];
+	glGetIntegerv(GL_VIEWPORT, origViewport);
 				
 	glUseProgram(programId);
 
@@ -82,9 +178,6 @@ void ShadowMapping::update(GLWidget3D* glWidget3D, const glm::vec3& light_dir, c
 	// シャドウマップ用のmodel/view/projection行列を設定
 	glUniformMatrix4fv(glGetUniformLocation(programId, "light_mvpMatrix"), 1, GL_FALSE, &light_mvpMatrix[0][0]);
 
-	// 光の方向を設定
-	//glUniform3f(glGetUniformLocation(programId, "lightDir"), light_dir.x, light_dir.y, light_dir.z);
-
 	// 色バッファには描画しない
 	glDrawBuffer(GL_NONE);
 
@@ -94,15 +187,16 @@ void ShadowMapping::update(GLWidget3D* glWidget3D, const glm::vec3& light_dir, c
 	glDepthFunc(GL_LEQUAL);
 
 	//RENDER
-	glWidget3D->drawScene();
+	renderManager->drawScene();
 	
 	// この時点で、textureDepthにデプス情報が格納されている
 	
 	glBindFramebuffer(GL_FRAMEBUFFER,0);
 	glDisable(GL_TEXTURE_2D);
 	glDisable(GL_POLYGON_OFFSET_FILL);
-	glDrawBuffer(GL_BACK);
 
 	// ビューポートを戻す
-	glViewport(0, 0, origWidth, origHeigh);
+	glViewport(origViewport[0], origViewport[1], origViewport[2], origViewport[3]);
+
+	dirty = false;
 }
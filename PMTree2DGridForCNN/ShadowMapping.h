@@ -4,9 +4,18 @@
 #include <QGLWidget>
 #include <glm/glm.hpp>
 
-class GLWidget3D;
+class RenderManager;
 
+/**
+ * Shadow map of a directional light.
+ * The light frustum is fitted to the bounding box of the scene, and the map is allocated
+ * and rendered only when a rendering mode that uses shadows needs it.
+ */
 class ShadowMapping {
+public:
+	enum { QUALITY_LOW = 0, QUALITY_MEDIUM, QUALITY_HIGH };
+	enum { FILTER_HARD = 0, FILTER_PCF4, FILTER_PCF16 };
+
 public:
 	int width;
 	int height;
@@ -16,12 +25,25 @@ public:
 	uint fboDepth;
 	uint textureDepth;
 
-public:
-	ShadowMapping();
+	glm::vec3 light_dir;
+	glm::mat4 light_mvpMatrix;
+	bool dirty;				// the map has to be rendered again (geometry or light changed)
 
-	void init(int programId, int width, int height);
-	void update(GLWidget3D* glWidget3D, const glm::vec3& light_dir, const glm::mat4& light_mvpMatrix);
-};
+private:
+	int allocatedWidth;
+	int allocatedHeight;
 
+public:
+	ShadowMapping();
+	~ShadowMapping();
 
+	void init(int programId, int quality);
+	void setQuality(int quality);
+	void setLightDir(const glm::vec3& light_dir);
+	void fitToBounds(const glm::vec3& minPt, const glm::vec3& maxPt);
+	void invalidate() { dirty = true; }
+	void update(RenderManager* renderManager);
 
+private:
+	void allocate();
+};
@@ -0,0 +1,513 @@
+#include "SoftwareRasterizer.h"
+#include "RenderManager.h"
+#include "Camera.h"
+#include "PatchClassifier.h"
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#define SOFTWARERASTERIZER_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace {
+	// triangles of a contiguous range of the submission order, and the tiles they overlap
+	struct TriangleChunk {
+		std::vector<SoftwareRasterizer::Triangle> triangles;
+		std::vector<std::pair<int, int> > entries;	// (tile, index in triangles)
+	};
+
+	const unsigned int PIXEL_WHITE = 0xffffffff;
+	const unsigned int PIXEL_BLACK = 0xff000000;
+}
+
+SoftwareRasterizer::SoftwareRasterizer() {
+	numThreads = 0;
+	width = 0;
+	height = 0;
+	stride = 0;
+	tileCols = 0;
+	tileRows = 0;
+}
+
+/**
+ * Render the objects of the render manager, and compute the class color image and the line image.
+ * The atlas of the render manager is not supported.
+ *
+ * @param renderManager		objects and model matrix
+ * @param camera			camera (mvpMatrix and pMatrix are used)
+ * @param width				image width
+ * @param height			image height
+ * @param colorImage [OUT]	class color image (BGRA, top-down)
+ * @param lineImage [OUT]	line image (BGRA, top-down)
+ */
+void SoftwareRasterizer::render(RenderManager* renderManager, const Camera& camera, int width, int height, cv::Mat& colorImage, cv::Mat& lineImage) {
+	resize(width, height);
+	setupTriangles(renderManager, camera);
+
+	parallelFor(tileCols * tileRows, numThreads, [this](int tile) { rasterizeTile(tile); });
+	fillBorder();
+
+	colorImage.create(height, width, CV_8UC4);
+	lineImage.create(height, width, CV_8UC4);
+	glm::mat4 pMatrix = camera.pMatrix;
+	parallelFor(tileRows, numThreads, [&](int band) {
+		int rowBegin = band * TILE_SIZE;
+		int rowEnd = (std::min)(rowBegin + TILE_SIZE, height);
+		writeColorRows(rowBegin, rowEnd, colorImage);
+		detectEdgeRows(rowBegin, rowEnd, pMatrix, lineImage);
+	});
+}
+
+/**
+ * Compare two line images, and return the ratio of the line pixels that have no line pixel
+ * of the other image within the tolerance.
+ *
+ * @param image1		line image (BGRA)
+ * @param image2		line image (BGRA)
+ * @param tolerance		radius in pixels
+ * @return				mismatch ratio [0, 1]
+ */
+double SoftwareRasterizer::compareLines(const cv::Mat& image1, const cv::Mat& image2, int tolerance) {
+	cv::Mat blue1, blue2;
+	cv::extractChannel(image1, blue1, 0);
+	cv::extractChannel(image2, blue2, 0);
+	cv::Mat lines1 = blue1 < 128;
+	cv::Mat lines2 = blue2 < 128;
+
+	cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(tolerance * 2 + 1, tolerance * 2 + 1));
+	cv::Mat near1, near2;
+	cv::dilate(lines1, near1, kernel);
+	cv::dilate(lines2, near2, kernel);
+
+	int total = cv::countNonZero(lines1) + cv::countNonZero(lines2);
+	if (total == 0) return 0.0;
+
+	cv::Mat miss1 = lines1 & ~near2;
+	cv::Mat miss2 = lines2 & ~near1;
+	return (double)(cv::countNonZero(miss1) + cv::countNonZero(miss2)) / total;
+}
+
+/**
+ * Compare the classes of two color images (the rendered image or the class color image), and
+ * return the ratio of the tree pixels that have no pixel of the same class in the other image
+ * within the tolerance. The pixels are classified in the same way as the patches.
+ *
+ * @param image1		color image (BGRA)
+ * @param image2		color image (BGRA)
+ * @param tolerance		radius in pixels
+ * @return				mismatch ratio [0, 1]
+ */
+double SoftwareRasterizer::compareClasses(const cv::Mat& image1, const cv::Mat& image2, int tolerance) {
+	cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(tolerance * 2 + 1, tolerance * 2 + 1));
+
+	int total = 0;
+	int miss = 0;
+	for (int cls = CLASS_TRUNK; cls <= CLASS_LEAF; ++cls) {
+		cv::Mat mask1 = classMask(image1, cls);
+		cv::Mat mask2 = classMask(image2, cls);
+		cv::Mat near1, near2;
+		cv::dilate(mask1, near1, kernel);
+		cv::dilate(mask2, near2, kernel);
+
+		cv::Mat miss1 = mask1 & ~near2;
+		cv::Mat miss2 = mask2 & ~near1;
+		total += cv::countNonZero(mask1) + cv::countNonZero(mask2);
+		miss += cv::countNonZero(miss1) + cv::countNonZero(miss2);
+	}
+
+	return total > 0 ? (double)miss / total : 0.0;
+}
+
+void SoftwareRasterizer::resize(int width, int height) {
+	if (width == this->width && height == this->height) return;
+
+	this->width = width;
+	this->height = height;
+	stride = width + 2;
+	tileCols = (width + TILE_SIZE - 1) / TILE_SIZE;
+	tileRows = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+	size_t size = (size_t)stride * (height + 2);
+	depth.resize(size);
+	normalX.resize(size);
+	normalY.resize(size);
+	normalZ.resize(size);
+	posX.resize(size);
+	posY.resize(size);
+	posZ.resize(size);
+	classes.resize(size);
+}
+
+/**
+ * Transform the vertices, and bin the triangles into the tiles.
+ * The triangles are set up in parallel in chunks of the submission order, and the bins are
+ * concatenated in the chunk order, so that each tile sees its triangles in the same order as
+ * the GL path draws them.
+ * The tree is always in front of the camera, so the triangles that cross the near plane are
+ * dropped instead of being clipped.
+ */
+void SoftwareRasterizer::setupTriangles(RenderManager* renderManager, const Camera& camera) {
+	std::vector<const Vertex*> sources;
+	for (auto it = renderManager->objects.constBegin(); it != renderManager->objects.constEnd(); ++it) {
+		for (auto it2 = it.value().constBegin(); it2 != it.value().constEnd(); ++it2) {
+			const std::vector<Vertex>& vertices = it2.value().vertices;
+			for (size_t i = 0; i + 2 < vertices.size(); i += 3) {
+				sources.push_back(&vertices[i]);
+			}
+		}
+	}
+
+	glm::mat4 modelMatrix = renderManager->modelMatrix;
+	glm::mat4 mvpMatrix = camera.mvpMatrix * modelMatrix;
+
+	int numChunks = (std::min)((int)sources.size(), (int)(std::max)(1u, std::thread::hardware_concurrency()) * 4);
+	std::vector<TriangleChunk> chunks(numChunks);
+	parallelFor(numChunks, numThreads, [&](int c) {
+		size_t begin = sources.size() * c / numChunks;
+		size_t end = sources.size() * (c + 1) / numChunks;
+		TriangleChunk& chunk = chunks[c];
+		chunk.triangles.reserve(end - begin);
+
+		for (size_t i = begin; i < end; ++i) {
+			const Vertex* v = sources[i];
+
+			glm::vec4 clip[3];
+			bool visible = true;
+			for (int k = 0; k < 3; ++k) {
+				clip[k] = mvpMatrix * glm::vec4(v[k].position, 1.0f);
+				if (clip[k].w <= 0.0f || clip[k].z < -clip[k].w) visible = false;
+			}
+			if (!visible) continue;
+
+			Triangle tri;
+			float minX = (std::numeric_limits<float>::max)(), minY = minX, minZ = minX;
+			float maxX = -minX, maxY = -minX;
+			for (int k = 0; k < 3; ++k) {
+				float invW = 1.0f / clip[k].w;
+				tri.x[k] = (clip[k].x * invW * 0.5f + 0.5f) * width;
+				tri.y[k] = (clip[k].y * invW * 0.5f + 0.5f) * height;
+				tri.z[k] = clip[k].z * invW * 0.5f + 0.5f;
+				tri.invW[k] = invW;
+				tri.normal[k] = v[k].normal;
+				tri.position[k] = glm::vec3(modelMatrix * glm::vec4(v[k].position, 1.0f));
+				minX = (std::min)(minX, tri.x[k]);
+				maxX = (std::max)(maxX, tri.x[k]);
+				minY = (std::min)(minY, tri.y[k]);
+				maxY = (std::max)(maxY, tri.y[k]);
+				minZ = (std::min)(minZ, tri.z[k]);
+			}
+			if (minZ > 1.0f) continue;
+
+			// pixels whose centers can be covered
+			tri.minX = (std::max)(0, (int)std::ceil(minX - 0.5f));
+			tri.maxX = (std::min)(width - 1, (int)std::floor(maxX - 0.5f));
+			tri.minY = (std::max)(0, (int)std::ceil(minY - 0.5f));
+			tri.maxY = (std::min)(height - 1, (int)std::floor(maxY - 0.5f));
+			if (tri.minX > tri.maxX || tri.minY > tri.maxY) continue;
+
+			tri.cls = classify(v[0].color);
+
+			int index = chunk.triangles.size();
+			chunk.triangles.push_back(tri);
+			for (int ty = tri.minY / TILE_SIZE; ty <= tri.maxY / TILE_SIZE; ++ty) {
+				for (int tx = tri.minX / TILE_SIZE; tx <= tri.maxX / TILE_SIZE; ++tx) {
+					chunk.entries.push_back(std::make_pair(ty * tileCols + tx, index));
+				}
+			}
+		}
+	});
+
+	triangles.clear();
+	bins.resize(tileCols * tileRows);
+	for (int i = 0; i < bins.size(); ++i) {
+		bins[i].clear();
+	}
+	for (int c = 0; c < numChunks; ++c) {
+		int offset = triangles.size();
+		triangles.insert(triangles.end(), chunks[c].triangles.begin(), chunks[c].triangles.end());
+		for (int i = 0; i < chunks[c].entries.size(); ++i) {
+			bins[chunks[c].entries[i].first].push_back(offset + chunks[c].entries[i].second);
+		}
+	}
+}
+
+/**
+ * Clear the pixels of the tile, and rasterize the triangles of its bin.
+ * The coverage follows the top-left rule and the depth test is LEQUAL, as in the GL path.
+ * The triangles are drawn from both sides.
+ */
+void SoftwareRasterizer::rasterizeTile(int tile) {
+	int tileX0 = (tile % tileCols) * TILE_SIZE;
+	int tileY0 = (tile / tileCols) * TILE_SIZE;
+	int tileX1 = (std::min)(tileX0 + TILE_SIZE, width) - 1;
+	int tileY1 = (std::min)(tileY0 + TILE_SIZE, height) - 1;
+
+	// the background is what the line shader sees in the cleared G-buffer:
+	// the clear color (1, 1) of the normal texture decodes to (0, 0, -1)
+	for (int y = tileY0; y <= tileY1; ++y) {
+		int row = (y + 1) * stride + 1;
+		std::fill(depth.begin() + row + tileX0, depth.begin() + row + tileX1 + 1, 1.0f);
+		std::fill(normalX.begin() + row + tileX0, normalX.begin() + row + tileX1 + 1, 0.0f);
+		std::fill(normalY.begin() + row + tileX0, normalY.begin() + row + tileX1 + 1, 0.0f);
+		std::fill(normalZ.begin() + row + tileX0, normalZ.begin() + row + tileX1 + 1, -1.0f);
+		std::fill(posX.begin() + row + tileX0, posX.begin() + row + tileX1 + 1, 0.0f);
+		std::fill(posY.begin() + row + tileX0, posY.begin() + row + tileX1 + 1, 0.0f);
+		std::fill(posZ.begin() + row + tileX0, posZ.begin() + row + tileX1 + 1, 0.0f);
+		std::fill(classes.begin() + row + tileX0, classes.begin() + row + tileX1 + 1, (unsigned char)CLASS_BACKGROUND);
+	}
+
+	const std::vector<int>& bin = bins[tile];
+	for (int b = 0; b < bin.size(); ++b) {
+		const Triangle& tri = triangles[bin[b]];
+
+		// counter-clockwise order
+		int i0 = 0, i1 = 1, i2 = 2;
+		float area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.x[2] - tri.x[0]) * (tri.y[1] - tri.y[0]);
+		if (area == 0.0f) continue;
+		if (area < 0.0f) {
+			std::swap(i1, i2);
+			area = -area;
+		}
+		int idx[3] = { i0, i1, i2 };
+
+		// edge function of the edge opposite to each vertex: e = a * x + b * y + c
+		float a[3], bb[3], c[3];
+		bool topLeft[3];
+		for (int k = 0; k < 3; ++k) {
+			int from = idx[(k + 1) % 3];
+			int to = idx[(k + 2) % 3];
+			float dx = tri.x[to] - tri.x[from];
+			float dy = tri.y[to] - tri.y[from];
+			a[k] = -dy;
+			bb[k] = dx;
+			c[k] = dy * tri.x[from] - dx * tri.y[from];
+			topLeft[k] = dy < 0.0f || (dy == 0.0f && dx < 0.0f);
+		}
+
+		int x0 = (std::max)(tri.minX, tileX0);
+		int x1 = (std::min)(tri.maxX, tileX1);
+		int y0 = (std::max)(tri.minY, tileY0);
+		int y1 = (std::min)(tri.maxY, tileY1);
+		float invArea = 1.0f / area;
+
+		for (int y = y0; y <= y1; ++y) {
+			float py = y + 0.5f;
+			int row = (y + 1) * stride + 1;
+			for (int x = x0; x <= x1; ++x) {
+				float px = x + 0.5f;
+				float e[3];
+				bool inside = true;
+				for (int k = 0; k < 3; ++k) {
+					e[k] = a[k] * px + bb[k] * py + c[k];
+					if (e[k] < 0.0f || (e[k] == 0.0f && !topLeft[k])) inside = false;
+				}
+				if (!inside) continue;
+
+				float w0 = e[0] * invArea;
+				float w1 = e[1] * invArea;
+				float w2 = e[2] * invArea;
+				float z = w0 * tri.z[i0] + w1 * tri.z[i1] + w2 * tri.z[i2];
+				int i = row + x;
+				if (z < 0.0f || z > 1.0f || z > depth[i]) continue;
+
+				// perspective correct weights
+				float q0 = w0 * tri.invW[i0];
+				float q1 = w1 * tri.invW[i1];
+				float q2 = w2 * tri.invW[i2];
+				float s = 1.0f / (q0 + q1 + q2);
+				q0 *= s;
+				q1 *= s;
+				q2 *= s;
+
+				glm::vec3 normal = tri.normal[i0] * q0 + tri.normal[i1] * q1 + tri.normal[i2] * q2;
+				float l = glm::length(normal);
+				normal = l > 1e-6f ? normal / l : glm::vec3(0, 0, 1);
+				glm::vec3 position = tri.position[i0] * q0 + tri.position[i1] * q1 + tri.position[i2] * q2;
+
+				depth[i] = z;
+				normalX[i] = normal.x;
+				normalY[i] = normal.y;
+				normalZ[i] = normal.z;
+				posX[i] = position.x;
+				posY[i] = position.y;
+				posZ[i] = position.z;
+				classes[i] = tri.cls;
+			}
+		}
+	}
+}
+
+/**
+ * Replicate the edge pixels into the border, like GL_CLAMP_TO_EDGE for the post pass.
+ */
+void SoftwareRasterizer::fillBorder() {
+	std::vector<float>* planes[] = { &depth, &normalX, &normalY, &normalZ, &posX, &posY, &posZ };
+	for (int p = 0; p < 7; ++p) {
+		float* data = planes[p]->data();
+		for (int y = 1; y <= height; ++y) {
+			data[y * stride] = data[y * stride + 1];
+			data[y * stride + width + 1] = data[y * stride + width];
+		}
+		memcpy(data, data + stride, stride * sizeof(float));
+		memcpy(data + (height + 1) * stride, data + height * stride, stride * sizeof(float));
+	}
+}
+
+void SoftwareRasterizer::writeColorRows(int rowBegin, int rowEnd, cv::Mat& colorImage) {
+	static const unsigned int colors[4] = { PIXEL_WHITE, 0xffff0000, 0xff00ff00, 0xff0000ff };	// BGRA in little endian
+
+	for (int r = rowBegin; r < rowEnd; ++r) {
+		const unsigned char* src = &classes[(height - r) * stride + 1];
+		unsigned int* dst = colorImage.ptr<unsigned int>(r);
+		for (int x = 0; x < width; ++x) {
+			dst[x] = colors[src[x]];
+		}
+	}
+}
+
+/**
+ * Port of lc_frag_line.glsl: a pixel is a line if the normal or the linear depth differs from
+ * one of the eight neighbors that are not on the same surface. Four pixels are processed at once
+ * with SSE, and the remaining pixels of the row with the scalar code.
+ */
+void SoftwareRasterizer::detectEdgeRows(int rowBegin, int rowEnd, const glm::mat4& pMatrix, cv::Mat& lineImage) {
+	const float normalSensitivity = 1.0f;
+	const float depthSensitivity = 10.0f;
+	const float p32 = pMatrix[3][2];
+	const float p22 = pMatrix[2][2];
+	const int offsets[8] = { -stride - 1, -stride, -stride + 1, -1, 1, stride - 1, stride, stride + 1 };
+
+	for (int r = rowBegin; r < rowEnd; ++r) {
+		int row = (height - r) * stride + 1;
+		unsigned int* dst = lineImage.ptr<unsigned int>(r);
+
+		int x = 0;
+#ifdef SOFTWARERASTERIZER_USE_SSE
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 signMask = _mm_set1_ps(-0.0f);
+		const __m128 sameSurface = _mm_set1_ps(0.4f);
+		const __m128 threshold = _mm_set1_ps(0.3f);
+		const __m128 p32v = _mm_set1_ps(p32);
+		const __m128 p22v = _mm_set1_ps(p22);
+		for (; x + 4 <= width; x += 4) {
+			int i = row + x;
+			__m128 d = _mm_loadu_ps(&depth[i]);
+			__m128 lin = _mm_div_ps(p32v, _mm_add_ps(d, p22v));
+			__m128 nx = _mm_loadu_ps(&normalX[i]);
+			__m128 ny = _mm_loadu_ps(&normalY[i]);
+			__m128 nz = _mm_loadu_ps(&normalZ[i]);
+			__m128 px = _mm_loadu_ps(&posX[i]);
+			__m128 py = _mm_loadu_ps(&posY[i]);
+			__m128 pz = _mm_loadu_ps(&posZ[i]);
+
+			__m128 normalDiff = zero;
+			__m128 depthDiff = zero;
+			for (int k = 0; k < 8; ++k) {
+				int j = i + offsets[k];
+				__m128 dd = _mm_loadu_ps(&depth[j]);
+
+				// ignore the neighbor on the same surface: |dot(normalize(v), n)| < 0.4 as |dot(v, n)| < 0.4 |v|
+				__m128 vx = _mm_sub_ps(_mm_loadu_ps(&posX[j]), px);
+				__m128 vy = _mm_sub_ps(_mm_loadu_ps(&posY[j]), py);
+				__m128 vz = _mm_sub_ps(_mm_loadu_ps(&posZ[j]), pz);
+				__m128 dotN = _mm_andnot_ps(signMask, _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, nx), _mm_mul_ps(vy, ny)), _mm_mul_ps(vz, nz)));
+				__m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz)));
+				__m128 skip = _mm_and_ps(_mm_cmplt_ps(dd, one), _mm_cmplt_ps(dotN, _mm_mul_ps(sameSurface, len)));
+
+				__m128 dx = _mm_sub_ps(nx, _mm_loadu_ps(&normalX[j]));
+				__m128 dy = _mm_sub_ps(ny, _mm_loadu_ps(&normalY[j]));
+				__m128 dz = _mm_sub_ps(nz, _mm_loadu_ps(&normalZ[j]));
+				__m128 nd = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+				__m128 ld = _mm_andnot_ps(signMask, _mm_sub_ps(lin, _mm_div_ps(p32v, _mm_add_ps(dd, p22v))));
+
+				// the differences are not negative, so the skipped neighbors can be zeroed
+				normalDiff = _mm_max_ps(normalDiff, _mm_andnot_ps(skip, nd));
+				depthDiff = _mm_max_ps(depthDiff, _mm_andnot_ps(skip, ld));
+			}
+
+			__m128 diff = _mm_min_ps(one, _mm_max_ps(_mm_mul_ps(depthDiff, _mm_set1_ps(depthSensitivity)), _mm_mul_ps(normalDiff, _mm_set1_ps(normalSensitivity))));
+			int lines = _mm_movemask_ps(_mm_and_ps(_mm_cmpgt_ps(diff, threshold), _mm_cmplt_ps(d, one)));
+			for (int k = 0; k < 4; ++k) {
+				dst[x + k] = (lines & (1 << k)) ? PIXEL_BLACK : PIXEL_WHITE;
+			}
+		}
+#endif
+
+		for (; x < width; ++x) {
+			int i = row + x;
+			if (depth[i] >= 1.0f) {
+				dst[x] = PIXEL_WHITE;
+				continue;
+			}
+
+			float lin = p32 / (depth[i] + p22);
+			glm::vec3 normal(normalX[i], normalY[i], normalZ[i]);
+			glm::vec3 pos(posX[i], posY[i], posZ[i]);
+
+			float normalDiff = 0.0f;
+			float depthDiff = 0.0f;
+			for (int k = 0; k < 8; ++k) {
+				int j = i + offsets[k];
+				glm::vec3 v = glm::vec3(posX[j], posY[j], posZ[j]) - pos;
+				if (depth[j] < 1.0f && std::abs(glm::dot(v, normal)) < 0.4f * glm::length(v)) continue;
+
+				normalDiff = (std::max)(normalDiff, glm::length(normal - glm::vec3(normalX[j], normalY[j], normalZ[j])));
+				depthDiff = (std::max)(depthDiff, std::abs(lin - p32 / (depth[j] + p22)));
+			}
+
+			float diff = (std::min)(1.0f, (std::max)(depthDiff * depthSensitivity, normalDiff * normalSensitivity));
+			dst[x] = diff > 0.3f ? PIXEL_BLACK : PIXEL_WHITE;
+		}
+	}
+}
+
+/**
+ * Call func(0) ... func(count - 1) on the worker threads. The indices are handed out one by one,
+ * so that the threads stay busy even if the work per index varies.
+ *
+ * @param count			number of the indices
+ * @param numThreads	number of the threads (0 -- number of cores)
+ * @param func			function called for each index
+ */
+void SoftwareRasterizer::parallelFor(int count, int numThreads, const std::function<void(int)>& func) {
+	int threads = numThreads > 0 ? numThreads : (int)std::thread::hardware_concurrency();
+	threads = (std::max)(1, (std::min)(threads, count));
+
+	std::atomic<int> next(0);
+	auto worker = [&]() {
+		for (int i = next++; i < count; i = next++) {
+			func(i);
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (int t = 1; t < threads; ++t) {
+		workers.push_back(std::thread(worker));
+	}
+	worker();
+	for (int t = 0; t < workers.size(); ++t) {
+		workers[t].join();
+	}
+}
+
+unsigned char SoftwareRasterizer::classify(const glm::vec4& color) {
+	if (color.r > color.g && color.r > color.b) return CLASS_TRUNK;
+	else if (color.g > color.r && color.g > color.b) return CLASS_BRANCH;
+	else if (color.b > color.g && color.b > color.r) return CLASS_LEAF;
+	else return CLASS_BACKGROUND;
+}
+
+/**
+ * Mask of the pixels of the class, with the same rules as the classification of the patches.
+ */
+cv::Mat SoftwareRasterizer::classMask(const cv::Mat& image, int cls) {
+	cv::Mat classes;
+	PatchClassifier::classifyPixels(image, classes);
+	return classes == cls;
+}
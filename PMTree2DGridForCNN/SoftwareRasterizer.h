@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <glm/glm.hpp>
+#include <opencv2/opencv.hpp>
+
+class RenderManager;
+class Camera;
+
+/**
+ * CPU renderer of the training images for the machines without a GPU.
+ * Only what the combined rendering mode needs is implemented: the triangles of all the objects
+ * are binned into tiles and rasterized tile-parallel into a G-buffer of depth, normal, world
+ * position and class, and the edge detector of lc_frag_line.glsl runs on it as a SIMD post pass.
+ *
+ * The color image is the class of each pixel in the vertex color of the class (trunk red,
+ * branch green, leaf blue, background white) without shading, since the color image is used only
+ * to classify the patches. The line image is the same as the one of the GL path within a pixel
+ * or so (see compareLines()). Both images are BGRA and top-down, like the images of the GL path
+ * rendered with flipY.
+ */
+class SoftwareRasterizer {
+public:
+	enum { CLASS_BACKGROUND = 0, CLASS_TRUNK, CLASS_BRANCH, CLASS_LEAF };
+	static const int TILE_SIZE = 64;
+
+	/** triangle after the vertex transformation (window coordinates, bottom-up like GL) */
+	struct Triangle {
+		float x[3];
+		float y[3];
+		float z[3];				// window depth [0, 1]
+		float invW[3];			// for the perspective correct interpolation
+		glm::vec3 normal[3];
+		glm::vec3 position[3];	// world position
+		unsigned char cls;
+		int minX, minY, maxX, maxY;	// pixel bounds clipped to the screen
+	};
+
+	int numThreads;		// 0 -- number of cores
+
+private:
+	int width;
+	int height;
+	int stride;			// width + 2, the G-buffer has a border of one pixel for the post pass
+	int tileCols;
+	int tileRows;
+
+	// G-buffer as separate planes, so that the post pass can load four pixels of each attribute at once
+	std::vector<float> depth;
+	std::vector<float> normalX, normalY, normalZ;
+	std::vector<float> posX, posY, posZ;
+	std::vector<unsigned char> classes;
+
+	std::vector<Triangle> triangles;
+	std::vector<std::vector<int> > bins;	// indices of the triangles that overlap each tile, in submission order
+
+public:
+	SoftwareRasterizer();
+
+	void render(RenderManager* renderManager, const Camera& camera, int width, int height, cv::Mat& colorImage, cv::Mat& lineImage);
+	static double compareLines(const cv::Mat& image1, const cv::Mat& image2, int tolerance);
+	static double compareClasses(const cv::Mat& image1, const cv::Mat& image2, int tolerance);
+	static void parallelFor(int count, int numThreads, const std::function<void(int)>& func);
+
+private:
+	void resize(int width, int height);
+	void setupTriangles(RenderManager* renderManager, const Camera& camera);
+	void rasterizeTile(int tile);
+	void fillBorder();
+	void writeColorRows(int rowBegin, int rowEnd, cv::Mat& colorImage);
+	void detectEdgeRows(int rowBegin, int rowEnd, const glm::mat4& pMatrix, cv::Mat& lineImage);
+	static unsigned char classify(const glm::vec4& color);
+	static cv::Mat classMask(const cv::Mat& image, int cls);
+};
@@ -0,0 +1,389 @@
+#include "TextureLoader.h"
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <QImage>
+#include <QFile>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDir>
+#include <QCryptographicHash>
+
+TextureLoader::TextureLoader() {
+	useCache = true;
+	cacheDir = "texture_cache";
+}
+
+TextureLoader::~TextureLoader() {
+	for (int i = 0; i < requests.size(); ++i) {
+		if (requests[i]->future.valid()) requests[i]->future.wait();
+	}
+}
+
+/**
+ * Start loading a 2D texture.
+ *
+ * @param filename	image file
+ * @return			texture id (the texture has no storage until update() publishes it)
+ */
+GLuint TextureLoader::load2D(const QString& filename) {
+	std::vector<QString> files;
+	files.push_back(filename);
+	return request(GL_TEXTURE_2D, files);
+}
+
+/**
+ * Start loading a 3D texture whose layers are the specified images.
+ *
+ * @param files		image files, one per layer. All the images must have the same size.
+ * @return			texture id (the texture has no storage until update() publishes it)
+ */
+GLuint TextureLoader::load3D(const std::vector<QString>& files) {
+	return request(GL_TEXTURE_3D, files);
+}
+
+/**
+ * Upload the textures whose decoding has finished.
+ * This function has to be called on the GL thread, e.g., at the beginning of every frame.
+ *
+ * @return		the number of textures published in this call
+ */
+int TextureLoader::update() {
+	int count = 0;
+	for (int i = 0; i < requests.size();) {
+		if (requests[i]->future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+			++i;
+			continue;
+		}
+
+		boost::shared_ptr<TextureRequest> req = requests[i];
+		requests.erase(requests.begin() + i);
+		req->future.get();
+		publish(req.get());
+		count++;
+	}
+
+	return count;
+}
+
+/**
+ * Wait until all the requested textures are decoded, and upload them.
+ */
+void TextureLoader::finish() {
+	for (int i = 0; i < requests.size(); ++i) {
+		requests[i]->future.wait();
+	}
+	update();
+}
+
+bool TextureLoader::isReady(GLuint texture) {
+	return readyTextures.find(texture) != readyTextures.end();
+}
+
+GLuint TextureLoader::request(GLenum target, const std::vector<QString>& files) {
+	boost::shared_ptr<TextureRequest> req(new TextureRequest());
+	glGenTextures(1, &req->texture);
+	req->target = target;
+	req->files = files;
+	if (useCache) {
+		req->cacheFile = cacheFileName(target, files);
+	}
+
+	TextureRequest* ptr = req.get();
+	req->future = std::async(std::launch::async, [ptr]() { TextureLoader::decode(ptr); });
+	requests.push_back(req);
+
+	return req->texture;
+}
+
+/**
+ * Upload the decoded texture through a pixel buffer object.
+ * All the levels are copied into one PBO, and the 3D texture is uploaded by one glTexSubImage3D call.
+ */
+void TextureLoader::publish(TextureRequest* req) {
+	if (!req->error.empty()) {
+		std::cout << req->error << std::endl;
+		throw req->error;
+	}
+
+	const TextureLevel& base = req->levels[0];
+	int numLevels = req->levels.size();
+	if (!req->fromCache) {
+		int size = (std::max)(base.width, base.height);
+		if (req->target == GL_TEXTURE_3D) size = (std::max)(size, base.depth);
+		numLevels = 1;
+		while (size > 1) {
+			size /= 2;
+			numLevels++;
+		}
+	}
+
+	// stage the levels in a PBO
+	size_t total = 0;
+	for (int i = 0; i < req->levels.size(); ++i) {
+		total += req->levels[i].data.size();
+	}
+
+	GLuint pbo;
+	glGenBuffers(1, &pbo);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, total, NULL, GL_STREAM_DRAW);
+	unsigned char* dst = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, total, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	size_t offset = 0;
+	for (int i = 0; i < req->levels.size(); ++i) {
+		memcpy(dst + offset, req->levels[i].data.data(), req->levels[i].data.size());
+		offset += req->levels[i].data.size();
+	}
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(req->target, req->texture);
+	if (req->target == GL_TEXTURE_2D) {
+		glTexStorage2D(GL_TEXTURE_2D, numLevels, GL_RGBA8, base.width, base.height);
+	}
+	else {
+		glTexStorage3D(GL_TEXTURE_3D, numLevels, GL_RGBA8, base.width, base.height, base.depth);
+	}
+
+	offset = 0;
+	for (int i = 0; i < req->levels.size(); ++i) {
+		const TextureLevel& level = req->levels[i];
+		if (req->target == GL_TEXTURE_2D) {
+			glTexSubImage2D(GL_TEXTURE_2D, i, 0, 0, level.width, level.height, GL_RGBA, GL_UNSIGNED_BYTE, (const GLvoid*)offset);
+		}
+		else {
+			glTexSubImage3D(GL_TEXTURE_3D, i, 0, 0, 0, level.width, level.height, level.depth, GL_RGBA, GL_UNSIGNED_BYTE, (const GLvoid*)offset);
+		}
+		offset += level.data.size();
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glDeleteBuffers(1, &pbo);
+
+	if (req->target == GL_TEXTURE_2D) {
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	}
+	else {
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	}
+
+	if (!req->fromCache) {
+		glGenerateMipmap(req->target);
+		if (!req->cacheFile.isEmpty()) {
+			saveMipChain(req, numLevels);
+		}
+	}
+
+	glBindTexture(req->target, 0);
+
+	// the decoded images are no longer needed
+	req->levels.clear();
+	readyTextures.insert(req->texture);
+}
+
+/**
+ * Read back the generated mip chain and store it in the cache.
+ * The texture has to be bound to req->target.
+ */
+void TextureLoader::saveMipChain(TextureRequest* req, int numLevels) {
+	QDir().mkpath(cacheDir);
+
+	QSaveFile file(req->cacheFile);
+	if (!file.open(QIODevice::WriteOnly)) {
+		std::cout << "Could not write the texture cache: " << req->cacheFile.toUtf8().constData() << std::endl;
+		return;
+	}
+
+	// header: "PMTX" + number of levels
+	// each level: width, height, depth + RGBA8 texels
+	file.write("PMTX", 4);
+	int header = numLevels;
+	file.write((const char*)&header, sizeof(int));
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	std::vector<unsigned char> data;
+	for (int i = 0; i < numLevels; ++i) {
+		int size[3] = { 1, 1, 1 };
+		glGetTexLevelParameteriv(req->target, i, GL_TEXTURE_WIDTH, &size[0]);
+		glGetTexLevelParameteriv(req->target, i, GL_TEXTURE_HEIGHT, &size[1]);
+		if (req->target == GL_TEXTURE_3D) {
+			glGetTexLevelParameteriv(req->target, i, GL_TEXTURE_DEPTH, &size[2]);
+		}
+
+		data.resize((size_t)size[0] * size[1] * size[2] * 4);
+		glGetTexImage(req->target, i, GL_RGBA, GL_UNSIGNED_BYTE, data.data());
+
+		file.write((const char*)size, sizeof(int) * 3);
+		file.write((const char*)data.data(), data.size());
+	}
+
+	file.commit();
+}
+
+/**
+ * Return the cache file name of the texture.
+ * The key includes the size and the modification time of the image files,
+ * so the cache is rebuilt when an image is edited.
+ */
+QString TextureLoader::cacheFileName(GLenum target, const std::vector<QString>& files) {
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	hash.addData((const char*)&target, sizeof(GLenum));
+	for (int i = 0; i < files.size(); ++i) {
+		QFileInfo info(files[i]);
+		hash.addData(info.absoluteFilePath().toUtf8());
+		qint64 stamp[2] = { info.size(), info.lastModified().toMSecsSinceEpoch() };
+		hash.addData((const char*)stamp, sizeof(stamp));
+	}
+
+	return cacheDir + "/" + QString(hash.result().toHex()) + ".tex";
+}
+
+/**
+ * Decode the image files of the request (worker thread).
+ */
+void TextureLoader::decode(TextureRequest* req) {
+	if (!req->cacheFile.isEmpty()) {
+		try {
+			if (loadMipChain(req)) {
+				req->fromCache = true;
+				return;
+			}
+		}
+		catch (const std::exception&) {
+			// a corrupt cache file is ignored, and the images are decoded again
+			req->levels.clear();
+		}
+	}
+
+	// decode the layers in parallel
+	std::vector<TextureLevel> layers(req->files.size());
+	std::vector<std::string> errors(req->files.size());
+	std::vector<std::future<void> > futures;
+	for (int i = 0; i < req->files.size(); ++i) {
+		futures.push_back(std::async(std::launch::async, [req, i, &layers, &errors]() { TextureLoader::decodeImage(req->files[i], layers[i], errors[i]); }));
+	}
+	for (int i = 0; i < futures.size(); ++i) {
+		futures[i].wait();
+	}
+
+	for (int i = 0; i < layers.size(); ++i) {
+		if (!errors[i].empty()) {
+			req->error = errors[i];
+			return;
+		}
+		if (layers[i].width != layers[0].width || layers[i].height != layers[0].height) {
+			std::stringstream ss;
+			ss << "Texture3D::load() failed : different dimensions of images. " << req->files[0].toUtf8().constData() << " " << req->files[i].toUtf8().constData();
+			req->error = ss.str();
+			return;
+		}
+	}
+
+	// concatenate the layers into level 0
+	TextureLevel level;
+	level.width = layers[0].width;
+	level.height = layers[0].height;
+	level.depth = layers.size();
+	level.data.reserve(layers[0].data.size() * layers.size());
+	for (int i = 0; i < layers.size(); ++i) {
+		level.data.insert(level.data.end(), layers[i].data.begin(), layers[i].data.end());
+	}
+	req->levels.push_back(level);
+}
+
+/**
+ * Read the mip chain from the cache file (worker thread).
+ * The number of levels and their sizes are checked against the mip chain of level 0,
+ * so that a truncated or corrupt file is rejected before anything is allocated for it.
+ *
+ * @return		true if the cache file exists and is valid
+ */
+bool TextureLoader::loadMipChain(TextureRequest* req) {
+	QFile file(req->cacheFile);
+	if (!file.open(QIODevice::ReadOnly)) return false;
+	QByteArray data = file.readAll();
+	file.close();
+
+	const char* ptr = data.constData();
+	const char* end = ptr + data.size();
+	if (data.size() < 8 || strncmp(ptr, "PMTX", 4) != 0) return false;
+	int numLevels;
+	memcpy(&numLevels, ptr + 4, sizeof(int));
+	ptr += 8;
+	if (numLevels < 1 || numLevels > 32) return false;
+
+	std::vector<TextureLevel> levels(numLevels);
+	for (int i = 0; i < numLevels; ++i) {
+		if (end - ptr < sizeof(int) * 3) return false;
+		int size[3];
+		memcpy(size, ptr, sizeof(int) * 3);
+		ptr += sizeof(int) * 3;
+
+		if (size[0] <= 0 || size[1] <= 0 || size[2] <= 0) return false;
+		if (i == 0) {
+			// a full mip chain has log2(max dim) + 1 levels
+			int maxSize = (std::max)((std::max)(size[0], size[1]), size[2]);
+			int maxLevels = 1;
+			while (maxSize >>= 1) maxLevels++;
+			if (numLevels > maxLevels) return false;
+		}
+		else {
+			int base[3] = { levels[0].width, levels[0].height, levels[0].depth };
+			for (int k = 0; k < 3; ++k) {
+				if (size[k] != (std::max)(1, base[k] >> i)) return false;
+			}
+		}
+
+		// the sizes are checked against the rest of the file before they are multiplied
+		if ((size_t)(end - ptr) / 4 / size[0] / size[1] < (size_t)size[2]) return false;
+		size_t length = (size_t)size[0] * size[1] * size[2] * 4;
+		levels[i].width = size[0];
+		levels[i].height = size[1];
+		levels[i].depth = size[2];
+		levels[i].data.assign(ptr, ptr + length);
+		ptr += length;
+	}
+
+	req->levels.swap(levels);
+	return true;
+}
+
+/**
+ * Decode an image file into RGBA8 with the first row at the bottom, as OpenGL expects (worker thread).
+ */
+void TextureLoader::decodeImage(const QString& filename, TextureLevel& level, std::string& error) {
+	QImage img;
+	if (!img.load(filename)) {
+		std::stringstream ss;
+		ss << "load texture failed : " << filename.toUtf8().constData();
+		error = ss.str();
+		return;
+	}
+
+	// same conversion as QGLWidget::convertToGLFormat
+	QImage GL_formatted_image = img.convertToFormat(QImage::Format_RGBA8888).mirrored();
+	if (GL_formatted_image.isNull()) {
+		std::stringstream ss;
+		ss << "Failed to convert to gl format : " << filename.toUtf8().constData();
+		error = ss.str();
+		return;
+	}
+
+	level.width = GL_formatted_image.width();
+	level.height = GL_formatted_image.height();
+	level.depth = 1;
+	level.data.resize((size_t)level.width * level.height * 4);
+	for (int y = 0; y < level.height; ++y) {
+		memcpy(&level.data[(size_t)y * level.width * 4], GL_formatted_image.constScanLine(y), level.width * 4);
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "glew.h"
+#include <QString>
+#include <vector>
+#include <set>
+#include <future>
+#include <boost/shared_ptr.hpp>
+
+/**
+ * One mip level of a texture in RGBA8.
+ */
+class TextureLevel {
+public:
+	int width;
+	int height;
+	int depth;
+	std::vector<unsigned char> data;
+
+public:
+	TextureLevel() : width(0), height(0), depth(0) {}
+};
+
+/**
+ * A texture that is being decoded by a worker thread.
+ */
+class TextureRequest {
+public:
+	GLuint texture;
+	GLenum target;					// GL_TEXTURE_2D or GL_TEXTURE_3D
+	std::vector<QString> files;		// one file per layer
+	QString cacheFile;
+
+	// filled by the worker thread
+	std::vector<TextureLevel> levels;	// only level 0, or the whole mip chain if it was found in the cache
+	bool fromCache;
+	std::string error;
+
+	std::future<void> future;
+
+public:
+	TextureRequest() : texture(0), target(GL_TEXTURE_2D), fromCache(false) {}
+};
+
+/**
+ * Texture loader that decodes the image files on worker threads and uploads them through
+ * pixel buffer objects on the GL thread.
+ * The texture id is returned immediately, and the texture gets its storage when update()
+ * finds that the decoding has finished. Once the mip chain has been generated, it is stored
+ * in the cache directory, so that the next launch skips decoding and mipmap generation.
+ */
+class TextureLoader {
+public:
+	bool useCache;
+	QString cacheDir;
+
+private:
+	std::vector<boost::shared_ptr<TextureRequest> > requests;
+	std::set<GLuint> readyTextures;
+
+public:
+	TextureLoader();
+	~TextureLoader();
+
+	GLuint load2D(const QString& filename);
+	GLuint load3D(const std::vector<QString>& files);
+	int update();
+	void finish();
+	bool isReady(GLuint texture);
+	bool pending() const { return !requests.empty(); }
+
+private:
+	GLuint request(GLenum target, const std::vector<QString>& files);
+	void publish(TextureRequest* req);
+	void saveMipChain(TextureRequest* req, int numLevels);
+	QString cacheFileName(GLenum target, const std::vector<QString>& files);
+	static void decode(TextureRequest* req);
+	static bool loadMipChain(TextureRequest* req);
+	static void decodeImage(const QString& filename, TextureLevel& level, std::string& error);
+};
@@ -0,0 +1,86 @@
+#include "TileGrid.h"
+#include <algorithm>
+
+TileGrid::TileGrid() {
+	imageWidth = 0;
+	imageHeight = 0;
+	tileWidth = 0;
+	tileHeight = 0;
+	guard = 0;
+	numCols = 0;
+	numRows = 0;
+}
+
+/**
+ * Divide the image.
+ *
+ * @param imageWidth	width of the whole image
+ * @param imageHeight	height of the whole image
+ * @param maxTileSize	maximum width/height of the rendered tile including the guard band
+ * @param guard			width of the guard band
+ */
+void TileGrid::init(int imageWidth, int imageHeight, int maxTileSize, int guard) {
+	this->imageWidth = imageWidth;
+	this->imageHeight = imageHeight;
+
+	if (imageWidth <= maxTileSize && imageHeight <= maxTileSize) {
+		this->guard = 0;
+		tileWidth = imageWidth;
+		tileHeight = imageHeight;
+	}
+	else {
+		this->guard = guard;
+		tileWidth = (std::min)(imageWidth, maxTileSize - guard * 2);
+		tileHeight = (std::min)(imageHeight, maxTileSize - guard * 2);
+	}
+
+	numCols = (imageWidth + tileWidth - 1) / tileWidth;
+	numRows = (imageHeight + tileHeight - 1) / tileHeight;
+}
+
+/**
+ * Interior of the tile in the image (top-down), clipped by the image.
+ */
+cv::Rect TileGrid::tileRect(int index) const {
+	int x = (index % numCols) * tileWidth;
+	int y = (index / numCols) * tileHeight;
+	return cv::Rect(x, y, (std::min)(tileWidth, imageWidth - x), (std::min)(tileHeight, imageHeight - y));
+}
+
+/**
+ * Projection matrix of the sub-frustum of the tile including the guard band.
+ * The region of the tile in NDC of the whole image is scaled to [-1, 1], so the matrix
+ * is applied after the projection matrix of the whole image. The depth is not changed.
+ *
+ * @param pMatrix	projection matrix of the whole image
+ * @param index		tile index
+ * @return			projection matrix of the tile
+ */
+glm::mat4 TileGrid::projection(const glm::mat4& pMatrix, int index) const {
+	cv::Rect rect = tileRect(index);
+	float x0 = rect.x - guard;
+	float x1 = x0 + renderWidth();
+	float y0 = rect.y - guard;
+	float y1 = y0 + renderHeight();
+
+	// NDC of the region (y axis points up in NDC, and down in the image)
+	float left = x0 / imageWidth * 2.0f - 1.0f;
+	float right = x1 / imageWidth * 2.0f - 1.0f;
+	float top = 1.0f - y0 / imageHeight * 2.0f;
+	float bottom = 1.0f - y1 / imageHeight * 2.0f;
+
+	return glm::inverse(ndcRegion(left, right, bottom, top)) * pMatrix;
+}
+
+/**
+ * Matrix that maps [-1, 1] x [-1, 1] in NDC onto the given region of NDC.
+ * The depth is not changed.
+ */
+glm::mat4 TileGrid::ndcRegion(float left, float right, float bottom, float top) {
+	glm::mat4 m;
+	m[0][0] = (right - left) * 0.5f;
+	m[1][1] = (top - bottom) * 0.5f;
+	m[3][0] = (right + left) * 0.5f;
+	m[3][1] = (top + bottom) * 0.5f;
+	return m;
+}
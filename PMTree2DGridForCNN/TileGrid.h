@@ -0,0 +1,34 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <opencv2/opencv.hpp>
+
+/**
+ * Division of an image into tiles that are rendered separately.
+ * The tiles are ordered row by row from the top-left corner. Each tile is rendered with a
+ * guard band of "guard" pixels on every side, so that the screen space passes (edge detection,
+ * blur, AO) see the neighboring pixels at the tile borders. Only the interior is used.
+ * If the image fits in one tile, it is rendered as a whole without the guard band.
+ */
+class TileGrid {
+public:
+	int imageWidth;
+	int imageHeight;
+	int tileWidth;		// size of the interior of the tiles
+	int tileHeight;
+	int guard;
+	int numCols;
+	int numRows;
+
+public:
+	TileGrid();
+
+	void init(int imageWidth, int imageHeight, int maxTileSize, int guard);
+	int numTiles() const { return numCols * numRows; }
+	int renderWidth() const { return tileWidth + guard * 2; }
+	int renderHeight() const { return tileHeight + guard * 2; }
+	cv::Rect tileRect(int index) const;
+	bool endOfRow(int index) const { return index % numCols == numCols - 1; }
+	glm::mat4 projection(const glm::mat4& pMatrix, int index) const;
+	static glm::mat4 ndcRegion(float left, float right, float bottom, float top);
+};
@@ -1,8 +1,315 @@
 #include "MainWindow.h"
 #include <QtWidgets/QApplication>
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <thread>
+#include "HeadlessContext.h"
+#include "RenderBackend.h"
+#include "RenderManager.h"
+#include "DatasetGenerator.h"
+#include "PatchShard.h"
+#include "DatasetManifest.h"
+#include "GenerationCoordinator.h"
+#include "Camera.h"
+#include "PMTree2D.h"
+
+/**
+ * Generate the dataset without a window.
+ *
+ * PMTree2DGridForCNN --headless --output <dir> [--trees N] [--width W] [--height H] [--tile-size S] [--atlas K] [--predicted <file>]
+ *                    [--renderer gl|software] [--threads N] [--validate N] [--labels] [--encoders N]
+ *                    [--format files|shards] [--raw] [--shard-size MB] [--first N] [--range-size N] [--seed N] [--workers N]
+ *                    [--quota N0,N1,N2,N3] [--accept P0,P1,P2,P3] [--dedup T]
+ * PMTree2DGridForCNN --headless --output <dir> --merge <dir> [--merge <dir> ...] [--verify]
+ * PMTree2DGridForCNN --headless --output <dir> --export-legacy <dir>
+ * PMTree2DGridForCNN --headless --self-test
+ *
+ * The trees are generated in ranges of --range-size trees, and the completed ranges are skipped,
+ * so an interrupted run continues where it stopped, and the ranges can be generated by separate
+ * runs (--first) and merged into the index of the dataset (--merge). With --workers, this process
+ * runs the ranges in that many worker processes, and merges them when all of them are complete.
+ *
+ * The software renderer does not create a GL context at all, so it runs on the machines without a GPU,
+ * and without a display. The GL renderer needs a display unless it is built with PMTREE_USE_EGL
+ * (see HeadlessContext), which the project file does not define yet.
+ */
+int runHeadless(QCoreApplication& app) {
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Generate the training data without a window.");
+	parser.addHelpOption();
+	QCommandLineOption headlessOption("headless", "Render with an offscreen context.");
+	QCommandLineOption outputOption("output", "Output directory.", "dir");
+	QCommandLineOption treesOption("trees", "Number of random trees.", "N", "300");
+	QCommandLineOption widthOption("width", "Width of the rendered image.", "W", "2560");
+	QCommandLineOption heightOption("height", "Height of the rendered image.", "H", "2560");
+	QCommandLineOption tileSizeOption("tile-size", "Images larger than this are rendered in tiles.", "S", "4096");
+	QCommandLineOption atlasOption("atlas", "Number of trees rendered in one frame.", "K", "1");
+	QCommandLineOption predictedOption("predicted", "Render the trees of the predicted parameters in this file instead of random trees.", "file");
+	QCommandLineOption rendererOption("renderer", "Renderer of the training images (gl or software).", "name", "gl");
+	QCommandLineOption threadsOption("threads", "Number of threads of the software renderer (0 -- number of cores).", "N", "0");
+	QCommandLineOption validateOption("validate", "Render the first N trees with both renderers and print the mismatch, and that of the patch types.", "N", "0");
+	QCommandLineOption labelsOption("labels", "Classify the patches by the label map of the skeleton instead of the colors.");
+	QCommandLineOption encodersOption("encoders", "Number of threads that encode the patches (0 -- number of cores).", "N", "0");
+	QCommandLineOption formatOption("format", "Output of the patches (files: one PNG file per patch, shards: packed records).", "name", "files");
+	QCommandLineOption rawOption("raw", "Store the raw pixels in the shards instead of PNG.");
+	QCommandLineOption shardSizeOption("shard-size", "Maximum size of a shard in MB.", "MB", "256");
+	QCommandLineOption exportOption("export-legacy", "Write the patches of the shards in this directory (or of the ranges in its index) as one PNG file per patch.", "dir");
+	QCommandLineOption firstOption("first", "Index of the first tree.", "N", "0");
+	QCommandLineOption rangeSizeOption("range-size", "Number of the trees per range (0 -- one range in the output directory).", "N", "100");
+	QCommandLineOption seedOption("seed", "Seed of the random numbers of the tree 0.", "N", "2");
+	QCommandLineOption mergeOption("merge", "Write the index of the complete ranges in this directory into the output directory.", "dir");
+	QCommandLineOption verifyOption("verify", "Verify the checksums of the ranges when merging.");
+	QCommandLineOption workersOption("workers", "Generate the ranges in this number of worker processes.", "N", "0");
+	QCommandLineOption progressOption("progress", "Print \"tree N\" when the patches of each tree have been stored.");
+	QCommandLineOption quotaOption("quota", "Number of the patches of each type (-1 -- no limit). The generation stops when all are filled.", "N0,N1,N2,N3");
+	QCommandLineOption acceptOption("accept", "Probability to keep a patch of each type.", "P0,P1,P2,P3");
+	QCommandLineOption quotaSpanOption("quota-span", "Trees that the quota is divided among (set by the coordinator).", "first,count");
+	QCommandLineOption dedupOption("dedup", "Reject the patches within this Hamming distance of the average hash of a stored patch of the same type.", "T", "-1");
+	QCommandLineOption selfTestOption("self-test", "Compare the SIMD pixel classification with the scalar one for all the colors, and exit with 1 if they differ.");
+	QCommandLineOption profileNameOption("profile-name", "File name of the profile in the output directory.", "name", "profile");
+	parser.addOption(headlessOption);
+	parser.addOption(outputOption);
+	parser.addOption(treesOption);
+	parser.addOption(widthOption);
+	parser.addOption(heightOption);
+	parser.addOption(tileSizeOption);
+	parser.addOption(atlasOption);
+	parser.addOption(predictedOption);
+	parser.addOption(rendererOption);
+	parser.addOption(threadsOption);
+	parser.addOption(validateOption);
+	parser.addOption(labelsOption);
+	parser.addOption(encodersOption);
+	parser.addOption(formatOption);
+	parser.addOption(rawOption);
+	parser.addOption(shardSizeOption);
+	parser.addOption(exportOption);
+	parser.addOption(firstOption);
+	parser.addOption(rangeSizeOption);
+	parser.addOption(seedOption);
+	parser.addOption(mergeOption);
+	parser.addOption(verifyOption);
+	parser.addOption(workersOption);
+	parser.addOption(progressOption);
+	parser.addOption(profileNameOption);
+	parser.addOption(quotaOption);
+	parser.addOption(acceptOption);
+	parser.addOption(quotaSpanOption);
+	parser.addOption(dedupOption);
+	parser.addOption(selfTestOption);
+	parser.process(app);
+
+	if (parser.isSet(selfTestOption)) {
+		if (!PatchClassifier::verify()) return 1;
+		std::cout << "Self-test passed" << std::endl;
+		return 0;
+	}
+
+	if (!parser.isSet(outputOption)) {
+		std::cout << "Error: --output is required" << std::endl;
+		return 1;
+	}
+	QString outputDir = QDir::fromNativeSeparators(parser.value(outputOption));
+	if (!outputDir.endsWith("/")) outputDir += "/";
+
+	// the ranges are merged and the shards are converted without rendering
+	if (parser.isSet(mergeOption)) {
+		QStringList inputDirs = parser.values(mergeOption);
+		for (int i = 0; i < inputDirs.size(); ++i) {
+			inputDirs[i] = QDir::fromNativeSeparators(inputDirs[i]);
+			if (!inputDirs[i].endsWith("/")) inputDirs[i] += "/";
+		}
+		int numTrees = DatasetIndex::merge(outputDir, inputDirs, parser.isSet(verifyOption));
+		if (numTrees < 0) return 1;
+		std::cout << numTrees << " trees in the index" << std::endl;
+		return 0;
+	}
+	if (parser.isSet(exportOption)) {
+		QString shardDir = QDir::fromNativeSeparators(parser.value(exportOption));
+		if (!shardDir.endsWith("/")) shardDir += "/";
+		QStringList shardDirs = DatasetIndex::rangeDirs(shardDir);
+		if (shardDirs.empty()) shardDirs.push_back(shardDir);
+		int numPatches = ShardReader::exportLegacy(shardDirs, outputDir);
+		if (numPatches < 0) return 1;
+		std::cout << numPatches << " patches exported" << std::endl;
+		return 0;
+	}
+
+	int width = parser.value(widthOption).toInt();
+	int height = parser.value(heightOption).toInt();
+	int tileSize = parser.value(tileSizeOption).toInt();
+	if (width <= 0 || height <= 0 || tileSize <= 0) {
+		std::cout << "Error: invalid image size" << std::endl;
+		return 1;
+	}
+	QString renderer = parser.value(rendererOption);
+	if (renderer != "gl" && renderer != "software") {
+		std::cout << "Error: unknown renderer " << renderer.toUtf8().constData() << std::endl;
+		return 1;
+	}
+	bool useSoftware = renderer == "software";
+	QString format = parser.value(formatOption);
+	if (format != "files" && format != "shards") {
+		std::cout << "Error: unknown format " << format.toUtf8().constData() << std::endl;
+		return 1;
+	}
+	int shardSize = parser.value(shardSizeOption).toInt();
+	if (shardSize <= 0) {
+		std::cout << "Error: invalid shard size" << std::endl;
+		return 1;
+	}
+	if (useSoftware && parser.isSet(predictedOption)) {
+		std::cout << "Error: the software renderer supports only the training data" << std::endl;
+		return 1;
+	}
+
+	// the coordinator only starts the workers, which are this program for one range each
+	int numWorkers = parser.value(workersOption).toInt();
+	if (numWorkers > 0) {
+		int rangeSize = parser.value(rangeSizeOption).toInt();
+		if (parser.isSet(predictedOption) || rangeSize <= 0) {
+			std::cout << "Error: the workers need the training data in ranges (--range-size > 0)" << std::endl;
+			return 1;
+		}
+
+		QStringList removed;
+		removed << "--workers" << "--first" << "--trees" << "--range-size" << "--profile-name";
+		QStringList args = GenerationCoordinator::workerArguments(app.arguments().mid(1), removed);
+
+		// the cores are shared by the workers
+		int threads = (std::max)(1, (int)std::thread::hardware_concurrency() / numWorkers);
+		if (!parser.isSet(encodersOption)) args << "--encoders" << QString::number(threads);
+		if (!parser.isSet(threadsOption)) args << "--threads" << QString::number(threads);
+
+		// the quota is divided among all the ranges of this run, not the range of each worker
+		if (!parser.isSet(quotaSpanOption)) args << "--quota-span" << QString("%1,%2").arg((std::max)(0, parser.value(firstOption).toInt())).arg(parser.value(treesOption).toInt());
+
+		GenerationCoordinator coordinator;
+		coordinator.numWorkers = numWorkers;
+		return coordinator.run(QCoreApplication::applicationFilePath(), args, outputDir, (std::max)(0, parser.value(firstOption).toInt()), parser.value(treesOption).toInt(), rangeSize);
+	}
+
+	HeadlessContext context;
+	OffscreenBackend backend(&context);
+	RenderManager renderManager;
+	if (!useSoftware) {
+		std::string error;
+		if (!context.create(error)) {
+			std::cout << "Error: " << error << std::endl;
+			return 1;
+		}
+
+		// the training images are rendered into the framebuffer of DatasetGenerator (in tiles if necessary),
+		// so the size of the backend matters only for the predicted images
+		renderManager.init("", "", "", true, ShadowMapping::QUALITY_MEDIUM);
+		backend.resize((std::min)(width, tileSize), (std::min)(height, tileSize));
+	}
+
+	// same view and light as GLWidget3D
+	Camera camera;
+	camera.xrot = 0.0f;
+	camera.yrot = 0.0f;
+	camera.zrot = 0.0f;
+	camera.pos = glm::vec3(0, 6, 15.0f);
+	camera.updatePMatrix((std::min)(width, tileSize), (std::min)(height, tileSize));
+
+	glm::vec3 light_dir = glm::normalize(glm::vec3(-4, -5, -8));
+	renderManager.shadow.setLightDir(light_dir);
+
+	pmtree::PMTree2D tree;
+	DatasetGenerator generator(&renderManager, &backend, &camera, light_dir, &tree);
+	generator.outputWidth = width;
+	generator.outputHeight = height;
+	generator.maxTileSize = tileSize;
+	generator.atlasSize = (std::max)(1, parser.value(atlasOption).toInt());
+	generator.firstTree = (std::max)(0, parser.value(firstOption).toInt());
+	generator.rangeSize = (std::max)(0, parser.value(rangeSizeOption).toInt());
+	generator.seed = parser.value(seedOption).toInt();
+	generator.reportProgress = parser.isSet(progressOption);
+	generator.profileName = parser.value(profileNameOption);
+	if (parser.isSet(quotaOption)) {
+		QStringList values = parser.value(quotaOption).split(",");
+		for (int i = 0; i < values.size(); ++i) {
+			generator.sampler.quota.push_back(values[i].toInt());
+		}
+	}
+	if (parser.isSet(acceptOption)) {
+		QStringList values = parser.value(acceptOption).split(",");
+		for (int i = 0; i < values.size(); ++i) {
+			generator.sampler.acceptance.push_back(values[i].toFloat());
+		}
+	}
+	generator.dedup.threshold = parser.value(dedupOption).toInt();
+	if (parser.isSet(quotaSpanOption)) {
+		QStringList values = parser.value(quotaSpanOption).split(",");
+		if (values.size() == 2) {
+			generator.sampler.spanFirst = values[0].toInt();
+			generator.sampler.spanTrees = values[1].toInt();
+		}
+	}
+	generator.useSoftware = useSoftware;
+	generator.validateTrees = parser.value(validateOption).toInt();
+	generator.softwareRasterizer.numThreads = parser.value(threadsOption).toInt();
+	generator.useLabelMap = parser.isSet(labelsOption);
+	generator.labelRasterizer.numThreads = generator.softwareRasterizer.numThreads;
+	generator.patchWriter.numThreads = parser.value(encodersOption).toInt();
+	generator.patchWriter.format = format == "shards" ? PatchWriter::FORMAT_SHARDS : PatchWriter::FORMAT_FILES;
+	generator.patchWriter.compress = !parser.isSet(rawOption);
+	generator.patchWriter.shardSize = (unsigned long long)shardSize << 20;
+	if (parser.isSet(predictedOption)) {
+		generator.generatePredictedData(outputDir, parser.value(predictedOption));
+	}
+	else {
+		if (!generator.generateTrainingData(outputDir, parser.value(treesOption).toInt())) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Return true if the headless run creates a GL context, which needs the platform plugin of QtGui
+ * unless it is created with EGL. The software renderer, the coordinator of the workers, the merge
+ * and the export of the ranges, and the self-test do not render with GL, so they run without a display.
+ */
+bool headlessNeedsGui(int argc, char *argv[]) {
+#ifdef PMTREE_USE_EGL
+	return false;
+#else
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--renderer=software") == 0 || (strcmp(argv[i], "--renderer") == 0 && i + 1 < argc && strcmp(argv[i + 1], "software") == 0)) return false;
+		if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) return false;
+		if (strncmp(argv[i], "--workers=", 10) == 0 && atoi(argv[i] + 10) > 0) return false;
+		if (strcmp(argv[i], "--merge") == 0 || strncmp(argv[i], "--merge=", 8) == 0) return false;
+		if (strcmp(argv[i], "--export-legacy") == 0 || strncmp(argv[i], "--export-legacy=", 16) == 0) return false;
+		if (strcmp(argv[i], "--self-test") == 0) return false;
+	}
+	return true;
+#endif
+}
 
 int main(int argc, char *argv[])
 {
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--headless") == 0) {
+			if (headlessNeedsGui(argc, argv)) {
+				// QOffscreenSurface needs the platform plugin of QtGui
+				QGuiApplication app(argc, argv);
+				return runHeadless(app);
+			}
+			else {
+				QCoreApplication app(argc, argv);
+				return runHeadless(app);
+			}
+		}
+	}
+
 	QApplication a(argc, argv);
 	MainWindow w;
 	w.show();
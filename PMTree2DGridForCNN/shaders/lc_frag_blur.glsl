@@ -5,17 +5,50 @@ in vec2 outUV;
 
 layout(location = 0)out vec4 outputF;
 
-uniform sampler2D tex0;//color
-uniform sampler2D tex1;//normals
-uniform sampler2D tex2;//orig pos
+uniform sampler2D tex0;//color (rgb), light intensity (a)
+uniform sampler2D tex1;//octahedral normals
 uniform sampler2D tex3;//AO
 
 uniform sampler2D depthTex;
 
 uniform vec2 pixelSize;//in texture space
-uniform int ssao_used;	// 1 -- ssao used / 0 -- no ssao used
+uniform mat4 pMatrix;
+// USE_SSAO -- multiply the color by the AO
 
 const int uBlurSize = 4; // use size of noise texture
+const float depthSigma = 0.02; // relative depth difference at which the weight falls to 1/e
+
+float linearizeDepth(in float depth) {
+	float ndc = depth * 2.0 - 1.0;
+	return pMatrix[3][2] / (ndc + pMatrix[2][2]);
+}
+
+// Joint bilateral upsampling of the low resolution AO.
+// The uBlurSize x uBlurSize AO texels around the pixel are averaged with weights that fall off
+// with the depth difference, so that the noise pattern is removed without blurring AO across silhouettes.
+float upsampleAO(in vec2 coord, in float centerDepth) {
+	ivec2 aoSize = textureSize(tex3, 0);
+	ivec2 base = ivec2(floor(coord * vec2(aoSize) - 0.5)) - ivec2(uBlurSize / 2 - 1);
+
+	float sum = 0.0;
+	float weightSum = 0.0;
+	for (int i = 0; i < uBlurSize; ++i) {
+		for (int j = 0; j < uBlurSize; ++j) {
+			ivec2 texel = clamp(base + ivec2(i, j), ivec2(0), aoSize - 1);
+			vec2 texelCoord = (vec2(texel) + 0.5) / vec2(aoSize);
+			float sampleDepth = linearizeDepth(texture(depthTex, texelCoord).r);
+			float w = exp(-abs(sampleDepth - centerDepth) / (depthSigma * centerDepth));
+			sum += texelFetch(tex3, texel, 0).r * w;
+			weightSum += w;
+		}
+	}
+
+	// all the neighbors are on other surfaces (e.g., thin branches)
+	if (weightSum < 1e-4) {
+		return texture(tex3, coord).r;
+	}
+	return sum / weightSum;
+}
 
 void main(){
 	float depth = texture(depthTex, outUV.xy).r;
@@ -38,18 +71,9 @@ void main(){
 		// SSAO
 		//float ssaoVal = texture(tex3, coord).r;
 		float ssaoVal = 1.0;
-		if (ssao_used == 1) {
-			vec2 texelSize = 1.0 / vec2(textureSize(tex3, 0));
-			ssaoVal = 0.0f;
-			vec2 hlim = vec2(float(-uBlurSize) * 0.5 + 0.5);
-			for (int i = 0; i < uBlurSize; ++i) {
-				for (int j = 0; j < uBlurSize; ++j) {
-					vec2 offset = (hlim + vec2(float(i), float(j))) * texelSize;
-					ssaoVal += texture(tex3, coord + offset).r;
-				}
-			}
-			ssaoVal = ssaoVal / float(uBlurSize * uBlurSize);
-		}
+#ifdef USE_SSAO
+		ssaoVal = upsampleAO(coord, linearizeDepth(depth));
+#endif
 
 		/*
 		////////////////////////////////
@@ -5,18 +5,34 @@ in vec2 outUV;
 
 layout(location = 0)out vec4 outputF;
 
-uniform sampler2D tex0;//color
-uniform sampler2D tex1;//normals
-uniform sampler2D tex2;//orig pos
-uniform sampler2D tex3;//light intensity
+uniform sampler2D tex0;//color (rgb), light intensity (a)
+uniform sampler2D tex1;//octahedral normals
 
 uniform sampler2D depthTex;
 uniform sampler3D hatchingTexture;
 
 uniform vec2 pixelSize;//in texture space
 uniform mat4 pMatrix;
+uniform mat4 invMvpMatrix;
 
-uniform int useHatching;	// 1 -- use hatching / 0 -- use white color
+// USE_HATCHING -- fill the faces with the hatching texture instead of white color
+
+// octahedral normal decoding
+vec2 signNotZero(vec2 v) {
+	return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec3 decodeNormal(vec2 e) {
+	vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * signNotZero(n.xy);
+	return normalize(n);
+}
+
+// reconstruct the world position from the depth and the inverse of the view-projection matrix
+vec3 reconstructPosition(vec2 coord, float depth) {
+	vec4 pos = invMvpMatrix * vec4(coord * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+	return pos.xyz / pos.w;
+}
 
 float linearizeDepth(float depth, mat4 pMatrix) {
 	return pMatrix[3][2] / (depth + pMatrix[2][2]);
@@ -28,13 +44,12 @@ void main(){
 
 	vec2 coord = outUV.xy;
 	
-	vec3 normal = texture(tex1, coord).rgb;
-	normal = normalize(normal);
+	vec3 normal = decodeNormal(texture(tex1, coord).rg);
 
 	float depth = texture(depthTex, coord).r;
 	float orig_depth = linearizeDepth(depth, pMatrix);
 
-	vec3 originPos = texture(tex2, coord).rgb;
+	vec3 originPos = reconstructPosition(coord, depth);
 
 	/////// DEBUG //////
 	
@@ -62,12 +77,13 @@ void main(){
 		for (int yy = -range; yy <= range; ++yy) {
 			if (xx == 0 && yy == 0) continue;
 
-			vec3 nn = texture(tex1, vec2(coord.x + xx * pixelSize.x, coord.y + yy * pixelSize.y)).xyz;
-			float dd = texture(depthTex, vec2(coord.x + xx * pixelSize.x, coord.y + yy * pixelSize.y)).x;
-			dd = linearizeDepth(dd, pMatrix);
-			vec3 pp = texture(tex2, vec2(coord.x + xx * pixelSize.x, coord.y + yy * pixelSize.y)).xyz;
+			vec2 nc = vec2(coord.x + xx * pixelSize.x, coord.y + yy * pixelSize.y);
+			vec3 nn = decodeNormal(texture(tex1, nc).rg);
+			float raw_dd = texture(depthTex, nc).x;
+			float dd = linearizeDepth(raw_dd, pMatrix);
 
-			if (length(pp - vec3(0.95, 0.95, 0.95)) > 0.1 && abs(dot(normalize(pp - originPos), normal)) < 0.4) continue;
+			// ignore the neighbor on the same surface
+			if (raw_dd < 1.0 && abs(dot(normalize(reconstructPosition(nc, raw_dd) - originPos), normal)) < 0.4) continue;
 
 			normal_diff = max(normal_diff, length(normal - nn));
 			depth_diff = max(depth_diff, length(orig_depth - dd));
@@ -80,26 +96,25 @@ void main(){
 		outputF = vec4(0, 0, 0, 1);	// line
 	}
 	else {
-		if (useHatching == 1) {
-			float lightIntensity = texture(tex3, coord).r;
-
-			////////////////////// DEBUG ///////////////////////
-			/*
-			outputF = vec4(lightIntensity, lightIntensity, lightIntensity, 1);
-			return;
-			*/
-			////////////////////// DEBUG ///////////////////////
-
-			ivec3 sizeOfTex = textureSize(hatchingTexture, 0);
-
-			// sample 3D texture to get hatching intensity
-			//outputF.rgb = texture(hatchingTexture, vec3(coord.x / pixelSize.x / sizeOfTex.x, coord.y / pixelSize.y / sizeOfTex.y, lightIntensity)).rgb;
-			outputF.rgb = texture(hatchingTexture, vec3((originPos.x + originPos.z) * 0.5, (originPos.x * 0.5 + originPos.y + originPos.z) * 0.5, lightIntensity)).rgb;
-			outputF.a = 1;
-		}
-		else {
-			outputF = vec4(1, 1, 1, 1);
-		}
+#ifdef USE_HATCHING
+		float lightIntensity = texture(tex0, coord).a;
+
+		////////////////////// DEBUG ///////////////////////
+		/*
+		outputF = vec4(lightIntensity, lightIntensity, lightIntensity, 1);
+		return;
+		*/
+		////////////////////// DEBUG ///////////////////////
+
+		ivec3 sizeOfTex = textureSize(hatchingTexture, 0);
+
+		// sample 3D texture to get hatching intensity
+		//outputF.rgb = texture(hatchingTexture, vec3(coord.x / pixelSize.x / sizeOfTex.x, coord.y / pixelSize.y / sizeOfTex.y, lightIntensity)).rgb;
+		outputF.rgb = texture(hatchingTexture, vec3((originPos.x + originPos.z) * 0.5, (originPos.x * 0.5 + originPos.y + originPos.z) * 0.5, lightIntensity)).rgb;
+		outputF.a = 1;
+#else
+		outputF = vec4(1, 1, 1, 1);
+#endif
 	}
 }
 
@@ -6,30 +6,34 @@ in vec2 outUV;
 in vec3 origVertex;
 in vec3 varyingNormal;
 
-layout(location = 0)out vec3 def_diffuse;
-layout(location = 1)out vec3 def_normal;
-layout(location = 2)out vec3 def_originPos;
-layout(location = 3)out vec3 def_intensity;
+// LINE_ONLY -- the line mode reads only the normal and the depth
+#ifndef LINE_ONLY
+layout(location = 0)out vec4 def_diffuse;	// rgb: shaded color, a: light intensity
+#endif
+layout(location = 1)out vec2 def_normal;	// octahedral encoded normal
 
 uniform sampler2D tex0;
 uniform sampler2DArray tex_3D;
 
 uniform int useShadow;
-uniform int softShadow;
+uniform int shadowFilter;	// 0 -- hard / 1 -- 4 taps / 2 -- 16 taps
 uniform int lighting;
 uniform mat4 light_mvpMatrix;
 uniform vec3 lightDir;
-uniform sampler2D shadowMap;
+uniform sampler2DShadow shadowMap;	// depth comparison with bilinear PCF in hardware
 uniform int textureEnabled;
 
-vec2 poissonDisk4[4] = vec2[](
+const float shadowBias = 0.001;
+const float filterRadius = 1.5;	// in shadow map texels
+
+const vec2 poissonDisk4[4] = vec2[](
 	vec2(-0.94201624, -0.39906216),
 	vec2(0.94558609, -0.76890725),
 	vec2(-0.094184101, -0.92938870),
 	vec2(0.34495938, 0.29387760)
 );
 
-vec2 poissonDisk16[16] = vec2[](
+const vec2 poissonDisk16[16] = vec2[](
 	vec2(-0.94201624, -0.39906216),
 	vec2(0.94558609, -0.76890725),
 	vec2(-0.094184101, -0.92938870),
@@ -48,52 +52,75 @@ vec2 poissonDisk16[16] = vec2[](
 	vec2(0.14383161, -0.14100790)
 );
 
-// Returns a random number based on a vec3 and an int.
-float random(vec3 seed, int i){
-	vec4 seed4 = vec4(seed, i);
-	float dot_product = dot(seed4, vec4(12.9898, 78.233, 45.164, 94.673));
-	return fract(sin(dot_product) * 43758.5453);
+// octahedral normal encoding
+vec2 signNotZero(vec2 v) {
+	return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 encodeNormal(vec3 n) {
+	float l1 = abs(n.x) + abs(n.y) + abs(n.z);
+	if (l1 < 1e-6) return vec2(0, 0);
+	n /= l1;
+	return n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * signNotZero(n.xy);
 }
 
-float shadowCoef(int softShadow){
+// The Poisson disk is rotated by one of four fixed angles chosen by the pixel position in a 2x2 block,
+// which breaks up the banding of a single pattern without computing a hash per sample.
+const vec2 diskRotation[4] = vec2[](
+	vec2(1.0, 0.0),
+	vec2(0.0, 1.0),
+	vec2(0.70710678, 0.70710678),
+	vec2(-0.70710678, 0.70710678)
+);
+
+vec2 rotate(vec2 v, vec2 cs) {
+	return vec2(v.x * cs.x - v.y * cs.y, v.x * cs.y + v.y * cs.x);
+}
+
+float shadowCoef(int shadowFilter){
 	vec4 shadow_coord2 = light_mvpMatrix * vec4(origVertex, 1.0);
 	vec3 ProjCoords = shadow_coord2.xyz / shadow_coord2.w;
 	vec2 UVCoords;
 	UVCoords.x = 0.5 * ProjCoords.x + 0.5;
 	UVCoords.y = 0.5 * ProjCoords.y + 0.5;
-	float z = 0.5 * ProjCoords.z + 0.5;
+	float z = 0.5 * ProjCoords.z + 0.5 - shadowBias;
+
+	if (shadowFilter == 0) {
+		return texture(shadowMap, vec3(UVCoords, z));
+	}
 
-	float visibility = 1.0f;
+	ivec2 pixel = ivec2(gl_FragCoord.xy) & 1;
+	vec2 cs = diskRotation[pixel.x + pixel.y * 2];
+	vec2 radius = filterRadius / vec2(textureSize(shadowMap, 0));
 
-	if (softShadow == 1) {
-		for (int i = 0; i<4; i++){
-			int index = int(4.0*random(origVertex.xyz, i)) % 4;
-			if (texture2D(shadowMap, UVCoords + poissonDisk4[index] / 3500.0).z  <  z - 0.001){
-				visibility -= 0.2;
-			}
+	float visibility = 0.0;
+	if (shadowFilter == 1) {
+		for (int i = 0; i < 4; i++){
+			visibility += texture(shadowMap, vec3(UVCoords + rotate(poissonDisk4[i], cs) * radius, z));
 		}
+		return visibility * 0.25;
 	}
 	else {
-		if (texture2D(shadowMap, UVCoords).z  <  z) {
-			visibility = 0;
+		for (int i = 0; i < 16; i++){
+			visibility += texture(shadowMap, vec3(UVCoords + rotate(poissonDisk16[i], cs) * radius, z));
 		}
+		return visibility * 0.0625;
 	}
-
-	return visibility;
 }
 
 void main(){
-	def_diffuse = outColor.xyz;
-	def_normal = varyingNormal;
-	def_originPos = origVertex;
+	def_normal = encodeNormal(varyingNormal);
+
+#ifndef LINE_ONLY
+	vec3 color = outColor.xyz;
 
 	if (textureEnabled == 1) {
-		def_diffuse = def_diffuse * texture(tex0, outUV.rg).xyz;
+		color = color * texture(tex0, outUV.rg).xyz;
 	}
 
 	float visibility = 1.0;
 	if (useShadow == 1) {
-		visibility = shadowCoef(softShadow);
+		visibility = shadowCoef(shadowFilter);
 	}
 
 	float ambient = 0.6;
@@ -108,7 +135,7 @@ void main(){
 		intensity = ambient + (visibility * 0.95 + 0.05) * diffuse;
 	}
 
-	def_intensity = vec3(intensity, intensity, intensity);
-	def_diffuse = def_diffuse * intensity;
+	def_diffuse = vec4(color * intensity, intensity);
+#endif
 }
 
@@ -7,11 +7,13 @@ layout(location = 3)in vec2 uv;
 
 out vec2 outUV;
 
+uniform bool flipY;	// write the rows top-down, so that the image can be read back without flipping
+
 uniform mat4 pMatrix;
 
 void main(){
 	outUV=uv;
 	
-	gl_Position = vec4(vertex.xy,0,1.0);
+	gl_Position = vec4(vertex.x, flipY ? -vertex.y : vertex.y, 0, 1.0);
 
 }
\ No newline at end of file
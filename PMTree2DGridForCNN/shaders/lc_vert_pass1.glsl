@@ -11,11 +11,12 @@ out vec3 origVertex;
 out vec3 varyingNormal;
 
 uniform mat4 mvpMatrix;
+uniform mat4 modelMatrix;	// uniform scale and translation only, so the normal is not transformed
 
 void main(){
 	outColor=color;
 	outUV=uv;
-	origVertex=vertex;
+	origVertex=(modelMatrix * vec4(vertex, 1.0)).xyz;
 	varyingNormal=normal;
 
 	gl_Position = mvpMatrix * vec4(origVertex,1.0);
@@ -12,11 +12,12 @@ out vec3 origVertex;// L
 out vec3 varyingNormal;
 
 uniform mat4 light_mvpMatrix;
+uniform mat4 modelMatrix;
 
 void main(){
 	outColor=color;
 	outUV=uv;
-	origVertex=vertex;
+	origVertex=(modelMatrix * vec4(vertex, 1.0)).xyz;
 
 	varyingNormal=normal;
 